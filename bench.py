@@ -0,0 +1,52 @@
+import socket
+import struct
+import sys
+import time
+
+# the host side of netbench: times UDP round trips and
+# throughput against "netbench echo" in xv6, which qemu
+# forwards this port to. prints the same name=value lines.
+
+def percentile(rtts, p):
+    if not rtts:
+        return 0
+    return int(rtts[(len(rtts) - 1) * p // 100] * 1e6)
+
+def report(name, size, window, sent, rtts, elapsed):
+    recv = len(rtts)
+    rtts.sort()
+    print ('netbench-host %s size=%d window=%d sent=%d recv=%d lost=%d '
+           'us=%d pps=%d kbps=%d p50_us=%d p90_us=%d p99_us=%d max_us=%d' %
+           (name, size, window, sent, recv, sent - recv, int(elapsed * 1e6),
+            int(recv / elapsed), int(recv * size * 8 / elapsed / 1000),
+            percentile(rtts, 50), percentile(rtts, 90),
+            percentile(rtts, 99), percentile(rtts, 100)))
+    sys.stdout.flush()
+
+# sends n datagrams of size bytes, keeping up to window in
+# flight, each carrying the time it was sent.
+def run(addr, name, size, window, n):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.settimeout(1.0)
+    pad = 'x' * (size - 8)
+    rtts = []
+    sent = 0
+    start = time.time()
+    while len(rtts) < sent or sent < n:
+        while sent < n and sent - len(rtts) < window:
+            sock.sendto(struct.pack('d', time.time()) + pad, addr)
+            sent += 1
+        try:
+            buf = sock.recv(65535)
+        except socket.timeout:
+            break
+        rtts.append(time.time() - struct.unpack('d', buf[:8])[0])
+    report(name, size, window, sent, rtts, time.time() - start)
+    sock.close()
+
+addr = ('localhost', int(sys.argv[1]))
+n = int(sys.argv[2]) if len(sys.argv) > 2 else 2000
+for size in (64, 512, 1400, 8000):
+    run(addr, 'rr', size, 1, n // 2)
+for size in (64, 512, 1400, 8000):
+    run(addr, 'stream', size, 32, n)
@@ -134,6 +134,31 @@ brelse(struct buf *b)
   release(&bcache.lock);
 }
 
+// Release a locked buffer holding file data, which the page
+// cache has too. Move it to the LRU end, so that it is recycled
+// before the metadata.
+void
+brelsedata(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("brelsedata");
+
+  releasesleep(&b->lock);
+
+  acquire(&bcache.lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    b->next->prev = b->prev;
+    b->prev->next = b->next;
+    b->prev = bcache.head.prev;
+    b->next = &bcache.head;
+    bcache.head.prev->next = b;
+    bcache.head.prev = b;
+  }
+  
+  release(&bcache.lock);
+}
+
 void
 bpin(struct buf *b) {
   acquire(&bcache.lock);
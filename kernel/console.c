@@ -21,6 +21,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "poll.h"
+#include "errno.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
@@ -55,6 +57,8 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+
+  struct wq wq;  // poll() and epoll waiters
 } cons;
 
 //
@@ -100,6 +104,10 @@ consoleread(struct file *f, int user_dst, uint64 dst, int n)
         release(&cons.lock);
         return -1;
       }
+      if(f && f->nonblock){
+        release(&cons.lock);
+        return n < target ? target - n : -EAGAIN;
+      }
       sleep(&cons.r, &cons.lock);
     }
 
@@ -133,6 +141,24 @@ consoleread(struct file *f, int user_dst, uint64 dst, int n)
   return target - n;
 }
 
+//
+// poll() and epoll support: readable once a whole
+// line (or end-of-file) has arrived.
+//
+int
+consolepoll(struct file *f, struct wqent *e)
+{
+  int mask = POLLOUT;
+
+  if(e)
+    wqadd(&cons.wq, e);
+  acquire(&cons.lock);
+  if(cons.r != cons.w)
+    mask |= POLLIN;
+  release(&cons.lock);
+  return mask;
+}
+
 //
 // the console input interrupt handler.
 // uartintr() calls this for input character.
@@ -177,6 +203,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        wqwakeup(&cons.wq);
       }
     }
     break;
@@ -189,6 +216,7 @@ void
 consoleinit(void)
 {
   initlock(&cons.lock, "cons");
+  wqinit(&cons.wq, "conswq");
 
   uartinit();
 
@@ -196,4 +224,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
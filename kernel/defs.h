@@ -10,11 +10,20 @@ struct stat;
 struct superblock;
 struct mbuf;
 struct sock;
+struct tcb;
+struct epoll;
+struct wq;
+struct wqent;
+struct vdso;
+struct uringsqe;
+struct iovec;
+struct slab;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
+void            brelsedata(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
@@ -31,6 +40,8 @@ void            pci_init();
 void            e1000_init(uint32 *);
 void            e1000_intr(void);
 int             e1000_transmit(struct mbuf*);
+void            e1000_stats(void);
+void            e1000_mcast(uint8*, int);
 
 // exec.c
 int             exec(char*, char**);
@@ -41,8 +52,15 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filewritev(struct file*, struct iovec*, int, int);
+int             filepoll(struct file*, struct wqent*);
+int             fdalloc(struct file*);
+void            fdclear(int);
+int             fdcopy(struct proc*, struct proc*);
+struct file*    fdfile(int);
 
 // fs.c
 void            fsinit(int);
@@ -59,21 +77,58 @@ void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
+uint64          ipage(struct inode*, uint);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 
 // net.c
+void            netinit(void);
+void            net_timer(void);
 void            net_rx(struct mbuf*);
 void            net_tx_udp(struct mbuf*, uint32, uint16, uint16);
+void            net_tx_tcp(struct mbuf*, uint32);
+int             net_loopback(void);
+void            nettraceinit(void);
+void            nettracedone(struct mbuf*);
+int             net_looppending(void);
+int             net_joingroup(uint32);
+void            net_leavegroup(uint32);
 
 // sysnet.c
 void            sockinit(void);
 int             sockalloc(struct file **, uint32, uint16, uint16);
 void            sockclose(struct sock*);
-int             sockwrite(struct sock*, uint64 addr, int n);
-int             sockread(struct sock*, uint64 addr, int n);
-void            sockrecvudp(struct mbuf*, uint32, uint16, uint16);
+int             sockwrite(struct sock*, uint64 addr, int n, int nonblock);
+int             sockread(struct sock*, uint64 addr, int n, int nonblock);
+void            sockrecvudp(struct mbuf*, uint32, uint16, uint16, uint32);
+int             socksetopt(struct sock*, int, int);
+int             sockstat(struct sock*, uint64 addr);
+int             socksendmmsg(struct sock*, uint64 addr, int vlen);
+int             sockrecvmmsg(struct sock*, uint64 addr, int vlen, int nonblock);
+int             sockpoll(struct sock*, struct wqent*);
+int             socktcpconnect(struct file **, uint32, uint16, uint16, int);
+int             socklisten(struct file **, uint16, int);
+int             sockaccept(struct sock*, struct file **, int);
+
+// pcap.c
+void            pcapinit(void);
+void            pcaptap(struct mbuf*, int);
+uint64          pcapopen(uint64, int);
+int             pcapwait(void);
+int             pcapunmap(pagetable_t);
+
+// tcp.c
+void            tcpinit(void);
+void            tcp_rx(struct mbuf*, uint32, uint16, uint16);
+void            tcptimer(void);
+int             tcpconnect(struct tcb**, uint32, uint16, uint16, int);
+int             tcplisten(struct tcb**, uint16, int);
+int             tcpaccept(struct tcb*, struct tcb**, int);
+int             tcpread(struct tcb*, uint64, int, int);
+int             tcpwrite(struct tcb*, uint64, int, int);
+int             tcppoll(struct tcb*, struct wqent*);
+void            tcpclose(struct tcb*);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -84,6 +139,16 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit();
+void*           kmegaalloc(void);
+void            kmegafree(void *);
+void            kincref(void *);
+int             krefcnt(void *);
+int             kfreepages(void);
+
+// slab.c
+void            slabinit(struct slab*, char*, uint);
+void*           slaballoc(struct slab*);
+void            slabfree(struct slab*, void*);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -92,11 +157,33 @@ void            begin_op(int);
 void            end_op(int);
 void            crash_op(int,int);
 
+// pagecache.c
+void            pcinit(void);
+uint64          pclookup(struct inode*, uint);
+void            pcinsert(struct inode*, uint, char*);
+uint64          pcget(struct inode*, uint, int);
+void            pcupdate(struct inode*, uint, char*, uint);
+void            pcinval(struct inode*);
+int             pcreclaim(void);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, uint64, int, int);
+int             pipewrite(struct pipe*, uint64, int, int);
+int             pipepoll(struct pipe*, int, struct wqent*);
+
+// poll.c
+void            wqinit(struct wq*, char*);
+void            wqadd(struct wq*, struct wqent*);
+void            wqdel(struct wqent*);
+void            wqwakeup(struct wq*);
+int             pollfds(uint64, int, int);
+int             epollalloc(struct file**);
+void            epollclose(struct epoll*);
+int             epollpoll(struct epoll*, struct wqent*);
+int             epollctl(struct epoll*, int, int, struct file*, uint64);
+int             epollwait(struct epoll*, uint64, int, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -119,9 +206,12 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
+void            sleepuntil(void*, struct spinlock*, uint);
 void            userinit(void);
+void            kproc(void (*)(void), char*);
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeuptimeouts(uint);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
@@ -154,6 +244,15 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// swap.c
+void            swapinit(void);
+void            swapdup(uint);
+void            swapfree(uint);
+int             swapin(uint64, pte_t*);
+int             swapreclaim(int, int);
+void            swaplow(void);
+void            swaptick(void);
+
 // syscall.c
 int             argint(int, int*);
 int             argstr(int, char*, int);
@@ -162,13 +261,21 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// sysfile.c
+int             uringop(struct uringsqe*);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
+extern struct vdso *vdso;
 void            usertrapret(void);
 
+// uring.c
+uint64          uringsetup(void);
+int             uringenter(int);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
@@ -178,22 +285,33 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+void            kvmswitch(struct proc*);
 uint64          kvmpa(uint64);
+pagetable_t     kvmcreate(void);
+void            kvmsync(pagetable_t, pagetable_t);
+void            kvmfree(pagetable_t);
 void            kvmmap(uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
-uint64          uvmalloc(pagetable_t, uint64, uint64);
+uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmfault(struct proc*, uint64);
+int             uvmfaultin(uint64, uint64);
+pte_t*          uvmpte(pagetable_t, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 
+// uaccess.S
+int             uaccesscopy(void *, void *, uint64);
+int             uaccesscopystr(char *, char *, uint64);
+
 // plic.c
 void            plicinit(void);
 void            plicinithart(void);
@@ -203,6 +321,8 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(int);
 void            virtio_disk_rw(int, struct buf *, int);
+void            virtio_disk_rwpage(int, uint64, void *, int);
+uint64          virtio_disk_capacity(int);
 void            virtio_disk_intr(int);
 
 // number of elements in fixed-size array
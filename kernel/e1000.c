@@ -7,14 +7,23 @@
 #include "defs.h"
 #include "e1000_dev.h"
 #include "net.h"
+#include "pcap.h"
+#include "netstat.h"
+#include "nettrace.h"
 
-#define TX_RING_SIZE 16
+#define TX_RING_SIZE 64
 static struct tx_desc tx_ring[TX_RING_SIZE] __attribute__((aligned(16)));
-static struct mbuf *tx_mbufs[TX_RING_SIZE];
+static struct mbuf *tx_mbufs[TX_RING_SIZE]; // on a packet's last descriptor
+static int tx_tail;  // next descriptor to fill; our copy of TDT
+static int tx_clean; // oldest descriptor not yet reclaimed
+static int tx_ctx;   // MBUF_CSUM_* flags of the last context descriptor
 
 #define RX_RING_SIZE 16
 static struct rx_desc rx_ring[RX_RING_SIZE] __attribute__((aligned(16)));
 static struct mbuf *rx_mbufs[RX_RING_SIZE];
+static struct mbuf *rx_pkt;  // the buffers of a frame still arriving
+static struct mbuf *rx_last; // the last mbuf in rx_pkt
+static int rx_drop;          // drop the rest of that frame
 
 // remember where the e1000's registers live.
 static volatile uint32 *regs;
@@ -50,6 +59,7 @@ e1000_init(uint32 *xregs)
     panic("e1000");
   regs[E1000_TDLEN] = sizeof(tx_ring);
   regs[E1000_TDH] = regs[E1000_TDT] = 0;
+  tx_tail = tx_clean = 0;
   
   // [E1000 14.4] Receive initialization
   memset(rx_ring, 0, sizeof(rx_ring));
@@ -73,6 +83,9 @@ e1000_init(uint32 *xregs)
   for (int i = 0; i < 4096/32; i++)
     regs[E1000_MTA + i] = 0;
 
+  // verify IP, TCP and UDP checksums of received packets.
+  regs[E1000_RXCSUM] = E1000_RXCSUM_IPOFL | E1000_RXCSUM_TUOFL;
+
   // transmitter control bits.
   regs[E1000_TCTL] = E1000_TCTL_EN |  // enable
     E1000_TCTL_PSP |                  // pad short packets
@@ -80,75 +93,247 @@ e1000_init(uint32 *xregs)
     (0x40 << E1000_TCTL_COLD_SHIFT);
   regs[E1000_TIPG] = 10 | (8<<10) | (6<<20); // inter-pkt gap
 
-  // receiver control bits.
+  // receiver control bits. a jumbo frame fills as many
+  // buffers as it needs, and e1000_recv() chains them.
   regs[E1000_RCTL] = E1000_RCTL_EN | // enable receiver
     E1000_RCTL_BAM |                 // enable broadcast
+    E1000_RCTL_LPE |                 // accept long (jumbo) frames
     E1000_RCTL_SZ_2048 |             // 2048-byte rx buffers
     E1000_RCTL_SECRC;                // strip CRC
   
-  // ask e1000 for receive interrupts.
+  // ask e1000 for receive interrupts, and for transmit
+  // interrupts so that sent mbufs are freed promptly.
   regs[E1000_RDTR] = 0; // interrupt after every received packet (no timer)
   regs[E1000_RADV] = 0; // interrupt after every packet (no timer)
-  regs[E1000_IMS] = (1 << 7); // RXDW -- Receiver Descriptor Write Back
+  regs[E1000_IMS] = (1 << 7) | // RXDW -- Receiver Descriptor Write Back
+    (1 << 0);                  // TXDW -- Transmit Descriptor Written Back
+}
+
+// Frees the packets the e1000 has finished sending.
+// Caller holds e1000_lock.
+static void
+e1000_txclean(void)
+{
+  while (tx_clean != tx_tail &&
+         (tx_ring[tx_clean].status & E1000_TXD_STAT_DD)) {
+    if (tx_mbufs[tx_clean]) {
+      mbuffree(tx_mbufs[tx_clean]);
+      tx_mbufs[tx_clean] = 0;
+    }
+    tx_clean = (tx_clean + 1) % TX_RING_SIZE;
+  }
+}
+
+// Fills in a context descriptor at i telling the e1000 where
+// the checksums named by csum are in the packets that follow.
+// All our packets have 14-byte Ethernet and 20-byte IP headers.
+static void
+e1000_txctx(int i, int csum)
+{
+  struct tx_ctx_desc *ctx = (struct tx_ctx_desc *)&tx_ring[i];
+  int ipoff = sizeof(struct eth);
+  int l4off = ipoff + sizeof(struct ip);
+  int tucmd = E1000_TXD_TUCMD_IP | E1000_TXD_CMD_RS | E1000_TXD_CMD_DEXT;
+
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->ipcss = ipoff;
+  ctx->ipcso = ipoff + 10;   // ip_sum
+  ctx->ipcse = l4off - 1;
+  ctx->tucss = l4off;
+  if (csum & MBUF_CSUM_TCP) {
+    ctx->tucso = l4off + 16; // tcp sum
+    tucmd |= E1000_TXD_TUCMD_TCP;
+  } else {
+    ctx->tucso = l4off + 6;  // udp sum
+  }
+  ctx->tucse = 0;
+  ctx->cmdlen = (E1000_TXD_DTYP_C << 20) | (tucmd << 24);
 }
 
+// Queues the packet held by the chain m for sending, one
+// descriptor per mbuf. Returns -1, leaving m to the caller,
+// if the ring has no room.
 int
 e1000_transmit(struct mbuf *m)
 {
-  //
-  // Your code here.
-  //
-  // the mbuf contains an ethernet frame; program it into
-  // the TX descriptor ring so that the e1000 sends it. Stash
-  // a pointer so that it can be freed after sending.
-  //
-  int position = regs[E1000_TDT];
-  if (position >= TX_RING_SIZE)
-    return -1;
-  struct tx_desc* desc = &tx_ring[position];
-  if (!(desc->status & E1000_TXD_STAT_DD))
-    return -1;
-
-  struct mbuf* mbuf = tx_mbufs[position];
-  if (mbuf)
-    mbuffree(mbuf);
-  desc->addr = (uint64)m->head;
-  desc->length = m->len;
-  desc->cmd |= E1000_TXD_CMD_EOP;
-  mbuf = m;
-  regs[E1000_TDT] = (position + 1) % TX_RING_SIZE;
+  struct tx_data_desc *data;
+  struct mbuf *seg;
+  int i, ndesc, ctx, len, csum;
+
+  acquire(&e1000_lock);
+  e1000_txclean();
+
+  // a packet that needs different checksum offsets from the
+  // last one takes an extra context descriptor first.
+  ctx = m->csum && m->csum != tx_ctx;
+  ndesc = ctx;
+  len = 0;
+  for (seg = m; seg; seg = seg->next) {
+    ndesc++;
+    len += seg->len;
+  }
+  if (ndesc > (tx_clean - tx_tail - 1 + TX_RING_SIZE) % TX_RING_SIZE) {
+    release(&e1000_lock);
+    NETSTAT_INC(txringfull);
+    return -1;  // ring full
+  }
+
+  i = tx_tail;
+  if (ctx) {
+    e1000_txctx(i, m->csum);
+    tx_ctx = m->csum;
+    i = (i + 1) % TX_RING_SIZE;
+  }
+  for (seg = m; seg; seg = seg->next) {
+    if (m->csum) {
+      data = (struct tx_data_desc *)&tx_ring[i];
+      data->addr = (uint64) seg->head;
+      data->cmdlen = seg->len | (E1000_TXD_DTYP_D << 20) |
+        ((E1000_TXD_CMD_IFCS | E1000_TXD_CMD_RS | E1000_TXD_CMD_DEXT |
+          (seg->next ? 0 : E1000_TXD_CMD_EOP)) << 24);
+      data->status = 0;
+      data->popts = 0;
+      if (m->csum & MBUF_CSUM_IP)
+        data->popts |= E1000_TXD_POPTS_IXSM;
+      if (m->csum & (MBUF_CSUM_TCP | MBUF_CSUM_UDP))
+        data->popts |= E1000_TXD_POPTS_TXSM;
+      data->special = 0;
+    } else {
+      memset(&tx_ring[i], 0, sizeof(tx_ring[i]));
+      tx_ring[i].addr = (uint64) seg->head;
+      tx_ring[i].length = seg->len;
+      tx_ring[i].cmd = E1000_TXD_CMD_RS |
+        (seg->next ? 0 : E1000_TXD_CMD_EOP);
+    }
+    // e1000_txclean() frees the chain once the e1000
+    // is done with its last descriptor.
+    tx_mbufs[i] = seg->next ? 0 : m;
+    i = (i + 1) % TX_RING_SIZE;
+  }
+
+  // once the lock is released, m may be sent and freed.
+  csum = m->csum;
+  __sync_synchronize();
+  tx_tail = i;
+  regs[E1000_TDT] = tx_tail;
+  release(&e1000_lock);
+  NETSTAT_INC(txframes);
+  NETSTAT_ADD(txbytes, len);
+  if (csum)
+    NETSTAT_INC(csumtxhw);
   return 0;
 }
 
+// Delivers packets that have arrived to the networking stack,
+// as chains of one mbuf per receive buffer they filled.
+// Only e1000_intr() calls this, and the PLIC does not raise the
+// e1000's interrupt again until it completes, so the receive ring
+// needs no lock; net_rx() may transmit, which takes e1000_lock.
 static void
 e1000_recv(void)
 {
-  //
-  // Your code here.
-  //
-  // Check for packets that have arrived from the e1000
-  // Create and deliver an mbuf for each packet (using net_rx()).
-  //
+  struct rx_desc *desc;
+  struct mbuf *m;
+  int i, status, errors;
+
   while (1) {
-    int position = (regs[E1000_RDT] + 1) % RX_RING_SIZE;
-    struct rx_desc* desc = &rx_ring[position];
-    if (!(desc->status & E1000_RXD_STAT_DD))
+    i = (regs[E1000_RDT] + 1) % RX_RING_SIZE;
+    desc = &rx_ring[i];
+    status = desc->status;
+    errors = desc->errors;
+    if (!(status & E1000_RXD_STAT_DD))
       return;
-    struct mbuf* mbuf = rx_mbufs[position];
-    mbufput(mbuf, desc->length);
-    net_rx(mbuf);
-
-    rx_mbufs[position] = mbufalloc(0);
-    desc->addr = (uint64)rx_mbufs[position]->head;
-    desc->status >>= 8;
-    regs[E1000_RDT] = position % RX_RING_SIZE;
+
+    m = rx_mbufs[i];
+    if ((rx_mbufs[i] = mbufalloc(0)) == 0) {
+      // out of memory: drop the frame and reuse its buffer.
+      rx_mbufs[i] = m;
+      rx_drop = 1;
+    } else {
+      mbufput(m, desc->length);
+      if (rx_pkt)
+        rx_last->next = m;
+      else
+        rx_pkt = m;
+      rx_last = m;
+    }
+
+    desc->addr = (uint64) rx_mbufs[i]->head;
+    desc->status = 0;
+    __sync_synchronize();
+    regs[E1000_RDT] = i;
+
+    // the last buffer of a frame carries its checksum status.
+    if (!(status & E1000_RXD_STAT_EOP))
+      continue;
+    m = rx_pkt;
+    rx_pkt = rx_last = 0;
+    if (rx_drop || m == 0) {
+      NETSTAT_INC(rxnombuf);
+      mbuffree(m);
+      rx_drop = 0;
+      continue;
+    }
+    NTRACE_STAMP(m, NTRACE_RECV);
+    NETSTAT_INC(rxframes);
+    NETSTAT_ADD(rxbytes, mbufchainlen(m));
+    if (!(status & E1000_RXD_STAT_IXSM)) {
+      if ((status & E1000_RXD_STAT_IPCS) && !(errors & E1000_RXD_ERR_IPE))
+        m->csum |= MBUF_CSUM_IP;
+      if ((status & E1000_RXD_STAT_TCPCS) && !(errors & E1000_RXD_ERR_TCPE))
+        m->csum |= MBUF_CSUM_TCP | MBUF_CSUM_UDP;
+      if (m->csum)
+        NETSTAT_INC(csumrxhw);
+    }
+    pcaptap(m, PCAP_RX);
+    net_rx(m);
+  }
+}
+
+// Adds the e1000's statistics registers, which clear when
+// read, to the netstat counters.
+void
+e1000_stats(void)
+{
+  NETSTAT_ADD(hwrxgood, regs[E1000_GPRC]);
+  NETSTAT_ADD(hwtxgood, regs[E1000_GPTC]);
+  NETSTAT_ADD(hwmissed, regs[E1000_MPC]);
+  NETSTAT_ADD(hwnobuf, regs[E1000_RNBC]);
+  NETSTAT_ADD(hwcrcerrs, regs[E1000_CRCERRS]);
+  NETSTAT_ADD(hwrxerrs, regs[E1000_RXERRC]);
+  NETSTAT_ADD(hwlenerrs, regs[E1000_RLEC]);
+  NETSTAT_ADD(hwundersize, regs[E1000_RUC]);
+  NETSTAT_ADD(hwoversize, regs[E1000_ROC]);
+}
+
+// Has the e1000 pass up frames sent to the n multicast Ethernet
+// addresses in macs, and (since the table is a hash) maybe others.
+void
+e1000_mcast(uint8 *macs, int n)
+{
+  uint32 mta[4096/32];
+  uint hash;
+  int i;
+
+  memset(mta, 0, sizeof(mta));
+  for (i = 0; i < n; i++, macs += 6) {
+    // with RCTL.MO 0, the hash is bits 47:36 of the address.
+    hash = ((macs[4] >> 4) | (macs[5] << 4)) & 0xfff;
+    mta[hash >> 5] |= 1 << (hash & 0x1f);
   }
+  acquire(&e1000_lock);
+  for (i = 0; i < 4096/32; i++)
+    regs[E1000_MTA + i] = mta[i];
+  release(&e1000_lock);
 }
 
 void
 e1000_intr(void)
 {
   e1000_recv();
+  acquire(&e1000_lock);
+  e1000_txclean();
+  release(&e1000_lock);
   // tell the e1000 we've seen this interrupt;
   // without this the e1000 won't raise any
   // further interrupts.
@@ -21,6 +21,16 @@
 #define E1000_TDLEN    (0x03808/4)  /* TX Descriptor Length - RW */
 #define E1000_TDH      (0x03810/4)  /* TX Descriptor Head - RW */
 #define E1000_TDT      (0x03818/4)  /* TX Descripotr Tail - RW */
+#define E1000_CRCERRS  (0x04000/4)  /* CRC Error Count - R/clr */
+#define E1000_RXERRC   (0x0400C/4)  /* Receive Error Count - R/clr */
+#define E1000_MPC      (0x04010/4)  /* Missed Packet Count - R/clr */
+#define E1000_RLEC     (0x04040/4)  /* Receive Length Error Count - R/clr */
+#define E1000_GPRC     (0x04074/4)  /* Good Packets RX Count - R/clr */
+#define E1000_GPTC     (0x04080/4)  /* Good Packets TX Count - R/clr */
+#define E1000_RNBC     (0x040A0/4)  /* RX No Buffers Count - R/clr */
+#define E1000_RUC      (0x040A4/4)  /* RX Undersize Count - R/clr */
+#define E1000_ROC      (0x040AC/4)  /* RX Oversize Count - R/clr */
+#define E1000_RXCSUM   (0x05000/4)  /* RX Checksum Control - RW */
 #define E1000_MTA      (0x05200/4)  /* Multicast Table Array - RW Array */
 #define E1000_RA       (0x05400/4)  /* Receive Address - RW Array */
 
@@ -89,13 +99,31 @@
 
 #define DATA_MAX 1518
 
+/* Receive Checksum Control */
+#define E1000_RXCSUM_IPOFL   0x00000100 /* IPv4 checksum offload */
+#define E1000_RXCSUM_TUOFL   0x00000200 /* TCP/UDP checksum offload */
+
 /* Transmit Descriptor command definitions [E1000 3.3.3.1] */
 #define E1000_TXD_CMD_EOP    0x01 /* End of Packet */
+#define E1000_TXD_CMD_IFCS   0x02 /* Insert FCS */
 #define E1000_TXD_CMD_RS     0x08 /* Report Status */
+#define E1000_TXD_CMD_DEXT   0x20 /* Descriptor extension (not legacy) */
 
 /* Transmit Descriptor status definitions [E1000 3.3.3.2] */
 #define E1000_TXD_STAT_DD    0x00000001 /* Descriptor Done */
 
+/* Extended descriptor types [E1000 3.3.5] */
+#define E1000_TXD_DTYP_C     0x0  /* TCP/IP context */
+#define E1000_TXD_DTYP_D     0x1  /* TCP/IP data */
+
+/* Context descriptor TUCMD bits [E1000 3.3.6] */
+#define E1000_TXD_TUCMD_TCP  0x01 /* TCP (not UDP) */
+#define E1000_TXD_TUCMD_IP   0x02 /* IPv4 (not IPv6) */
+
+/* Data descriptor POPTS bits [E1000 3.3.7] */
+#define E1000_TXD_POPTS_IXSM 0x01 /* Insert IP checksum */
+#define E1000_TXD_POPTS_TXSM 0x02 /* Insert TCP/UDP checksum */
+
 // [E1000 3.3.3]
 struct tx_desc
 {
@@ -108,9 +136,40 @@ struct tx_desc
   uint16 special;
 };
 
+// TCP/IP context descriptor [E1000 3.3.6]: sets up the checksum
+// offsets used by the data descriptors that follow it.
+struct tx_ctx_desc
+{
+  uint8 ipcss;       /* IP checksum start */
+  uint8 ipcso;       /* IP checksum offset */
+  uint16 ipcse;      /* IP checksum end (inclusive) */
+  uint8 tucss;       /* TCP/UDP checksum start */
+  uint8 tucso;       /* TCP/UDP checksum offset */
+  uint16 tucse;      /* TCP/UDP checksum end; 0 is the end of packet */
+  uint32 cmdlen;     /* paylen:20 dtyp:4 tucmd:8 */
+  uint8 status;
+  uint8 hdrlen;
+  uint16 mss;
+};
+
+// TCP/IP data descriptor [E1000 3.3.7]
+struct tx_data_desc
+{
+  uint64 addr;
+  uint32 cmdlen;     /* length:20 dtyp:4 dcmd:8 */
+  uint8 status;
+  uint8 popts;
+  uint16 special;
+};
+
 /* Receive Descriptor bit definitions [E1000 3.2.3.1] */
 #define E1000_RXD_STAT_DD       0x01    /* Descriptor Done */
 #define E1000_RXD_STAT_EOP      0x02    /* End of Packet */
+#define E1000_RXD_STAT_IXSM     0x04    /* Ignore checksum indications */
+#define E1000_RXD_STAT_TCPCS    0x20    /* TCP/UDP checksum calculated */
+#define E1000_RXD_STAT_IPCS     0x40    /* IP checksum calculated */
+#define E1000_RXD_ERR_TCPE      0x20    /* TCP/UDP checksum error */
+#define E1000_RXD_ERR_IPE       0x40    /* IP checksum error */
 
 // [E1000 3.2.3]
 struct rx_desc
@@ -0,0 +1,6 @@
+// Error numbers. System calls return -1 for most errors;
+// these are returned (negated) where the caller needs to
+// tell a particular condition apart.
+// Both the kernel and user programs use this header file.
+
+#define EAGAIN  11   // no data or space right now; try again (O_NONBLOCK)
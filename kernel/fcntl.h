@@ -2,3 +2,8 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+#define O_NONBLOCK 0x800  // reads and writes fail with -EAGAIN instead of waiting
+
+// commands for fcntl()
+#define F_GETFL   1   // return the file status flags (O_NONBLOCK)
+#define F_SETFL   2   // set the file status flags
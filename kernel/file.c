@@ -12,17 +12,23 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "poll.h"
+#include "uio.h"
+#include "slab.h"
 
 struct devsw devsw[NDEV];
 struct {
-  struct spinlock lock;
-  struct file file[NFILE];
+  struct spinlock lock;  // protects each file's ref
+  struct slab slab;      // where files come from
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  slabinit(&ftable.slab, "file", sizeof(struct file));
+  if(NOFILE * sizeof(struct file*) > PGSIZE || NOFILE % 64 != 0)
+    panic("fileinit");
 }
 
 // Allocate a file structure.
@@ -31,16 +37,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = slaballoc(&ftable.slab)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -72,6 +73,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  slabfree(&ftable.slab, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -81,7 +83,88 @@ fileclose(struct file *f)
     end_op(ff.ip->dev);
   } else if (ff.type == FD_SOCK) {
     sockclose(ff.sock);
+  } else if(ff.type == FD_EPOLL){
+    epollclose(ff.ep);
+  }
+}
+
+// Moves p's descriptor table to a page of its own, with room
+// for NOFILE. Returns -1 if it is there already, or there is
+// no memory.
+static int
+fdgrow(struct proc *p)
+{
+  struct file **ofile;
+
+  if(p->nofile == NOFILE || (ofile = kalloc()) == 0)
+    return -1;
+  memset(ofile, 0, PGSIZE);
+  memmove(ofile, p->ofile, p->nofile * sizeof(ofile[0]));
+  p->ofile = ofile;
+  p->nofile = NOFILE;
+  return 0;
+}
+
+// Allocate the lowest free file descriptor of the current
+// process for f. Takes over file reference from caller on
+// success.
+int
+fdalloc(struct file *f)
+{
+  struct proc *p = myproc();
+  uint64 used;
+  int i, fd;
+
+  for(i = 0; i < NOFILE/64; i++){
+    if((used = p->fdused[i]) == ~0UL)
+      continue;
+    for(fd = i*64; used & 1; fd++)
+      used >>= 1;
+    if(fd >= p->nofile && fdgrow(p) < 0)
+      return -1;
+    p->fdused[i] |= 1UL << (fd % 64);
+    p->ofile[fd] = f;
+    return fd;
   }
+  return -1;
+}
+
+// The file that the current process's descriptor fd refers
+// to, or 0.
+struct file*
+fdfile(int fd)
+{
+  struct proc *p = myproc();
+
+  if(fd < 0 || fd >= p->nofile)
+    return 0;
+  return p->ofile[fd];
+}
+
+// Free the current process's descriptor fd, leaving the file
+// it referred to for the caller to close.
+void
+fdclear(int fd)
+{
+  struct proc *p = myproc();
+
+  p->ofile[fd] = 0;
+  p->fdused[fd / 64] &= ~(1UL << (fd % 64));
+}
+
+// Give np, which fork() made, the same descriptors as p.
+int
+fdcopy(struct proc *np, struct proc *p)
+{
+  int fd;
+
+  if(p->nofile > np->nofile && fdgrow(np) < 0)
+    return -1;
+  for(fd = 0; fd < p->nofile; fd++)
+    if(p->ofile[fd])
+      np->ofile[fd] = filedup(p->ofile[fd]);
+  memmove(np->fdused, p->fdused, sizeof(p->fdused));
+  return 0;
 }
 
 // Get metadata about file f.
@@ -103,34 +186,91 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Report which POLL* events f is ready for. If e is non-zero,
+// first add it to the wait queue of the object behind f, so that
+// e->notify is called whenever f may have become ready.
+int
+filepoll(struct file *f, struct wqent *e)
+{
+  if(f->type == FD_PIPE){
+    return pipepoll(f->pipe, f->writable, e);
+  } else if(f->type == FD_SOCK){
+    return sockpoll(f->sock, e);
+  } else if(f->type == FD_EPOLL){
+    return epollpoll(f->ep, e);
+  } else if(f->type == FD_DEVICE){
+    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].poll)
+      return POLLIN | POLLOUT;
+    return devsw[f->major].poll(f, e);
+  }
+  // reading and writing files never waits for long.
+  return POLLIN | POLLOUT;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
 fileread(struct file *f, uint64 addr, int n)
 {
-  int r = 0;
+  struct iovec iov;
+
+  iov.base = addr;
+  iov.len = n;
+  return filereadv(f, &iov, 1, -1);
+}
+
+// Read from file f into the iovcnt buffers at iov, in order,
+// at offset off, or at f->off, advancing it, if off is -1.
+// The buffers' addresses are user virtual addresses.
+// Only inodes have offsets to read at.
+int
+filereadv(struct file *f, struct iovec *iov, int iovcnt, int off)
+{
+  uint poff = off, *offp = off < 0 ? &f->off : &poff;
+  int i, r, n, nonblock, ret = 0;
+  uint64 addr;
 
   if(f->readable == 0)
     return -1;
+  if(off >= 0 && f->type != FD_INODE)
+    return -1;
 
-  if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
-  } else if (f->type == FD_SOCK) {
-    r = sockread(f->sock, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
-      return -1;
-    r = devsw[f->major].read(f, 1, addr, n);
-  } else if(f->type == FD_INODE){
+  if(f->type == FD_INODE)
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
-  } else {
-    panic("fileread");
+  for(i = 0; i < iovcnt; i++){
+    addr = iov[i].base;
+    n = iov[i].len;
+    // once some bytes are in, don't wait for more.
+    nonblock = f->nonblock || ret > 0;
+    if(f->type == FD_PIPE){
+      r = piperead(f->pipe, addr, n, nonblock);
+    } else if (f->type == FD_SOCK) {
+      r = sockread(f->sock, addr, n, nonblock);
+    } else if(f->type == FD_DEVICE){
+      if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
+        return -1;
+      r = devsw[f->major].read(f, 1, addr, n);
+    } else if(f->type == FD_INODE){
+      if((r = readi(f->ip, 1, addr, *offp, n)) > 0)
+        *offp += r;
+    } else {
+      panic("fileread");
+    }
+    if(r < 0){
+      if(ret == 0)
+        ret = r;
+      break;
+    }
+    ret += r;
+    // a device can't be told not to wait, so it only
+    // fills the first buffer.
+    if(r < n || f->type == FD_DEVICE)
+      break;
   }
+  if(f->type == FD_INODE)
+    iunlock(f->ip);
 
-  return r;
+  return ret;
 }
 
 // Write to file f.
@@ -138,28 +278,60 @@ fileread(struct file *f, uint64 addr, int n)
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
+
+  iov.base = addr;
+  iov.len = n;
+  return filewritev(f, &iov, 1, -1);
+}
+
+// Where the byte pos bytes into the iovcnt buffers at iov is,
+// in *addr; returns how many bytes from there are in the same
+// buffer.
+static int
+iovat(struct iovec *iov, int iovcnt, int pos, uint64 *addr)
+{
+  int i;
+
+  for(i = 0; i < iovcnt; pos -= iov[i].len, i++){
+    if(pos < iov[i].len){
+      *addr = iov[i].base + pos;
+      return iov[i].len - pos;
+    }
+  }
+  panic("iovat");
+}
+
+// Write the iovcnt buffers at iov, in order, to file f, at
+// offset off, or at f->off, advancing it, if off is -1. The
+// buffers' addresses are user virtual addresses. Only inodes
+// have offsets to write at.
+int
+filewritev(struct file *f, struct iovec *iov, int iovcnt, int off)
+{
+  uint poff = off, *offp = off < 0 ? &f->off : &poff;
+  int i, r, n, ret = 0;
+  uint64 addr;
 
   if(f->writable == 0)
     return -1;
+  if(off >= 0 && f->type != FD_INODE)
+    return -1;
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if (f->type == FD_SOCK) {
-    ret = sockwrite(f->sock, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
-      return -1;
-    ret = devsw[f->major].write(f, 1, addr, n);
-  } else if(f->type == FD_INODE){
+  if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
     // i-node, indirect block, allocation blocks,
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
+    // the buffers share transactions, so that a small
+    // writev() takes just one.
     int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
+    int j, m;
+    for(n = 0, i = 0; i < iovcnt; i++)
+      n += iov[i].len;
+    i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
@@ -167,20 +339,49 @@ filewrite(struct file *f, uint64 addr, int n)
 
       begin_op(f->ip->dev);
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
+      for(j = 0, r = 0; j < n1; j += r){
+        m = iovat(iov, iovcnt, i + j, &addr);
+        if(m > n1 - j)
+          m = n1 - j;
+        if((r = writei(f->ip, 1, addr, *offp, m)) > 0)
+          *offp += r;
+        if(r != m)
+          break;
+      }
       iunlock(f->ip);
       end_op(f->ip->dev);
 
       if(r < 0)
         break;
-      if(r != n1)
+      if(j != n1)
         panic("short filewrite");
-      i += r;
+      i += j;
+    }
+    return i == n ? n : -1;
+  }
+
+  for(i = 0; i < iovcnt; i++){
+    addr = iov[i].base;
+    n = iov[i].len;
+    if(f->type == FD_PIPE){
+      r = pipewrite(f->pipe, addr, n, f->nonblock);
+    } else if (f->type == FD_SOCK) {
+      r = sockwrite(f->sock, addr, n, f->nonblock);
+    } else if(f->type == FD_DEVICE){
+      if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+        return -1;
+      r = devsw[f->major].write(f, 1, addr, n);
+    } else {
+      panic("filewrite");
+    }
+    if(r < 0){
+      if(ret == 0)
+        ret = r;
+      break;
     }
-    ret = (i == n ? n : -1);
-  } else {
-    panic("filewrite");
+    ret += r;
+    if(r < n)
+      break;
   }
 
   return ret;
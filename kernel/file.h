@@ -1,12 +1,14 @@
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE, FD_SOCK } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE, FD_SOCK, FD_EPOLL } type;
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;     // O_NONBLOCK
   struct net *net;   // FD_NET
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   struct sock *sock; // FD_SOCK
+  struct epoll *ep;  // FD_EPOLL
   uint off;          // FD_INODE and FD_DEVICE
   short major;       // FD_DEVICE
   short minor;       // FD_DEVICE
@@ -32,13 +34,32 @@ struct inode {
   uint addrs[NDIRECT+1];
 };
 
+// a wait queue, for poll() and epoll to learn when
+// a pipe, socket or device may have become ready.
+struct wq {
+  struct spinlock lock;
+  struct wqent *head;
+};
+
+// an entry on a wait queue. wqwakeup() calls notify(e)
+// with the object's lock and the queue's lock held.
+struct wqent {
+  struct wqent *next;
+  struct wq *wq;           // queue this entry is on, or 0
+  void (*notify)(struct wqent *);
+  void *arg;
+};
+
 // map major device number to device functions.
 struct devsw {
   int (*read)(struct file *, int, uint64, int);
   int (*write)(struct file *, int, uint64, int);
+  int (*poll)(struct file *, struct wqent *);
 };
 
 extern struct devsw devsw[];
 
 #define DISK 0
 #define CONSOLE 1
+// NETSTAT (2) is in netstat.h, for user programs too
+// NETTRACE (3) is in nettrace.h, for user programs too
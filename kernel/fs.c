@@ -417,6 +417,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcinval(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -452,15 +453,48 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Page pgno of the contents of ip, a file, from the page cache,
+// read in if it isn't there; zeros past the end of the file.
+// Returns its physical address, with a reference for the caller
+// to kfree(), or 0 if out of memory.
+// Caller must hold ip->lock.
+uint64
+ipage(struct inode *ip, uint pgno)
+{
+  struct buf *bp;
+  char *mem;
+  uint64 pa;
+  uint off, n, i;
+
+  if((pa = pclookup(ip, pgno)) != 0)
+    return pa;
+  if((mem = kalloc()) == 0)
+    return 0;
+  off = pgno * PGSIZE;
+  n = off < ip->size ? min(ip->size - off, PGSIZE) : 0;
+  for(i = 0; i < n; i += BSIZE){
+    bp = bread(ip->dev, bmap(ip, (off + i) / BSIZE));
+    memmove(mem + i, bp->data, min(n - i, BSIZE));
+    brelsedata(bp);
+  }
+  memset(mem + n, 0, PGSIZE - n);
+  pcinsert(ip, pgno, mem);
+  return (uint64)mem;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
+// The data of files comes from the page cache, and only that of
+// directories from the buffer cache.
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  uint64 pa;
+  int r;
 
   if(off > ip->size || off + n < off)
     return -1;
@@ -468,13 +502,20 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+    if(ip->type == T_FILE){
+      if((pa = ipage(ip, off/PGSIZE)) == 0)
+        return -1;
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      r = either_copyout(user_dst, dst, (char*)pa + (off % PGSIZE), m);
+      kfree((void*)pa);
+    } else {
+      bp = bread(ip->dev, bmap(ip, off/BSIZE));
+      m = min(n - tot, BSIZE - off%BSIZE);
+      r = either_copyout(user_dst, dst, bp->data + (off % BSIZE), m);
       brelse(bp);
-      break;
     }
-    brelse(bp);
+    if(r == -1)
+      break;
   }
   return n;
 }
@@ -483,6 +524,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
 // otherwise, src is a kernel address.
+// A file's data goes into the page cache too, and its blocks to
+// the back of the buffer cache once the log is done with them.
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
@@ -502,7 +545,12 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       break;
     }
     log_write(bp);
-    brelse(bp);
+    if(ip->type == T_FILE){
+      pcupdate(ip, off, (char*)bp->data + (off % BSIZE), m);
+      brelsedata(bp);
+    } else {
+      brelse(bp);
+    }
   }
 
   if(n > 0){
@@ -1,6 +1,14 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// and whole aligned 2MB megapages for user megapage mappings.
+//
+// Free memory that makes up an entire megapage is kept as one,
+// and split into pages only when no loose pages are left.
+// Freeing the last page of a split megapage joins it again.
+//
+// A page can be shared, by processes and the page cache; kfree()
+// only frees it once each kincref() has been matched.
 
 #include "types.h"
 #include "param.h"
@@ -14,19 +22,27 @@ void freerange(void *pa_start, void *pa_end);
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
-struct run {
-  struct run *next;
-};
+#define NMEGA ((PHYSTOP - KERNBASE) / MEGAPGSIZE)
+#define MEGA(pa) (((uint64)(pa) - KERNBASE) / MEGAPGSIZE)
+#define NPAGE ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PAGE(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
 
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct list pages;     // free pages, not part of a free megapage
+  struct list megas;     // free megapages
+  int nfree[NMEGA];      // how many of each megapage's pages are in pages
+  int npages;            // free pages, counting those of free megapages
+  uint16 ref[NPAGE];     // references to each page; 0 if it's one
+                         // of a megapage's, or free
 } kmem;
 
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  lst_init(&kmem.pages);
+  lst_init(&kmem.megas);
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -46,37 +62,146 @@ freerange(void *pa_start, void *pa_end)
 void
 kfree(void *pa)
 {
-  struct run *r;
+  char *base, *p;
+  int m;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  acquire(&kmem.lock);
+  if(kmem.ref[PAGE(pa)] > 1){
+    kmem.ref[PAGE(pa)]--;
+    release(&kmem.lock);
+    return;
+  }
+  kmem.ref[PAGE(pa)] = 0;
+  release(&kmem.lock);
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
-  r = (struct run*)pa;
+  acquire(&kmem.lock);
+  lst_push(&kmem.pages, pa);
+  kmem.npages++;
+  m = MEGA(pa);
+  if(++kmem.nfree[m] == MEGAPGSIZE / PGSIZE){
+    // the whole megapage is free.
+    base = (char*)KERNBASE + m * MEGAPGSIZE;
+    for(p = base; p < base + MEGAPGSIZE; p += PGSIZE)
+      lst_remove((struct list*)p);
+    kmem.nfree[m] = 0;
+    lst_push(&kmem.megas, base);
+  }
+  release(&kmem.lock);
+}
+
+// Take a free page off the lists, or return 0.
+static char *
+kpop(void)
+{
+  char *base, *p, *r = 0;
+  int low;
 
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  if(lst_empty(&kmem.pages) && !lst_empty(&kmem.megas)){
+    base = lst_pop(&kmem.megas);
+    for(p = base; p < base + MEGAPGSIZE; p += PGSIZE)
+      lst_push(&kmem.pages, p);
+    kmem.nfree[MEGA(base)] = MEGAPGSIZE / PGSIZE;
+  }
+  if(!lst_empty(&kmem.pages)){
+    r = lst_pop(&kmem.pages);
+    kmem.nfree[MEGA(r)]--;
+    kmem.ref[PAGE(r)] = 1;
+    kmem.npages--;
+  }
+  low = kmem.npages < SWAPLOW;
   release(&kmem.lock);
+  if(low)
+    swaplow();
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// When there is none free, takes some back from the page cache.
 void *
 kalloc(void)
 {
-  struct run *r;
+  char *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
+  if((r = kpop()) == 0 && pcreclaim() > 0)
+    r = kpop();
   if(r)
-    kmem.freelist = r->next;
+    memset(r, 5, PGSIZE); // fill with junk
+  return (void*)r;
+}
+
+// Allocate an aligned 2MB megapage, which isn't filled with
+// junk; its users clear it. Returns 0 if there is none free.
+void *
+kmegaalloc(void)
+{
+  void *r = 0;
+  int low;
+
+  acquire(&kmem.lock);
+  if(!lst_empty(&kmem.megas)){
+    r = lst_pop(&kmem.megas);
+    kmem.npages -= MEGAPGSIZE / PGSIZE;
+  }
+  low = kmem.npages < SWAPLOW;
   release(&kmem.lock);
+  if(low)
+    swaplow();
+  return r;
+}
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
-  return (void*)r;
+// Free a megapage from kmegaalloc(). Its pages may instead be
+// freed one by one with kfree().
+void
+kmegafree(void *pa)
+{
+  if(((uint64)pa % MEGAPGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kmegafree");
+
+  acquire(&kmem.lock);
+  lst_push(&kmem.megas, pa);
+  kmem.npages += MEGAPGSIZE / PGSIZE;
+  release(&kmem.lock);
+}
+
+// How many pages are free.
+int
+kfreepages(void)
+{
+  return kmem.npages;
+}
+
+// Take another reference to the allocated page pa, which the
+// next kfree() of it then only drops.
+void
+kincref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kincref");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PAGE(pa)] == 0)
+    kmem.ref[PAGE(pa)] = 1;
+  kmem.ref[PAGE(pa)]++;
+  release(&kmem.lock);
+}
+
+// How many references there are to the allocated page pa.
+int
+krefcnt(void *pa)
+{
+  int n;
+
+  acquire(&kmem.lock);
+  n = kmem.ref[PAGE(pa)];
+  release(&kmem.lock);
+  return n ? n : 1;
 }
@@ -30,11 +30,17 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode cache
+    pcinit();        // page cache
     fileinit();      // file table
     virtio_disk_init(minor(ROOTDEV)); // emulated hard disk
     pci_init();
+    netinit();
+    pcapinit();
+    nettraceinit();
     sockinit();
+    tcpinit();
     userinit();      // first user process
+    swapinit();      // swap disk and kswapd
     __sync_synchronize();
     started = 1;
   } else {
@@ -65,6 +65,28 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   MAXUSZ (the heap ends below here)
+//   ...
+//   URING (the process's struct uring, if uringsetup() mapped it)
+//   VDSO (struct vdso, read-only)
+//   PCAPRING (the packet capture ring, if mapped by pcapopen())
+//   ...
 //   TRAPFRAME (p->tf, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// each process's kernel page table maps its memory below
+// MAXUSZ at the same addresses, so that copyin() and copyout()
+// can use user pointers directly. the kernel maps nothing of
+// its own below here.
+#define MAXUSZ PLIC
+
+// below the kernel stacks: kernel mappings are global, in every
+// address space, so no user mapping may share their addresses.
+#define PCAPRING (KSTACK(NPROC) - 32*PGSIZE)
+
+// the vDSO page, in every process, just below the ring.
+#define VDSO (PCAPRING - PGSIZE)
+
+// below it, the submission and completion rings.
+#define URING (VDSO - PGSIZE)
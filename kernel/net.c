@@ -8,12 +8,127 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
 #include "net.h"
+#include "pcap.h"
+#include "netstat.h"
+#include "nettrace.h"
 #include "defs.h"
 
+struct netstat netstat;
+
 static uint32 local_ip = MAKE_IP_ADDR(10, 0, 2, 15); // qemu's idea of the guest IP
+static uint32 netmask = MAKE_IP_ADDR(255, 255, 255, 0);
+static uint32 gateway_ip = MAKE_IP_ADDR(10, 0, 2, 2); // qemu's router
 static uint8 local_mac[ETHADDR_LEN] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };
 static uint8 broadcast_mac[ETHADDR_LEN] = { 0xFF, 0XFF, 0XFF, 0XFF, 0XFF, 0XFF };
+static uint8 zero_mac[ETHADDR_LEN];
+
+// have the e1000 compute outgoing IP, TCP and UDP checksums.
+// clear this to compute them in software instead.
+static int csum_offload = 1;
+
+// protects the extdone counts of zero-copy mbufs.
+static struct spinlock extlock;
+
+// the largest IP packet we send without fragmenting it. qemu's
+// user-mode network carries standard frames only; on a link that
+// takes jumbo frames this can be ETH_JUMBO_MTU.
+static int mtu = ETH_MTU;
+
+// the identification field of the next IP packet we send.
+static uint ip_id;
+
+//
+// the ARP neighbor cache, mapping IP addresses on the local
+// network to Ethernet addresses.
+//
+
+#define NARP            16
+#define ARP_REACHABLE   600 // ticks a learned address stays valid
+#define ARP_RETRY       10  // ticks between unanswered requests
+#define ARP_MAXTRIES    3
+#define ARP_MAXPENDING  8   // packets held per unresolved address
+
+enum { ARP_FREE, ARP_INCOMPLETE, ARP_RESOLVED };
+
+struct arpent {
+  int state;
+  uint32 ip;
+  uint8 mac[ETHADDR_LEN];
+  uint expire;          // RESOLVED: when to forget mac; INCOMPLETE: when to ask again
+  int tries;            // requests sent while INCOMPLETE
+  struct mbufq pending; // IP packets waiting for mac
+  int npending;
+};
+
+static struct spinlock arplock;
+static struct arpent arptable[NARP];
+
+//
+// IP reassembly. The fragments of a datagram are held, sorted by
+// offset, until all of them have arrived or IPQ_TIMEOUT passes.
+//
+
+#define NIPQ          8
+#define IPQ_TIMEOUT   300 // ticks to wait for the rest of a datagram
+#define IPQ_MAXFRAGS  64  // fragments held per datagram
+
+struct ipq {
+  int used;
+  uint32 src, dst;     // the addresses, identification and
+  uint16 id;           // protocol that the fragments share
+  uint8 p;
+  uint expire;         // when to give up on the datagram
+  struct mbuf *frags;  // fragments sorted by offset, linked by nextpkt
+  int nfrags;
+  unsigned int have;   // payload bytes held
+  unsigned int total;  // payload length; 0 until the last fragment arrives
+};
+
+static struct spinlock ipqlock;
+static struct ipq ipqtable[NIPQ];
+
+// the IP header pulled from the front of fragment m. ip_reass()
+// keeps the fragment's offset and payload length there, in bytes
+// and host order.
+#define FRAGHDR(m) ((struct ip *)((m)->head - sizeof(struct ip)))
+
+//
+// the loopback interface. packets sent to ourselves wait in
+// loopq until net_loopback() passes them to net_rx_ip(), so
+// that a sender holding locks isn't re-entered by its own
+// packet on the way back in.
+//
+
+#define LOOP_MAXQ 256
+
+static struct spinlock looplock;
+static struct mbufq loopq;
+static int loopqlen;
+static int loopbusy;    // some hart is running net_loopback()
+
+//
+// the multicast groups that sockets have joined. the e1000
+// passes up frames sent to their Ethernet addresses, and IP
+// takes the packets sent to the groups themselves.
+//
+
+#define NMCAST 16
+
+struct mcastent {
+  uint32 addr;
+  int refs;             // sockets in the group; 0 if free
+};
+
+static struct spinlock mcastlock;
+static struct mcastent mcasttable[NMCAST];
+
+static int net_tx_arp(uint16 op, uint8 dmac[ETHADDR_LEN], uint32 dip);
+static void net_rx_ip(struct mbuf *m, int loop);
+static int mcast_joined(uint32 addr);
 
 // Strips data from the start of the buffer and returns a pointer to it.
 // Returns 0 if less than the full requested length is available.
@@ -73,29 +188,202 @@ mbufalloc(unsigned int headroom)
   if (m == 0)
     return 0;
   m->next = 0;
+  m->nextpkt = 0;
   m->head = (char *)m->buf + headroom;
   m->len = 0;
+  m->csum = 0;
+  m->extdone = 0;
+  m->shared = 0;
+  m->refcnt = 1;
+  memset(m->tstamp, 0, sizeof(m->tstamp));
   memset(m->buf, 0, sizeof(m->buf));
   return m;
 }
 
-// Frees a packet buffer.
+// Drops a reference to the single mbuf m, freeing it (and
+// releasing what it points into) with the last one.
+static void
+mbufrele(struct mbuf *m)
+{
+  if (__sync_sub_and_fetch(&m->refcnt, 1) > 0)
+    return;
+  if (m->shared)
+    mbufrele(m->shared);
+  if (m->extdone) {
+    acquire(&extlock);
+    if (--*m->extdone == 0)
+      wakeup(m->extdone);
+    release(&extlock);
+  }
+  kfree(m);
+}
+
+// Frees a packet buffer, along with the rest of its chain.
 void
 mbuffree(struct mbuf *m)
 {
-  kfree(m);
+  struct mbuf *next;
+
+  for (; m; m = next) {
+    next = m->next;
+    mbufrele(m);
+  }
+}
+
+// Returns a chain holding the same packet as the chain m, whose
+// mbufs point into m's instead of copying them, or 0 if out of
+// memory. m and the clone are freed separately. Neither may be
+// written to while the other is in use.
+struct mbuf *
+mbufclone(struct mbuf *m)
+{
+  struct mbuf *c, *head, **tail;
+
+  head = 0;
+  tail = &head;
+  for (; m; m = m->next) {
+    if ((c = kalloc()) == 0) {
+      mbuffree(head);
+      return 0;
+    }
+    c->next = 0;
+    c->nextpkt = 0;
+    c->head = m->head;
+    c->len = m->len;
+    c->csum = m->csum;
+    c->extdone = 0;
+    c->refcnt = 1;
+    memmove(c->tstamp, m->tstamp, sizeof(c->tstamp));
+    // point straight at the mbuf that owns the bytes.
+    c->shared = m->shared ? m->shared : m;
+    __sync_fetch_and_add(&c->shared->refcnt, 1);
+    *tail = c;
+    tail = &c->next;
+  }
+  return head;
+}
+
+// Returns the length of the packet held by the chain m.
+unsigned int
+mbufchainlen(struct mbuf *m)
+{
+  unsigned int len;
+
+  for (len = 0; m; m = m->next)
+    len += m->len;
+  return len;
+}
+
+// Shortens the packet held by the chain m to len bytes, freeing
+// any mbufs after the one holding the last of them.
+void
+mbufchaintrim(struct mbuf *m, unsigned int len)
+{
+  struct mbuf *rest;
+
+  for (; m; m = m->next) {
+    if (m->len >= len) {
+      m->len = len;
+      rest = m->next;
+      m->next = 0;
+      mbuffree(rest);
+      return;
+    }
+    len -= m->len;
+  }
+}
+
+// Copies len bytes, starting off bytes into the packet held by
+// the chain src, onto the end of the chain m, adding mbufs to m
+// as its tailroom runs out. Returns -1 if out of memory, or if
+// src is too short.
+int
+mbufappend(struct mbuf *m, struct mbuf *src, unsigned int off,
+           unsigned int len)
+{
+  unsigned int c, room;
+
+  while (m->next)
+    m = m->next;
+  while (src && off >= src->len) {
+    off -= src->len;
+    src = src->next;
+  }
+  while (len > 0) {
+    if (src == 0)
+      return -1;
+    // the head of a zero-copy mbuf or a clone is not in its buf.
+    room = m->extdone || m->shared ? 0 :
+           m->buf + MBUF_SIZE - (m->head + m->len);
+    if (room == 0) {
+      if ((m->next = mbufalloc(0)) == 0)
+        return -1;
+      m = m->next;
+      room = MBUF_SIZE;
+    }
+    c = src->len - off;
+    if (c > len)
+      c = len;
+    if (c > room)
+      c = room;
+    memmove(mbufput(m, c), src->head + off, c);
+    len -= c;
+    off += c;
+    if (off == src->len) {
+      off = 0;
+      src = src->next;
+    }
+  }
+  return 0;
+}
+
+// Returns the packet held by m in a single mbuf, copying a chain
+// into a new one. Frees m, and returns 0, if it doesn't fit.
+struct mbuf *
+mbufflatten(struct mbuf *m)
+{
+  struct mbuf *n;
+  unsigned int len;
+
+  if (m->next == 0)
+    return m;
+  len = mbufchainlen(m);
+  n = 0;
+  if (len <= MBUF_SIZE && (n = mbufalloc(0)) != 0) {
+    if (mbufappend(n, m, 0, len) < 0) {
+      mbuffree(n);
+      n = 0;
+    } else {
+      n->csum = m->csum;
+    }
+  }
+  mbuffree(m);
+  return n;
+}
+
+// Waits until every zero-copy fragment counted by *extdone has
+// been freed, i.e. sent or dropped, so that the sender may reuse
+// its pages. Ignores kill, since the e1000 may still be reading
+// those pages.
+void
+mbufwait(int *extdone)
+{
+  acquire(&extlock);
+  while (*extdone > 0)
+    sleep(extdone, &extlock);
+  release(&extlock);
 }
 
 // Pushes an mbuf to the end of the queue.
 void
 mbufq_pushtail(struct mbufq *q, struct mbuf *m)
 {
-  m->next = 0;
+  m->nextpkt = 0;
   if (!q->head){
     q->head = q->tail = m;
     return;
   }
-  q->tail->next = m;
+  q->tail->nextpkt = m;
   q->tail = m;
 }
 
@@ -106,7 +394,7 @@ mbufq_pophead(struct mbufq *q)
   struct mbuf *head = q->head;
   if (!head)
     return 0;
-  q->head = head->next;
+  q->head = head->nextpkt;
   return head;
 }
 
@@ -124,78 +412,551 @@ mbufq_init(struct mbufq *q)
   q->head = 0;
 }
 
-// This code is lifted from FreeBSD's ping.c, and is copyright by the Regents
-// of the University of California.
-static unsigned short
-in_cksum(const unsigned char *addr, int len)
+// The Internet checksum (RFC 1071) is the ones'-complement sum of
+// 16-bit words, and the order in which the words are added doesn't
+// matter. So we add eight bytes at a time into a 64-bit accumulator,
+// adding the carry back in (the end-around carry), and fold the
+// result down to 16 bits at the end. Loads are little-endian, but
+// the sum comes out in network order all the same.
+//
+// in_cksum_add() adds len bytes at addr to a running sum, so that a
+// checksum can cover more than one buffer; all but the last must
+// have an even length.
+static unsigned int
+in_cksum_add(unsigned int sum, const unsigned char *addr, int len)
 {
-  int nleft = len;
-  const unsigned short *w = (const unsigned short *)addr;
-  unsigned int sum = 0;
-  unsigned short answer = 0;
+  uint64 acc, w;
+  int odd;
 
-  /*
-   * Our algorithm is simple, using a 32 bit accumulator (sum), we add
-   * sequential 16 bit words to it, and at the end, fold back all the
-   * carry bits from the top 16 bits into the lower 16 bits.
-   */
-  while (nleft > 1)  {
-    sum += *w++;
-    nleft -= 2;
+  acc = 0;
+  // start from an even address. if addr is odd, every word is
+  // loaded a byte out of step, which byte-swaps the final sum.
+  odd = (uint64)addr & 1;
+  if (odd && len > 0) {
+    acc = (uint64)*addr << 8;
+    addr++;
+    len--;
   }
-
-  /* mop up an odd byte, if necessary */
-  if (nleft == 1) {
-    *(unsigned char *)(&answer) = *(const unsigned char *)w;
-    sum += answer;
+  // then from an 8-byte boundary, so the 64-bit loads are aligned.
+  while (((uint64)addr & 7) && len >= 2) {
+    acc += *(const uint16 *)addr;
+    addr += 2;
+    len -= 2;
+  }
+  while (len >= 32) {
+    w = *(const uint64 *)addr;
+    acc += w;
+    acc += (acc < w);
+    w = *(const uint64 *)(addr + 8);
+    acc += w;
+    acc += (acc < w);
+    w = *(const uint64 *)(addr + 16);
+    acc += w;
+    acc += (acc < w);
+    w = *(const uint64 *)(addr + 24);
+    acc += w;
+    acc += (acc < w);
+    addr += 32;
+    len -= 32;
   }
+  while (len >= 8) {
+    w = *(const uint64 *)addr;
+    acc += w;
+    acc += (acc < w);
+    addr += 8;
+    len -= 8;
+  }
+  // fold to 32 bits before adding the tail, which can't overflow that.
+  acc = (acc & 0xffffffff) + (acc >> 32);
+  acc = (acc & 0xffffffff) + (acc >> 32);
+  while (len >= 2) {
+    acc += *(const uint16 *)addr;
+    addr += 2;
+    len -= 2;
+  }
+  // mop up an odd byte, if necessary
+  if (len == 1)
+    acc += *addr;
 
-  /* add back carry outs from top 16 bits to low 16 bits */
+  acc = (acc & 0xffff) + (acc >> 16);
+  acc = (acc & 0xffff) + (acc >> 16);
+  acc = (acc & 0xffff) + (acc >> 16);
+  if (odd)
+    acc = ((acc & 0xff) << 8) | (acc >> 8);
+  return sum + acc;
+}
+
+static unsigned short
+in_cksum_fold(unsigned int sum)
+{
+  // add back carry outs from top 16 bits to low 16 bits
   sum = (sum & 0xffff) + (sum >> 16);
   sum += (sum >> 16);
-  /* guaranteed now that the lower 16 bits of sum are correct */
+  return ~sum; // truncate to 16 bits
+}
+
+static unsigned short
+in_cksum(const unsigned char *addr, int len)
+{
+  return in_cksum_fold(in_cksum_add(0, addr, len));
+}
+
+// Returns the (unfolded) sum of the IP pseudo-header that TCP
+// and UDP checksums cover, for a segment of len bytes.
+static unsigned int
+in_cksum_phdr(uint8 proto, uint32 sip, uint32 dip, int len)
+{
+  struct {
+    uint32 sip, dip;
+    uint8  zero, proto;
+    uint16 len;
+  } ph;
+
+  ph.sip = htonl(sip);
+  ph.dip = htonl(dip);
+  ph.zero = 0;
+  ph.proto = proto;
+  ph.len = htons(len);
+  return in_cksum_add(0, (unsigned char *)&ph, sizeof(ph));
+}
+
+// Checksums a TCP or UDP segment of len bytes at addr, along with
+// the IP pseudo-header that those checksums also cover.
+static unsigned short
+in_cksum_pseudo(const unsigned char *addr, int len, uint8 proto,
+                uint32 sip, uint32 dip)
+{
+  return in_cksum_fold(in_cksum_add(in_cksum_phdr(proto, sip, dip, len),
+                                    addr, len));
+}
+
+// Adds the packet held by the chain m to a running sum. Unlike
+// in_cksum_add(), segments may have odd lengths: a segment that
+// starts at an odd offset into the packet has its sum byte-swapped.
+static unsigned int
+in_cksum_chain(unsigned int sum, struct mbuf *m)
+{
+  unsigned int s, off;
+
+  for (off = 0; m; m = m->next) {
+    s = in_cksum_add(0, (unsigned char *)m->head, m->len);
+    s = (s & 0xffff) + (s >> 16);
+    s = (s & 0xffff) + (s >> 16);
+    if (off & 1)
+      s = ((s & 0xff) << 8) | (s >> 8);
+    sum += s;
+    off += m->len;
+  }
+  return sum;
+}
+
+// Is dip one of our own addresses?
+static int
+ip_local(uint32 dip)
+{
+  return dip == local_ip || IP_LOOPBACK(dip);
+}
 
-  answer = ~sum; /* truncate to 16 bits */
-  return answer;
+// the source address of packets to dip: a loopback address
+// answers from itself, so that replies come back to it.
+static uint32
+ip_srcaddr(uint32 dip)
+{
+  return IP_LOOPBACK(dip) ? dip : local_ip;
+}
+
+// Sets the checksum field sum of the TCP or UDP segment that m
+// holds, which is going to dip. With offload, the e1000 finishes
+// the sum that we start with the pseudo-header (flag tells it which
+// checksum); without, we compute it all here. Loopback packets are
+// never checksummed, as net_tx_loop() explains.
+static void
+net_tx_cksum(struct mbuf *m, uint16 *sum, uint8 proto, uint32 dip, int flag)
+{
+  unsigned int len = mbufchainlen(m);
+  uint32 sip = ip_srcaddr(dip);
+
+  *sum = 0;
+  // the e1000 can't checksum a datagram sent in fragments.
+  if (ip_local(dip) || (csum_offload && sizeof(struct ip) + len <= mtu)) {
+    *sum = ~in_cksum_fold(in_cksum_phdr(proto, sip, dip, len));
+    m->csum |= flag | MBUF_CSUM_IP;
+    return;
+  }
+  *sum = in_cksum_fold(in_cksum_chain(in_cksum_phdr(proto, sip, dip, len),
+                                      m));
+  // UDP sends a computed zero as all ones; zero means no checksum.
+  if (proto == IPPROTO_UDP && *sum == 0)
+    *sum = 0xffff;
 }
 
 // sends an ethernet packet
 static void
-net_tx_eth(struct mbuf *m, uint16 ethtype)
+net_tx_eth(struct mbuf *m, uint16 ethtype, uint8 dmac[ETHADDR_LEN])
 {
   struct eth *ethhdr;
 
   ethhdr = mbufpushhdr(m, *ethhdr);
   memmove(ethhdr->shost, local_mac, ETHADDR_LEN);
-  // In a real networking stack, dhost would be set to the address discovered
-  // through ARP. Because we don't support enough of the ARP protocol, set it
-  // to broadcast instead.
-  memmove(ethhdr->dhost, broadcast_mac, ETHADDR_LEN);
+  memmove(ethhdr->dhost, dmac, ETHADDR_LEN);
   ethhdr->type = htons(ethtype);
+  pcaptap(m, PCAP_TX);
   if (e1000_transmit(m)) {
     mbuffree(m);
   }
 }
 
-// sends an IP packet
+// Returns the cache entry for ip, or 0. Caller holds arplock.
+static struct arpent *
+arp_lookup(uint32 ip)
+{
+  struct arpent *e;
+
+  for (e = arptable; e < &arptable[NARP]; e++) {
+    if (e->state != ARP_FREE && e->ip == ip)
+      return e;
+  }
+  return 0;
+}
+
+// Returns an unused cache entry for ip, evicting the resolved
+// entry closest to expiring if need be. Entries still being
+// resolved are never evicted, so this can fail.
+// Caller holds arplock.
+static struct arpent *
+arp_alloc(uint32 ip)
+{
+  struct arpent *e, *victim;
+
+  victim = 0;
+  for (e = arptable; e < &arptable[NARP]; e++) {
+    if (e->state == ARP_FREE) {
+      victim = e;
+      break;
+    }
+    if (e->state == ARP_RESOLVED &&
+        (victim == 0 || (int)(e->expire - victim->expire) < 0))
+      victim = e;
+  }
+  if (victim == 0)
+    return 0;
+  victim->state = ARP_INCOMPLETE;
+  victim->ip = ip;
+  victim->tries = 0;
+  mbufq_init(&victim->pending);
+  victim->npending = 0;
+  return victim;
+}
+
+// Records that ip is at mac, and sends any packets that were
+// waiting for it. Only refreshes an existing entry unless
+// create is set.
+static void
+arp_update(uint32 ip, uint8 mac[ETHADDR_LEN], int create)
+{
+  struct arpent *e;
+  struct mbufq q;
+  struct mbuf *m;
+
+  mbufq_init(&q);
+  acquire(&arplock);
+  e = arp_lookup(ip);
+  if (e == 0 && create)
+    e = arp_alloc(ip);
+  if (e == 0) {
+    release(&arplock);
+    return;
+  }
+  memmove(e->mac, mac, ETHADDR_LEN);
+  e->state = ARP_RESOLVED;
+  e->expire = ticks + ARP_REACHABLE;
+  q = e->pending;
+  mbufq_init(&e->pending);
+  e->npending = 0;
+  release(&arplock);
+
+  // send without arplock, since transmitting can take other locks.
+  while ((m = mbufq_pophead(&q)) != 0)
+    net_tx_eth(m, ETHTYPE_IP, mac);
+}
+
+// the Ethernet address that multicast group addr maps to: the
+// low 23 bits of addr after 01:00:5e, per RFC 1112.
+static void
+mcast_mac(uint32 addr, uint8 mac[ETHADDR_LEN])
+{
+  mac[0] = 0x01;
+  mac[1] = 0x00;
+  mac[2] = 0x5e;
+  mac[3] = (addr >> 16) & 0x7f;
+  mac[4] = (addr >> 8) & 0xff;
+  mac[5] = addr & 0xff;
+}
+
+// Is dip a broadcast address, for all hosts or for ours?
+static int
+ip_broadcast(uint32 dip)
+{
+  return dip == 0xffffffff ||
+    ((dip & netmask) == (local_ip & netmask) && (dip | netmask) == 0xffffffff);
+}
+
+// sends an IP packet to dip, or to the router if dip is not on
+// the local network, holding it until ARP resolves the next hop.
+static void
+net_tx_neigh(struct mbuf *m, uint32 dip)
+{
+  uint8 mac[ETHADDR_LEN];
+  struct arpent *e;
+  int request;
+
+  if (ip_broadcast(dip)) {
+    net_tx_eth(m, ETHTYPE_IP, broadcast_mac);
+    return;
+  }
+  if (IP_MULTICAST(dip)) {
+    mcast_mac(dip, mac);
+    net_tx_eth(m, ETHTYPE_IP, mac);
+    return;
+  }
+  if ((dip & netmask) != (local_ip & netmask))
+    dip = gateway_ip;
+
+  request = 0;
+  acquire(&arplock);
+  e = arp_lookup(dip);
+  if (e && e->state == ARP_RESOLVED) {
+    memmove(mac, e->mac, ETHADDR_LEN);
+    release(&arplock);
+    net_tx_eth(m, ETHTYPE_IP, mac);
+    return;
+  }
+  if (e == 0) {
+    if ((e = arp_alloc(dip)) == 0) {
+      release(&arplock);
+      mbuffree(m);
+      NETSTAT_INC(arpnoentry);
+      return;
+    }
+    e->tries = 1;
+    e->expire = ticks + ARP_RETRY;
+    request = 1;
+  }
+  if (e->npending == ARP_MAXPENDING) {
+    // keep the newest packets
+    mbuffree(mbufq_pophead(&e->pending));
+    e->npending--;
+    NETSTAT_INC(arpoverflow);
+  }
+  mbufq_pushtail(&e->pending, m);
+  e->npending++;
+  release(&arplock);
+
+  if (request)
+    net_tx_arp(ARP_OP_REQUEST, zero_mac, dip);
+}
+
+// Expires learned addresses, and repeats or gives up on
+// unanswered requests, dropping the packets held for them.
+static void
+arp_timer(void)
+{
+  uint32 ask[NARP];
+  struct arpent *e;
+  struct mbuf *m;
+  int i, n;
+
+  n = 0;
+  acquire(&arplock);
+  for (e = arptable; e < &arptable[NARP]; e++) {
+    if (e->state == ARP_FREE || (int)(ticks - e->expire) < 0)
+      continue;
+    if (e->state == ARP_RESOLVED || e->tries >= ARP_MAXTRIES) {
+      while ((m = mbufq_pophead(&e->pending)) != 0) {
+        mbuffree(m);
+        NETSTAT_INC(arptimeout);
+      }
+      e->npending = 0;
+      e->state = ARP_FREE;
+      continue;
+    }
+    e->tries++;
+    e->expire = ticks + ARP_RETRY;
+    ask[n++] = e->ip;
+  }
+  release(&arplock);
+
+  for (i = 0; i < n; i++)
+    net_tx_arp(ARP_OP_REQUEST, zero_mac, ask[i]);
+}
+
+// sends the IP packet m, which is larger than the MTU, as a
+// series of fragments. They hold copies of the payload, so m
+// is freed before this returns.
+static void
+net_tx_ipfrag(struct mbuf *m, uint32 dip)
+{
+  struct ip *iphdr, *fhdr;
+  struct mbuf *f;
+  unsigned int off, len, maxlen, total;
+
+  iphdr = (struct ip *)m->head;
+  total = ntohs(iphdr->ip_len) - sizeof(*iphdr);
+  // all but the last fragment carry a multiple of 8 bytes.
+  maxlen = (mtu - sizeof(*iphdr)) & ~7;
+  for (off = 0; off < total; off += len) {
+    len = total - off < maxlen ? total - off : maxlen;
+    if ((f = mbufalloc(sizeof(struct eth))) == 0) {
+      NETSTAT_INC(ipfragfails);
+      break;
+    }
+    fhdr = mbufputhdr(f, *fhdr);
+    *fhdr = *iphdr;
+    fhdr->ip_len = htons(sizeof(*fhdr) + len);
+    fhdr->ip_off = htons((off >> 3) | (off + len < total ? IP_MF : 0));
+    fhdr->ip_sum = 0;
+    fhdr->ip_sum = in_cksum((unsigned char *)fhdr, sizeof(*fhdr));
+    if (mbufappend(f, m, sizeof(*iphdr) + off, len) < 0) {
+      mbuffree(f);
+      NETSTAT_INC(ipfragfails);
+      break;
+    }
+    NETSTAT_INC(ipfragstx);
+    net_tx_neigh(f, dip);
+  }
+  mbuffree(m);
+}
+
+// Has some hart deliver the packets sent to ourselves. Runs
+// them through the receive path at once if this hart holds no
+// spinlocks, and otherwise leaves them for one of the callers
+// of net_loopback() that hold none: the end of a system call,
+// the timer, and tcpsleep().
+static void
+net_tx_loop(struct mbuf *m)
+{
+  struct mbuf *seg, *rest;
+
+  // the receiver may keep m for as long as it likes, and a
+  // zero-copy sender waits for its pages until m is freed, so
+  // copy any of those. the headers are in m's first mbuf.
+  for (seg = m; seg; seg = seg->next) {
+    if (seg->extdone || (seg->shared && seg->shared->extdone))
+      break;
+  }
+  if (seg) {
+    rest = m->next;
+    m->next = 0;
+    if (mbufappend(m, rest, 0, mbufchainlen(rest)) < 0) {
+      mbuffree(rest);
+      goto drop;
+    }
+    mbuffree(rest);
+  }
+  // nothing can corrupt it on the way, so the receiver
+  // needn't check the checksums we left unfinished.
+  m->csum = MBUF_CSUM_IP | MBUF_CSUM_TCP | MBUF_CSUM_UDP;
+
+  acquire(&looplock);
+  if (loopqlen == LOOP_MAXQ) {
+    release(&looplock);
+    goto drop;
+  }
+  mbufq_pushtail(&loopq, m);
+  loopqlen++;
+  release(&looplock);
+  NETSTAT_INC(looppkts);
+  // a hart holding no spinlocks has interrupts on, so it
+  // can't be in the middle of the receive path.
+  if (mycpu()->noff == 0)
+    net_loopback();
+  return;
+
+drop:
+  NETSTAT_INC(loopdrops);
+  mbuffree(m);
+}
+
+// Are packets waiting on the loopback interface? A racy peek,
+// since most callers have nothing to do; a packet this misses
+// is delivered by whoever queued it, or by the timer.
+int
+net_looppending(void)
+{
+  return !mbufq_empty(&loopq);
+}
+
+// Delivers the packets waiting on the loopback interface, unless
+// another hart already is. Caller must hold no spinlocks. Returns
+// the number delivered.
+int
+net_loopback(void)
+{
+  struct mbuf *m;
+  int n;
+
+  if (!net_looppending())
+    return 0;
+  acquire(&looplock);
+  if (loopbusy) {
+    release(&looplock);
+    return 0;
+  }
+  loopbusy = 1;
+  for (n = 0; (m = mbufq_pophead(&loopq)) != 0; n++) {
+    loopqlen--;
+    release(&looplock);
+    net_rx_ip(m, 1);
+    acquire(&looplock);
+  }
+  loopbusy = 0;
+  release(&looplock);
+  return n;
+}
+
+// sends an IP packet. packets to ourselves take the loopback
+// interface, and so do copies of broadcast packets and of
+// multicast packets to groups that our sockets have joined.
 static void
 net_tx_ip(struct mbuf *m, uint8 proto, uint32 dip)
 {
   struct ip *iphdr;
+  struct mbuf *c;
+  unsigned int len;
 
   // push the IP header
   iphdr = mbufpushhdr(m, *iphdr);
+  len = mbufchainlen(m);
   memset(iphdr, 0, sizeof(*iphdr));
   iphdr->ip_vhl = (4 << 4) | (20 >> 2);
+  iphdr->ip_id = htons(__sync_fetch_and_add(&ip_id, 1));
   iphdr->ip_p = proto;
-  iphdr->ip_src = htonl(local_ip);
+  iphdr->ip_src = htonl(ip_srcaddr(dip));
   iphdr->ip_dst = htonl(dip);
-  iphdr->ip_len = htons(m->len);
+  iphdr->ip_len = htons(len);
   iphdr->ip_ttl = 100;
-  iphdr->ip_sum = in_cksum((unsigned char *)iphdr, sizeof(*iphdr));
+  NETSTAT_INC(iptx);
+  if (ip_local(dip)) {
+    net_tx_loop(m);
+    return;
+  }
+  // before any clone, which shares the header; fragments
+  // get headers of their own.
+  if (len <= mtu && !(m->csum & MBUF_CSUM_IP))
+    iphdr->ip_sum = in_cksum((unsigned char *)iphdr, sizeof(*iphdr));
+  if (ip_broadcast(dip) || (IP_MULTICAST(dip) && mcast_joined(dip))) {
+    if ((c = mbufclone(m)) != 0)
+      net_tx_loop(c);
+    else
+      NETSTAT_INC(loopdrops);
+  }
+  if (len > mtu) {
+    net_tx_ipfrag(m, dip);
+    return;
+  }
 
   // now on to the ethernet layer
-  net_tx_eth(m, ETHTYPE_IP);
+  net_tx_neigh(m, dip);
 }
 
 // sends a UDP packet
@@ -209,14 +970,28 @@ net_tx_udp(struct mbuf *m, uint32 dip,
   udphdr = mbufpushhdr(m, *udphdr);
   udphdr->sport = htons(sport);
   udphdr->dport = htons(dport);
-  udphdr->ulen = htons(m->len);
-  udphdr->sum = 0; // zero means no checksum is provided
+  udphdr->ulen = htons(mbufchainlen(m));
+  net_tx_cksum(m, &udphdr->sum, IPPROTO_UDP, dip, MBUF_CSUM_UDP);
+  NETSTAT_INC(udptx);
 
   // now on to the IP layer
   net_tx_ip(m, IPPROTO_UDP, dip);
 }
 
-// sends an ARP packet
+// sends a TCP segment, whose header is already at the start of m
+void
+net_tx_tcp(struct mbuf *m, uint32 dip)
+{
+  struct tcp *tcphdr = (struct tcp *)m->head;
+
+  net_tx_cksum(m, &tcphdr->sum, IPPROTO_TCP, dip, MBUF_CSUM_TCP);
+  NETSTAT_INC(tcptx);
+
+  // now on to the IP layer
+  net_tx_ip(m, IPPROTO_TCP, dip);
+}
+
+// sends an ARP packet; requests are broadcast, with dmac zero
 static int
 net_tx_arp(uint16 op, uint8 dmac[ETHADDR_LEN], uint32 dip)
 {
@@ -242,7 +1017,8 @@ net_tx_arp(uint16 op, uint8 dmac[ETHADDR_LEN], uint32 dip)
   arphdr->tip = htonl(dip);
 
   // header is ready, send the packet
-  net_tx_eth(m, ETHTYPE_ARP);
+  NETSTAT_INC(arptx);
+  net_tx_eth(m, ETHTYPE_ARP, op == ARP_OP_REQUEST ? broadcast_mac : dmac);
   return 0;
 }
 
@@ -253,32 +1029,137 @@ net_rx_arp(struct mbuf *m)
   struct arp *arphdr;
   uint8 smac[ETHADDR_LEN];
   uint32 sip, tip;
+  uint16 op;
 
+  NETSTAT_INC(arprx);
   arphdr = mbufpullhdr(m, *arphdr);
   if (!arphdr)
-    goto done;
+    goto bad;
 
   // validate the ARP header
   if (ntohs(arphdr->hrd) != ARP_HRD_ETHER ||
       ntohs(arphdr->pro) != ETHTYPE_IP ||
       arphdr->hln != ETHADDR_LEN ||
       arphdr->pln != sizeof(uint32)) {
-    goto done;
+    goto bad;
   }
 
-  // only requests are supported so far
-  // check if our IP was solicited
+  op = ntohs(arphdr->op);
+  if (op != ARP_OP_REQUEST && op != ARP_OP_REPLY)
+    goto bad;
   tip = ntohl(arphdr->tip); // target IP address
-  if (ntohs(arphdr->op) != ARP_OP_REQUEST || tip != local_ip)
-    goto done;
-
-  // handle the ARP request
   memmove(smac, arphdr->sha, ETHADDR_LEN); // sender's ethernet address
   sip = ntohl(arphdr->sip); // sender's IP address (qemu's slirp)
-  net_tx_arp(ARP_OP_REPLY, smac, sip);
+
+  // another host claiming our address must not poison the cache.
+  if (sip == local_ip) {
+    printf("arp: %x claimed by %x:%x:%x:%x:%x:%x\n", sip, smac[0], smac[1],
+           smac[2], smac[3], smac[4], smac[5]);
+    goto done;
+  }
+
+  // RFC 826: refresh the sender's entry if we have one, and
+  // create one if we were the target. A gratuitous ARP (a
+  // request for the sender's own address) thus updates the
+  // entry of a neighbor whose Ethernet address changed.
+  // Probes (sip 0) teach nothing.
+  if (sip != 0)
+    arp_update(sip, smac, tip == local_ip);
+
+  // check if our IP was solicited
+  if (op == ARP_OP_REQUEST && tip == local_ip)
+    net_tx_arp(ARP_OP_REPLY, smac, sip);
 
 done:
   mbuffree(m);
+  return;
+
+bad:
+  NETSTAT_INC(arpbad);
+  mbuffree(m);
+}
+
+// Tells the e1000 which multicast Ethernet addresses to pass
+// up, after the group table changes. Caller holds mcastlock.
+static void
+mcast_update(void)
+{
+  uint8 macs[NMCAST][ETHADDR_LEN];
+  int i, n;
+
+  for (i = n = 0; i < NMCAST; i++) {
+    if (mcasttable[i].refs > 0)
+      mcast_mac(mcasttable[i].addr, macs[n++]);
+  }
+  e1000_mcast((uint8 *)macs, n);
+}
+
+// Adds one socket to multicast group addr. Returns -1 if addr
+// is not a multicast address, or too many groups are joined.
+int
+net_joingroup(uint32 addr)
+{
+  struct mcastent *e, *free;
+
+  if (!IP_MULTICAST(addr))
+    return -1;
+  free = 0;
+  acquire(&mcastlock);
+  for (e = mcasttable; e < mcasttable + NMCAST; e++) {
+    if (e->refs > 0 && e->addr == addr) {
+      e->refs++;
+      release(&mcastlock);
+      return 0;
+    }
+    if (e->refs == 0 && free == 0)
+      free = e;
+  }
+  if (free == 0) {
+    release(&mcastlock);
+    return -1;
+  }
+  free->addr = addr;
+  free->refs = 1;
+  mcast_update();
+  release(&mcastlock);
+  return 0;
+}
+
+// Removes one socket from multicast group addr, which it joined
+// with net_joingroup().
+void
+net_leavegroup(uint32 addr)
+{
+  struct mcastent *e;
+
+  acquire(&mcastlock);
+  for (e = mcasttable; e < mcasttable + NMCAST; e++) {
+    if (e->refs > 0 && e->addr == addr) {
+      if (--e->refs == 0)
+        mcast_update();
+      break;
+    }
+  }
+  release(&mcastlock);
+}
+
+// Has some socket joined multicast group addr?
+static int
+mcast_joined(uint32 addr)
+{
+  struct mcastent *e;
+  int joined;
+
+  joined = 0;
+  acquire(&mcastlock);
+  for (e = mcasttable; e < mcasttable + NMCAST; e++) {
+    if (e->refs > 0 && e->addr == addr) {
+      joined = 1;
+      break;
+    }
+  }
+  release(&mcastlock);
+  return joined;
 }
 
 // receives a UDP packet
@@ -286,71 +1167,338 @@ static void
 net_rx_udp(struct mbuf *m, uint16 len, struct ip *iphdr)
 {
   struct udp *udphdr;
-  uint32 sip;
+  uint32 sip, dip;
   uint16 sport, dport;
 
+  NTRACE_STAMP(m, NTRACE_UDP);
 
   udphdr = mbufpullhdr(m, *udphdr);
-  if (!udphdr)
+  if (!udphdr) {
+    NETSTAT_INC(udpbadlen);
     goto fail;
-
-  // TODO: validate UDP checksum
+  }
 
   // validate lengths reported in headers
-  if (ntohs(udphdr->ulen) != len)
+  if (ntohs(udphdr->ulen) != len) {
+    NETSTAT_INC(udpbadlen);
     goto fail;
-  len -= sizeof(*udphdr);
-  if (len > m->len)
+  }
+
+  // validate the checksum, if the sender provided one
+  // and the e1000 hasn't already. the payload may be a
+  // chain, of fragments or of a jumbo frame's buffers.
+  sip = ntohl(iphdr->ip_src);
+  dip = ntohl(iphdr->ip_dst);
+  if (udphdr->sum != 0 && !(m->csum & MBUF_CSUM_UDP) &&
+      in_cksum_fold(in_cksum_chain(
+        in_cksum_add(in_cksum_phdr(IPPROTO_UDP, sip, dip, len),
+                     (unsigned char *)udphdr, sizeof(*udphdr)), m))) {
+    NETSTAT_INC(udpbadsum);
     goto fail;
-  // minimum packet size could be larger than the payload
-  mbuftrim(m, m->len - len);
+  }
+  NETSTAT_INC(udprx);
 
   // parse the necessary fields
-  sip = ntohl(iphdr->ip_src);
   sport = ntohs(udphdr->sport);
   dport = ntohs(udphdr->dport);
-  sockrecvudp(m, sip, dport, sport);
+  if (ip_local(dip))
+    dip = 0;
+  else if (ip_broadcast(dip))
+    dip = 0xffffffff;
+  sockrecvudp(m, sip, dport, sport, dip);
+  return;
+
+fail:
+  mbuffree(m);
+}
+
+// receives a TCP segment
+static void
+net_rx_tcp(struct mbuf *m, uint16 len, struct ip *iphdr)
+{
+  struct tcp *tcphdr;
+  uint32 sip;
+
+  if (len < sizeof(*tcphdr)) {
+    NETSTAT_INC(tcpbadhdr);
+    goto fail;
+  }
+  // tcp_rx() wants the segment in one mbuf. flattening
+  // frees the mbuf that iphdr points into.
+  sip = ntohl(iphdr->ip_src);
+  if ((m = mbufflatten(m)) == 0)
+    return;
+
+  if (!(m->csum & MBUF_CSUM_TCP) &&
+      in_cksum_pseudo((unsigned char *)m->head, len, IPPROTO_TCP,
+                      sip, local_ip)) {
+    NETSTAT_INC(tcpbadsum);
+    goto fail;
+  }
+  NETSTAT_INC(tcprx);
+
+  // tcp_rx() parses the rest of the header.
+  tcphdr = (struct tcp *)m->head;
+  tcp_rx(m, sip, ntohs(tcphdr->dport), ntohs(tcphdr->sport));
   return;
 
 fail:
   mbuffree(m);
 }
 
-// receives an IP packet
+// Frees the fragments held by q. Caller holds ipqlock.
 static void
-net_rx_ip(struct mbuf *m)
+ipq_free(struct ipq *q)
+{
+  struct mbuf *m;
+
+  while ((m = q->frags) != 0) {
+    q->frags = m->nextpkt;
+    mbuffree(m);
+    NETSTAT_INC(ipfragdrops);
+  }
+  q->used = 0;
+}
+
+// Adds fragment m, whose IP header iphdr has been pulled and
+// whose payload has been trimmed to the IP length, to its
+// datagram. Returns the datagram as one chain, with the first
+// fragment's header made whole again, once every fragment has
+// arrived; otherwise keeps or frees m and returns 0.
+static struct mbuf *
+ip_reass(struct mbuf *m, struct ip *iphdr)
+{
+  struct ipq *q, *e;
+  struct mbuf **pp, *f, *prev, *next, *last;
+  unsigned int off, len, end, total;
+  int more;
+
+  more = ntohs(iphdr->ip_off) & IP_MF;
+  off = (ntohs(iphdr->ip_off) & IP_OFFMASK) << 3;
+  len = ntohs(iphdr->ip_len) - sizeof(*iphdr);
+  end = off + len;
+  // all but the last fragment carry a multiple of 8 bytes.
+  NETSTAT_INC(ipfragsrx);
+  if (end > IP_MAXPACKET - sizeof(*iphdr) || (more && (len == 0 || len % 8))) {
+    mbuffree(m);
+    NETSTAT_INC(ipfragdrops);
+    return 0;
+  }
+
+  acquire(&ipqlock);
+  for (q = ipqtable; q < &ipqtable[NIPQ]; q++) {
+    if (q->used && q->id == iphdr->ip_id && q->src == iphdr->ip_src &&
+        q->dst == iphdr->ip_dst && q->p == iphdr->ip_p)
+      break;
+  }
+  if (q == &ipqtable[NIPQ]) {
+    // a new datagram takes a free slot, or the one
+    // closest to timing out.
+    q = ipqtable;
+    for (e = ipqtable; e < &ipqtable[NIPQ] && q->used; e++) {
+      if (!e->used || (int)(e->expire - q->expire) < 0)
+        q = e;
+    }
+    if (q->used)
+      ipq_free(q);
+    q->used = 1;
+    q->id = iphdr->ip_id;
+    q->src = iphdr->ip_src;
+    q->dst = iphdr->ip_dst;
+    q->p = iphdr->ip_p;
+    q->expire = ticks + IPQ_TIMEOUT;
+    q->frags = 0;
+    q->nfrags = 0;
+    q->have = 0;
+    q->total = 0;
+  }
+
+  // insert m in offset order. duplicates and overlaps are
+  // dropped, which leaves a gap only if the sender lied.
+  iphdr->ip_off = off;
+  iphdr->ip_len = len;
+  prev = 0;
+  for (pp = &q->frags; *pp && FRAGHDR(*pp)->ip_off < off; pp = &(*pp)->nextpkt)
+    prev = *pp;
+  if ((prev && FRAGHDR(prev)->ip_off + FRAGHDR(prev)->ip_len > off) ||
+      (*pp && end > FRAGHDR(*pp)->ip_off)) {
+    release(&ipqlock);
+    mbuffree(m);
+    NETSTAT_INC(ipfragdrops);
+    return 0;
+  }
+  m->nextpkt = *pp;
+  *pp = m;
+  q->have += len;
+  if (++q->nfrags > IPQ_MAXFRAGS)
+    goto bad;
+
+  // the last fragment says how long the datagram is, and
+  // no fragment may reach past that.
+  if (!more) {
+    if ((q->total != 0 && q->total != end) || m->nextpkt)
+      goto bad;
+    q->total = end;
+  }
+  if (q->total != 0 && end > q->total)
+    goto bad;
+  if (q->total == 0 || q->have != q->total) {
+    release(&ipqlock);
+    return 0;
+  }
+
+  // every byte is in: link the fragments into one chain.
+  m = q->frags;
+  total = q->total;
+  q->frags = 0;
+  q->used = 0;
+  release(&ipqlock);
+  for (f = m; f; f = next) {
+    next = f->nextpkt;
+    f->nextpkt = 0;
+    for (last = f; last->next; last = last->next)
+      ;
+    last->next = next;
+  }
+  iphdr = FRAGHDR(m);
+  iphdr->ip_len = htons(sizeof(*iphdr) + total);
+  iphdr->ip_off = 0;
+  // the e1000 doesn't check fragments' TCP and UDP checksums.
+  m->csum = MBUF_CSUM_IP;
+  NETSTAT_INC(ipreassembled);
+  return m;
+
+bad:
+  ipq_free(q);
+  release(&ipqlock);
+  return 0;
+}
+
+// Gives up on datagrams whose fragments have stopped arriving.
+static void
+ipq_timer(void)
+{
+  struct ipq *q;
+
+  acquire(&ipqlock);
+  for (q = ipqtable; q < &ipqtable[NIPQ]; q++) {
+    if (q->used && (int)(ticks - q->expire) >= 0)
+      ipq_free(q);
+  }
+  release(&ipqlock);
+}
+
+// receives an IP packet, from the e1000 or (if loop is set)
+// from the loopback interface.
+static void
+net_rx_ip(struct mbuf *m, int loop)
 {
   struct ip *iphdr;
+  uint32 dip;
   uint16 len;
 
+  NETSTAT_INC(iprx);
   iphdr = mbufpullhdr(m, *iphdr);
   if (!iphdr)
-	  goto fail;
+	  goto badhdr;
 
   // check IP version and header len
   if (iphdr->ip_vhl != ((4 << 4) | (20 >> 2)))
+    goto badhdr;
+  // validate IP checksum, unless the e1000 has
+  if (!(m->csum & MBUF_CSUM_IP) &&
+      in_cksum((unsigned char *)iphdr, sizeof(*iphdr))) {
+    NETSTAT_INC(ipbadsum);
     goto fail;
-  // validate IP checksum
-  if (in_cksum((unsigned char *)iphdr, sizeof(*iphdr)))
-    goto fail;
-  // can't support fragmented IP packets
-  if (htons(iphdr->ip_off) != 0)
-    goto fail;
-  // is the packet addressed to us?
-  if (htonl(iphdr->ip_dst) != local_ip)
+  }
+  // is the packet addressed to us? UDP may also be broadcast,
+  // or multicast to a group that a socket has joined. loopback
+  // addresses never come from the e1000.
+  dip = ntohl(iphdr->ip_dst);
+  if (dip != local_ip && !(loop && IP_LOOPBACK(dip)) &&
+      (iphdr->ip_p != IPPROTO_UDP ||
+       !(ip_broadcast(dip) || (IP_MULTICAST(dip) && mcast_joined(dip))))) {
+    NETSTAT_INC(ipnotours);
     goto fail;
-  // can only support UDP
-  if (iphdr->ip_p != IPPROTO_UDP)
+  }
+  // minimum frame size could be larger than the packet
+  len = ntohs(iphdr->ip_len);
+  if (len < sizeof(*iphdr) || len - sizeof(*iphdr) > mbufchainlen(m))
+    goto badhdr;
+  len -= sizeof(*iphdr);
+  mbufchaintrim(m, len);
+  // hold fragments until the whole datagram is in
+  if (ntohs(iphdr->ip_off) & (IP_MF | IP_OFFMASK)) {
+    if ((m = ip_reass(m, iphdr)) == 0)
+      return;
+    iphdr = FRAGHDR(m);
+    len = ntohs(iphdr->ip_len) - sizeof(*iphdr);
+  }
+  if (iphdr->ip_p == IPPROTO_UDP)
+    net_rx_udp(m, len, iphdr);
+  else if (iphdr->ip_p == IPPROTO_TCP)
+    net_rx_tcp(m, len, iphdr);
+  else {
+    NETSTAT_INC(ipnoproto);
     goto fail;
-
-  len = ntohs(iphdr->ip_len) - sizeof(*iphdr);
-  net_rx_udp(m, len, iphdr);
+  }
   return;
 
+badhdr:
+  NETSTAT_INC(ipbadhdr);
 fail:
   mbuffree(m);
 }
 
+// Reads the netstat device: a struct netstat, from the file
+// offset on. Reading from the start takes a fresh snapshot.
+static int
+netstatread(struct file *f, int user_dst, uint64 dst, int n)
+{
+  struct netstat st;
+
+  if (f->off == 0)
+    e1000_stats();
+  st = netstat;
+  if (f->off >= sizeof(st))
+    return 0;
+  if (n > sizeof(st) - f->off)
+    n = sizeof(st) - f->off;
+  if (either_copyout(user_dst, dst, (char *)&st + f->off, n) < 0)
+    return -1;
+  f->off += n;
+  return n;
+}
+
+void
+netinit(void)
+{
+  initlock(&arplock, "arp");
+  initlock(&extlock, "mbufext");
+  initlock(&ipqlock, "ipq");
+  initlock(&mcastlock, "mcast");
+  initlock(&looplock, "loop");
+  mbufq_init(&loopq);
+  devsw[NETSTAT].read = netstatread;
+
+  // announce our address with a gratuitous ARP, which
+  // also replaces stale entries neighbors hold for it.
+  net_tx_arp(ARP_OP_REQUEST, zero_mac, local_ip);
+}
+
+// called from clockintr() on every tick.
+void
+net_timer(void)
+{
+  net_loopback();
+  arp_timer();
+  ipq_timer();
+  tcptimer();
+  // the e1000's statistics registers are only 32 bits wide.
+  if (ticks % 100 == 0)
+    e1000_stats();
+}
+
 // called by e1000 driver's interrupt handler to deliver a packet to the
 // networking stack
 void net_rx(struct mbuf *m)
@@ -360,15 +1508,18 @@ void net_rx(struct mbuf *m)
 
   ethhdr = mbufpullhdr(m, *ethhdr);
   if (!ethhdr) {
+    NETSTAT_INC(ethshort);
     mbuffree(m);
     return;
   }
 
   type = ntohs(ethhdr->type);
   if (type == ETHTYPE_IP)
-    net_rx_ip(m);
+    net_rx_ip(m, 0);
   else if (type == ETHTYPE_ARP)
     net_rx_arp(m);
-  else
+  else {
+    NETSTAT_INC(ethnotype);
     mbuffree(m);
+  }
 }
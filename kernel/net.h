@@ -6,12 +6,33 @@
 #define MBUF_DEFAULT_HEADROOM  128
 
 struct mbuf {
-  struct mbuf  *next; // the next mbuf in the chain
-  char         *head; // the current start position of the buffer
-  unsigned int len;   // the length of the buffer
+  struct mbuf  *next;    // the next mbuf in this packet's chain
+  struct mbuf  *nextpkt; // the next packet in a queue
+  char         *head;    // the current start position of the buffer
+  unsigned int len;      // the length of the buffer
+  unsigned int csum;     // MBUF_CSUM_* flags
+  int          *extdone; // zero-copy: head points into a sender's page,
+                         // and *extdone counts fragments not yet sent
+  struct mbuf  *shared;  // a clone: head points into shared's buf
+  int          refcnt;   // 1, plus the clones pointing into buf
+  uint64       tstamp[3]; // when the packet passed each NTRACE_* point
   char         buf[MBUF_SIZE]; // the backing store
 };
 
+// A packet is a chain of mbufs linked by next: the first holds the
+// headers, and the rest hold payload. A payload mbuf may point at a
+// user page instead of its own buf; see mbufwait(). A clone points
+// into another mbuf's buf, which stays allocated until the last
+// clone is freed; see mbufclone().
+
+// Checksum offload. On transmit, csum asks the driver to fill in
+// these checksums, with the TCP or UDP checksum field holding the
+// sum of the pseudo-header. On receive, it says which checksums
+// the driver has already verified.
+#define MBUF_CSUM_IP   0x1 // the IP header checksum
+#define MBUF_CSUM_TCP  0x2 // the TCP checksum
+#define MBUF_CSUM_UDP  0x4 // the UDP checksum
+
 char *mbufpull(struct mbuf *m, unsigned int len);
 char *mbufpush(struct mbuf *m, unsigned int len);
 char *mbufput(struct mbuf *m, unsigned int len);
@@ -32,6 +53,13 @@ char *mbuftrim(struct mbuf *m, unsigned int len);
 
 struct mbuf *mbufalloc(unsigned int headroom);
 void mbuffree(struct mbuf *m);
+unsigned int mbufchainlen(struct mbuf *m);
+void mbufchaintrim(struct mbuf *m, unsigned int len);
+int mbufappend(struct mbuf *m, struct mbuf *src, unsigned int off,
+               unsigned int len);
+struct mbuf *mbufflatten(struct mbuf *m);
+struct mbuf *mbufclone(struct mbuf *m);
+void mbufwait(int *extdone);
 
 struct mbufq {
   struct mbuf *head;  // the first element in the queue
@@ -44,6 +72,23 @@ int mbufq_empty(struct mbufq *q);
 void mbufq_init(struct mbufq *q);
 
 
+//
+// statistics
+//
+
+// the counters of struct netstat (see netstat.h), which
+// several harts may bump at once.
+extern struct netstat netstat;
+#define NETSTAT_ADD(field, n) __sync_fetch_and_add(&netstat.field, (n))
+#define NETSTAT_INC(field) NETSTAT_ADD(field, 1)
+
+// stamps the packet held by m at point pt (see nettrace.h),
+// if latency tracing is on.
+extern int nettraceon;
+#define NTRACE_STAMP(m, pt) \
+  do { if (nettraceon) (m)->tstamp[pt] = r_time(); } while (0)
+
+
 //
 // endianness support
 //
@@ -86,6 +131,9 @@ struct eth {
 #define ETHTYPE_IP  0x0800 // Internet protocol
 #define ETHTYPE_ARP 0x0806 // Address resolution protocol
 
+#define ETH_MTU        1500 // largest payload of a standard frame
+#define ETH_JUMBO_MTU  9000 // largest payload of a jumbo frame
+
 // an IP packet header (comes after an Ethernet header).
 struct ip {
   uint8  ip_vhl; // version << 4 | header length >> 2
@@ -99,6 +147,12 @@ struct ip {
   uint32 ip_src, ip_dst;
 };
 
+#define IP_DF      0x4000 // don't fragment
+#define IP_MF      0x2000 // more fragments
+#define IP_OFFMASK 0x1fff // fragment offset, in 8-byte units
+
+#define IP_MAXPACKET 65535 // largest IP packet, including the header
+
 #define IPPROTO_ICMP 1  // Control message protocol
 #define IPPROTO_TCP  6  // Transmission control protocol
 #define IPPROTO_UDP  17 // User datagram protocol
@@ -107,6 +161,12 @@ struct ip {
   (((uint32)a << 24) | ((uint32)b << 16) | \
    ((uint32)c << 8) | (uint32)d)
 
+// multicast addresses are 224.0.0.0 to 239.255.255.255.
+#define IP_MULTICAST(a) (((a) >> 28) == 0xe)
+
+// loopback addresses are 127.0.0.0 to 127.255.255.255.
+#define IP_LOOPBACK(a) (((a) >> 24) == 127)
+
 // a UDP packet header (comes after an IP header).
 struct udp {
   uint16 sport; // source port
@@ -115,6 +175,30 @@ struct udp {
   uint16 sum;   // checksum
 };
 
+// a TCP segment header (comes after an IP header).
+struct tcp {
+  uint16 sport; // source port
+  uint16 dport; // destination port
+  uint32 seq;   // sequence number
+  uint32 ack;   // acknowledgment number
+  uint8  off;   // header length in 32-bit words << 4
+  uint8  flags; // TCP_*
+  uint16 win;   // receive window
+  uint16 sum;   // checksum, including the IP pseudo-header
+  uint16 urp;   // urgent pointer
+};
+
+#define TCP_FIN  0x01
+#define TCP_SYN  0x02
+#define TCP_RST  0x04
+#define TCP_PSH  0x08
+#define TCP_ACK  0x10
+#define TCP_URG  0x20
+
+#define TCPOPT_EOL 0 // end of options
+#define TCPOPT_NOP 1 // padding
+#define TCPOPT_MSS 2 // maximum segment size
+
 // an ARP packet (comes after an Ethernet header).
 struct arp {
   uint16 hrd; // format of hardware address
@@ -0,0 +1,80 @@
+// Network statistics, read from the netstat device (major NETSTAT).
+// Both the kernel and user programs use this header file.
+//
+// Every counter counts from boot. Frames and packets that are
+// dropped are counted once, under the reason for the drop.
+
+#define NETSTAT 2  // device major
+
+struct netstat {
+  // e1000 driver
+  uint64 rxframes;      // frames received
+  uint64 rxbytes;       // bytes in those frames
+  uint64 rxnombuf;      // dropped: no mbuf to refill the receive ring
+  uint64 txframes;      // frames queued for sending
+  uint64 txbytes;       // bytes in those frames
+  uint64 txringfull;    // dropped: transmit ring full
+
+  // e1000 hardware statistics registers
+  uint64 hwrxgood;      // GPRC: good packets received
+  uint64 hwtxgood;      // GPTC: good packets sent
+  uint64 hwmissed;      // MPC: missed, receive FIFO full
+  uint64 hwnobuf;       // RNBC: no receive descriptor free
+  uint64 hwcrcerrs;     // CRCERRS: CRC errors
+  uint64 hwrxerrs;      // RXERRC: receive errors
+  uint64 hwlenerrs;     // RLEC: length errors
+  uint64 hwundersize;   // RUC: undersize frames
+  uint64 hwoversize;    // ROC: oversize frames
+
+  // Ethernet and ARP
+  uint64 ethshort;      // dropped: shorter than an Ethernet header
+  uint64 ethnotype;     // dropped: neither IP nor ARP
+  uint64 arprx;         // ARP packets received
+  uint64 arptx;         // ARP packets sent
+  uint64 arpbad;        // dropped: malformed ARP packets
+  uint64 arpnoentry;    // IP packets dropped: neighbor cache full
+  uint64 arpoverflow;   // IP packets dropped: too many awaiting one address
+  uint64 arptimeout;    // IP packets dropped: address never resolved
+
+  // IP
+  uint64 iprx;          // packets received
+  uint64 iptx;          // packets sent, before fragmenting
+  uint64 ipbadhdr;      // dropped: bad version, header length or length
+  uint64 ipbadsum;      // dropped: bad header checksum
+  uint64 ipnotours;     // dropped: addressed to another host
+  uint64 ipnoproto;     // dropped: neither UDP nor TCP
+  uint64 ipfragsrx;     // fragments received
+  uint64 ipreassembled; // datagrams reassembled from fragments
+  uint64 ipfragdrops;   // fragments dropped: bad, overlapping or timed out
+  uint64 ipfragstx;     // fragments sent
+  uint64 ipfragfails;   // packets not fragmented: no memory
+
+  // UDP
+  uint64 udprx;         // datagrams received
+  uint64 udptx;         // datagrams sent
+  uint64 udpbadlen;     // dropped: bad length
+  uint64 udpbadsum;     // dropped: bad checksum
+  uint64 udpnoport;     // dropped: no socket for the ports
+  uint64 udpfullsock;   // dropped: socket receive buffer full
+
+  // TCP
+  uint64 tcprx;         // segments received
+  uint64 tcptx;         // segments sent
+  uint64 tcpbadhdr;     // dropped: bad header length
+  uint64 tcpbadsum;     // dropped: bad checksum
+  uint64 tcpnoport;     // answered with a reset: no connection
+  uint64 tcpdup;        // dropped: data already received
+  uint64 tcpoutoforder; // dropped: data beyond a gap
+  uint64 tcprcvfull;    // data dropped: receive buffer full
+  uint64 tcprexmt;      // retransmission timeouts
+  uint64 tcpfastrexmt;  // fast retransmits
+  uint64 tcptimedout;   // connections dropped after too many timeouts
+
+  // loopback
+  uint64 looppkts;      // packets sent to ourselves
+  uint64 loopdrops;     // dropped: too many waiting, or no memory
+
+  // checksum offload
+  uint64 csumrxhw;      // received packets the e1000 verified
+  uint64 csumtxhw;      // packets sent for the e1000 to checksum
+};
@@ -0,0 +1,108 @@
+//
+// per-packet latency tracing of received UDP datagrams.
+// see nettrace.h.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "net.h"
+#include "nettrace.h"
+#include "defs.h"
+
+#define TIME_HZ 10000000 // qemu's time CSR counts at 10 MHz
+
+int nettraceon;
+
+static struct spinlock tracelock;
+static struct nettrace trace;
+
+// Adds a latency of t ticks to histogram h. Caller holds tracelock.
+static void
+histadd(struct nettrace_hist *h, uint64 t)
+{
+  int i;
+
+  h->count++;
+  h->sum += t;
+  if (t > h->max)
+    h->max = t;
+  for (i = 0; i < NTRACE_NBUCKETS - 1 && (t >> (i + 1)) != 0; i++)
+    ;
+  h->buckets[i]++;
+}
+
+// Records the latencies of the datagram held by m, which a
+// reader has just copied out. Points it was never stamped at
+// (before tracing started, or over loopback) are skipped.
+void
+nettracedone(struct mbuf *m)
+{
+  uint64 now = r_time();
+  uint64 *ts = m->tstamp;
+
+  if (!nettraceon || ts[NTRACE_SOCK] == 0)
+    return;
+  acquire(&tracelock);
+  if (ts[NTRACE_RECV] && ts[NTRACE_UDP])
+    histadd(&trace.stages[NTRACE_IP], ts[NTRACE_UDP] - ts[NTRACE_RECV]);
+  if (ts[NTRACE_UDP])
+    histadd(&trace.stages[NTRACE_LOOKUP], ts[NTRACE_SOCK] - ts[NTRACE_UDP]);
+  histadd(&trace.stages[NTRACE_WAKEUP], now - ts[NTRACE_SOCK]);
+  if (ts[NTRACE_RECV])
+    histadd(&trace.stages[NTRACE_TOTAL], now - ts[NTRACE_RECV]);
+  release(&tracelock);
+}
+
+// Reads the nettrace device: a struct nettrace, from the file
+// offset on, as it is at the time of the read.
+static int
+nettraceread(struct file *f, int user_dst, uint64 dst, int n)
+{
+  struct nettrace snap;
+
+  acquire(&tracelock);
+  snap = trace;
+  snap.on = nettraceon;
+  release(&tracelock);
+  if (f->off >= sizeof(snap))
+    return 0;
+  if (n > sizeof(snap) - f->off)
+    n = sizeof(snap) - f->off;
+  if (either_copyout(user_dst, dst, (char *)&snap + f->off, n) < 0)
+    return -1;
+  f->off += n;
+  return n;
+}
+
+// Writes the nettrace device: an int, which turns tracing on
+// (clearing the histograms) if nonzero and off if zero.
+static int
+nettracewrite(struct file *f, int user_src, uint64 src, int n)
+{
+  int on;
+
+  if (n != sizeof(on) || either_copyin(&on, user_src, src, n) < 0)
+    return -1;
+  acquire(&tracelock);
+  if (on)
+    memset(trace.stages, 0, sizeof(trace.stages));
+  nettraceon = on != 0;
+  release(&tracelock);
+  return n;
+}
+
+void
+nettraceinit(void)
+{
+  initlock(&tracelock, "nettrace");
+  trace.hz = TIME_HZ;
+  devsw[NETTRACE].read = nettraceread;
+  devsw[NETTRACE].write = nettracewrite;
+}
@@ -0,0 +1,42 @@
+// Per-packet latency tracing, read from the nettrace device
+// (major NETTRACE). Both the kernel and user programs use this
+// header file.
+//
+// While tracing is on, each received UDP datagram is stamped
+// with the time CSR as it passes each NTRACE_* point, and
+// when a reader has copied it out, the time between each pair
+// of points lands in a histogram. Writing a nonzero int to the
+// device clears the histograms and turns tracing on; writing
+// 0 turns it off.
+
+#define NETTRACE 3  // device major
+
+// where datagrams are stamped
+#define NTRACE_RECV   0  // e1000_recv() took it off the ring
+#define NTRACE_UDP    1  // net_rx_udp() got it from IP
+#define NTRACE_SOCK   2  // sockrecvudp() queued it on a socket
+#define NTRACE_NPOINTS 3
+
+// the stages between them, each with a histogram
+#define NTRACE_IP     0  // RECV to UDP: driver, Ethernet and IP
+#define NTRACE_LOOKUP 1  // UDP to SOCK: UDP checks and socket lookup
+#define NTRACE_WAKEUP 2  // SOCK to the read: queueing, wakeup, copy out
+#define NTRACE_TOTAL  3  // RECV to the read
+#define NTRACE_NSTAGES 4
+
+// bucket i counts latencies of less than 2^(i+1) ticks,
+// and at least 2^i if i > 0.
+#define NTRACE_NBUCKETS 24
+
+struct nettrace_hist {
+  uint64 count;
+  uint64 sum;      // ticks
+  uint64 max;      // ticks
+  uint64 buckets[NTRACE_NBUCKETS];
+};
+
+struct nettrace {
+  uint32 on;       // tracing
+  uint32 hz;       // ticks per second of the time CSR
+  struct nettrace_hist stages[NTRACE_NSTAGES];
+};
@@ -0,0 +1,245 @@
+//
+// page cache: the contents of files, a page at a time, in
+// pages from kalloc(). readi() reads through it, writei()
+// writes through it to the buffer cache and the log, and
+// exec()'d programs map its pages, so that every process
+// running the same program shares its text. The buffer cache
+// is then mostly left to metadata.
+//
+// Each cached file has a radix tree from page number to page;
+// since files have at most MAXFILE blocks, one level, a single
+// page of PCPAGES slots, is enough. The cache holds a reference
+// (kincref) to each of its pages. When kalloc() runs out, it
+// calls pcreclaim() for the pages no process has mapped.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+#define PCPAGES (PGSIZE / sizeof(uint64))
+
+struct pcfile {
+  uint dev;
+  uint inum;
+  uint64 *pages;   // radix tree root: pa of each page, or 0;
+                   // 0 if the slot is free
+  int npages;      // how many pages are cached
+  uint lastuse;    // pcache.clock when last used
+};
+
+struct {
+  struct spinlock lock;
+  struct pcfile file[NPCFILE];
+  uint clock;
+} pcache;
+
+void
+pcinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  if(MAXFILE*BSIZE > PCPAGES*PGSIZE)
+    panic("pcinit");
+}
+
+// Caller holds pcache.lock.
+static struct pcfile *
+pcfind(uint dev, uint inum)
+{
+  struct pcfile *f;
+
+  for(f = pcache.file; f < pcache.file + NPCFILE; f++)
+    if(f->pages && f->dev == dev && f->inum == inum)
+      return f;
+  return 0;
+}
+
+// Drops f's page pgno from the cache, and f itself along with
+// its last page. Caller holds pcache.lock.
+static void
+pcdrop(struct pcfile *f, uint pgno)
+{
+  kfree((void*)f->pages[pgno]);
+  f->pages[pgno] = 0;
+  if(--f->npages == 0){
+    kfree(f->pages);
+    f->pages = 0;
+  }
+}
+
+// Drops the pages of f that no process has mapped.
+// Returns how many. Caller holds pcache.lock.
+static int
+pcshrink(struct pcfile *f)
+{
+  int i, freed = 0;
+
+  for(i = 0; i < PCPAGES && f->pages; i++){
+    if(f->pages[i] && krefcnt((void*)f->pages[i]) == 1){
+      pcdrop(f, i);
+      freed++;
+    }
+  }
+  return freed;
+}
+
+// The least recently used cached file. Caller holds pcache.lock.
+static struct pcfile *
+pclru(void)
+{
+  struct pcfile *f, *lru = 0;
+
+  for(f = pcache.file; f < pcache.file + NPCFILE; f++)
+    if(f->pages && (lru == 0 || f->lastuse < lru->lastuse))
+      lru = f;
+  return lru;
+}
+
+// Returns page pgno of ip's contents if it is cached, with a
+// reference for the caller to kfree(), or else 0.
+uint64
+pclookup(struct inode *ip, uint pgno)
+{
+  struct pcfile *f;
+  uint64 pa = 0;
+
+  acquire(&pcache.lock);
+  if((f = pcfind(ip->dev, ip->inum)) != 0 && (pa = f->pages[pgno]) != 0){
+    kincref((void*)pa);
+    f->lastuse = ++pcache.clock;
+  }
+  release(&pcache.lock);
+  return pa;
+}
+
+// Adds mem, just read in, to the cache as page pgno of ip, if
+// there is room for it. Caller holds ip->lock, as does anyone
+// adding a page of ip, so the page can't be there already.
+void
+pcinsert(struct inode *ip, uint pgno, char *mem)
+{
+  struct pcfile *f;
+  uint64 *root = 0;
+
+  for(;;){
+    acquire(&pcache.lock);
+    if((f = pcfind(ip->dev, ip->inum)) != 0 || root != 0)
+      break;
+    // kalloc() may call pcreclaim(), so not with pcache.lock held.
+    release(&pcache.lock);
+    if((root = kalloc()) == 0)
+      return;
+    memset(root, 0, PGSIZE);
+  }
+  if(f == 0){
+    for(f = pcache.file; f < pcache.file + NPCFILE; f++)
+      if(f->pages == 0)
+        break;
+    if(f == pcache.file + NPCFILE){
+      // evict the least recently used file, if no process
+      // has any of its pages mapped.
+      f = pclru();
+      pcshrink(f);
+      if(f->pages){
+        release(&pcache.lock);
+        kfree(root);
+        return;
+      }
+    }
+    f->dev = ip->dev;
+    f->inum = ip->inum;
+    f->pages = root;
+    f->npages = 0;
+    root = 0;
+  }
+  f->pages[pgno] = (uint64)mem;
+  f->npages++;
+  f->lastuse = ++pcache.clock;
+  kincref(mem);
+  release(&pcache.lock);
+  if(root)
+    kfree(root);
+}
+
+// Returns page pgno of ip's contents, as ipage() does, for
+// uvmfault() to map; the page must not be written. Reads it in
+// only if canblock is 1 and the caller doesn't hold ip->lock;
+// otherwise returns 0 unless it is cached.
+uint64
+pcget(struct inode *ip, uint pgno, int canblock)
+{
+  uint64 pa;
+
+  if((pa = pclookup(ip, pgno)) != 0)
+    return pa;
+  if(!canblock || holdingsleep(&ip->lock))
+    return 0;
+  ilock(ip);
+  pa = ipage(ip, pgno);
+  iunlock(ip);
+  return pa;
+}
+
+// Copies n bytes at src, which writei() is writing at off in ip,
+// into the page that caches them; they don't cross a page. A
+// page that a process has mapped is dropped instead, and the
+// process keeps the old bytes. Caller holds ip->lock.
+void
+pcupdate(struct inode *ip, uint off, char *src, uint n)
+{
+  struct pcfile *f;
+  uint64 pa;
+
+  acquire(&pcache.lock);
+  if((f = pcfind(ip->dev, ip->inum)) != 0 && (pa = f->pages[off / PGSIZE]) != 0){
+    if(krefcnt((void*)pa) == 1)
+      memmove((char*)pa + off % PGSIZE, src, n);
+    else
+      pcdrop(f, off / PGSIZE);
+  }
+  release(&pcache.lock);
+}
+
+// Drops every cached page of ip, whose contents are going
+// away; that includes pages beyond the end of the file, which
+// ipage() caches zero-filled for a segment that runs past it.
+// Caller holds ip->lock.
+void
+pcinval(struct inode *ip)
+{
+  struct pcfile *f;
+  int i;
+
+  acquire(&pcache.lock);
+  if((f = pcfind(ip->dev, ip->inum)) != 0){
+    for(i = 0; i < PCPAGES && f->pages; i++)
+      if(f->pages[i])
+        pcdrop(f, i);
+  }
+  release(&pcache.lock);
+}
+
+// Frees the unmapped pages of the least recently used file that
+// has any, for kalloc() when it has run out. Returns how many.
+int
+pcreclaim(void)
+{
+  struct pcfile *f;
+  int i, n = 0;
+
+  acquire(&pcache.lock);
+  for(i = 0; i < NPCFILE && (f = pclru()) != 0; i++){
+    if((n = pcshrink(f)) > 0)
+      break;
+    // every page is mapped; look at the others first next time.
+    f->lastuse = ++pcache.clock;
+  }
+  release(&pcache.lock);
+  return n;
+}
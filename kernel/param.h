@@ -1,7 +1,9 @@
-#define NPROC        10  // maximum number of processes
+#define NPROC        11  // maximum number of processes, kswapd included
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
+#define NOFILE      512  // open files per process
+#define NOFILEINIT   16  // room for this many until a process has more
+#define NFILE       100  // open files per system, before struct files
+                         // came from a slab; now there is no limit
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       0  // device number of file system root disk
@@ -12,3 +14,8 @@
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define NDISK        2
+#define NPCFILE      32  // files with pages in the page cache
+#define NEXECSEG      4  // max program segments exec loads on demand
+#define SWAPDISK      1  // virtio disk to swap to, if qemu has it
+#define NSWAP      2048  // max pages of swap
+#define SWAPLOW      64  // kswapd keeps this many pages free
@@ -0,0 +1,336 @@
+//
+// packet capture: frames the e1000 sends and receives are copied
+// into a ring that one process at a time maps and reads.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "net.h"
+#include "pcap.h"
+
+#define PCAP_SIZE (PCAP_DATAPAGES*PGSIZE)
+#define MTIME_HZ  10000000 // qemu's time CSR counts at 10 MHz
+
+struct {
+  struct spinlock lock;
+  int on;                  // capturing; pcaptap() peeks without the lock
+  struct pcapring *ring;   // the shared header page
+  char *data[PCAP_DATAPAGES];
+  uint64 head;             // our copy of ring->head, which the reader can write
+  uint64 drops;            // and of ring->drops
+  pagetable_t pagetable;   // the reader's page table, where the ring is mapped
+  int waiting;             // the reader is asleep in pcapwait()
+  struct pcapinsn filter[PCAP_MAXINSNS];
+  int nfilter;             // 0: capture PCAP_SNAPLEN bytes of every frame
+} pcap;
+
+void
+pcapinit(void)
+{
+  initlock(&pcap.lock, "pcap");
+  if ((1 + PCAP_DATAPAGES) * PGSIZE > KSTACK(NPROC-1) - PCAPRING)
+    panic("pcapinit");
+}
+
+// Allocates the ring's pages, the first time there is a reader.
+// They are kept for the next one.
+static int
+pcapalloc(void)
+{
+  int i;
+
+  if (pcap.ring)
+    return 0;
+  for (i = 0; i < PCAP_DATAPAGES; i++) {
+    if ((pcap.data[i] = kalloc()) == 0)
+      goto bad;
+  }
+  if ((pcap.ring = kalloc()) == 0)
+    goto bad;
+  memset(pcap.ring, 0, PGSIZE);
+  return 0;
+
+bad:
+  while (--i >= 0)
+    kfree(pcap.data[i]);
+  return -1;
+}
+
+// Checks that the filter f of n instructions only uses the
+// instructions we know, and always ends in a PCAP_RET.
+static int
+pcapcheck(struct pcapinsn *f, int n)
+{
+  int i;
+
+  if (n == 0)
+    return 0;
+  if (f[n-1].code != PCAP_RET)
+    return -1;
+  for (i = 0; i < n; i++) {
+    switch (f[i].code) {
+    case PCAP_JEQ:
+    case PCAP_JGT:
+    case PCAP_JSET:
+      if (i + 1 + f[i].jt >= n || i + 1 + f[i].jf >= n)
+        return -1;
+      break;
+    case PCAP_LDB:
+    case PCAP_LDH:
+    case PCAP_LDW:
+    case PCAP_AND:
+    case PCAP_RET:
+      break;
+    default:
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Loads the n bytes at off in the frame held by the chain m into
+// *a, big-endian. Returns -1 if the frame is too short.
+static int
+pcapload(struct mbuf *m, uint32 off, int n, uint32 *a)
+{
+  *a = 0;
+  while (n-- > 0) {
+    for (; m && off >= m->len; m = m->next)
+      off -= m->len;
+    if (m == 0)
+      return -1;
+    *a = (*a << 8) | (uint8)m->head[off++];
+  }
+  return 0;
+}
+
+// Runs the filter over the frame held by m, and returns how
+// many bytes of it to capture. Caller holds pcap.lock.
+static uint32
+pcaprun(struct mbuf *m)
+{
+  struct pcapinsn *pc;
+  uint32 a;
+
+  if (pcap.nfilter == 0)
+    return PCAP_SNAPLEN;
+  a = 0;
+  for (pc = pcap.filter; ; pc++) {
+    switch (pc->code) {
+    case PCAP_LDB:
+      if (pcapload(m, pc->k, 1, &a) < 0)
+        return 0;
+      break;
+    case PCAP_LDH:
+      if (pcapload(m, pc->k, 2, &a) < 0)
+        return 0;
+      break;
+    case PCAP_LDW:
+      if (pcapload(m, pc->k, 4, &a) < 0)
+        return 0;
+      break;
+    case PCAP_AND:
+      a &= pc->k;
+      break;
+    case PCAP_JEQ:
+      pc += (a == pc->k) ? pc->jt : pc->jf;
+      break;
+    case PCAP_JGT:
+      pc += (a > pc->k) ? pc->jt : pc->jf;
+      break;
+    case PCAP_JSET:
+      pc += (a & pc->k) ? pc->jt : pc->jf;
+      break;
+    default: // PCAP_RET, as pcapcheck() made sure
+      return pc->k;
+    }
+  }
+}
+
+// Copies n bytes from src into the ring at off, which the
+// record they belong to keeps from wrapping.
+static void
+pcapcopy(uint64 off, void *src, uint n)
+{
+  uint c;
+
+  for (; n > 0; n -= c, off += c, src = (char *)src + c) {
+    c = PGSIZE - off % PGSIZE;
+    if (c > n)
+      c = n;
+    memmove(pcap.data[off / PGSIZE] + off % PGSIZE, src, c);
+  }
+}
+
+// Captures the frame held by m, which the e1000 has received
+// (dir is PCAP_RX) or is about to send (PCAP_TX), if a reader
+// has the ring mapped and its filter takes the frame.
+void
+pcaptap(struct mbuf *m, int dir)
+{
+  struct pcaprec rec;
+  struct mbuf *seg;
+  uint64 used, off, pad;
+  uint32 caplen, reclen, c, n;
+
+  if (!pcap.on)
+    return;
+  acquire(&pcap.lock);
+  if (!pcap.on || (caplen = pcaprun(m)) == 0)
+    goto out;
+  rec.len = mbufchainlen(m);
+  if (caplen > rec.len)
+    caplen = rec.len;
+  reclen = PCAP_RECLEN(caplen);
+
+  // a record that would run past the end of the ring goes at
+  // its start instead, after a PCAP_PAD record. tail comes from
+  // the reader, so it is only trusted to say how much is free.
+  off = pcap.head % PCAP_SIZE;
+  pad = off + reclen > PCAP_SIZE ? PCAP_SIZE - off : 0;
+  used = pcap.head - pcap.ring->tail;
+  if (used > PCAP_SIZE || used + pad + reclen > PCAP_SIZE) {
+    pcap.ring->drops = ++pcap.drops;
+    goto out;
+  }
+  memset(&rec.pad, 0, sizeof(rec.pad));
+  if (pad) {
+    rec.dir = PCAP_PAD;
+    rec.ts = rec.caplen = 0;
+    pcapcopy(off, &rec, sizeof(rec));
+    pcap.head += pad;
+    off = 0;
+  }
+  rec.ts = r_time();
+  rec.caplen = caplen;
+  rec.dir = dir;
+  pcapcopy(off, &rec, sizeof(rec));
+  off += sizeof(rec);
+  for (seg = m, n = caplen; seg && n > 0; seg = seg->next, n -= c) {
+    c = seg->len < n ? seg->len : n;
+    pcapcopy(off, seg->head, c);
+    off += c;
+  }
+  pcap.head += reclen;
+
+  // the reader must see the record before the new head.
+  __sync_synchronize();
+  pcap.ring->head = pcap.head;
+  if (pcap.waiting) {
+    pcap.waiting = 0;
+    wakeup(&pcap);
+  }
+out:
+  release(&pcap.lock);
+}
+
+// Maps the ring into the current process at PCAPRING and starts
+// capturing the frames that the filter of n instructions at user
+// address uf accepts. Returns PCAPRING, or -1 if another process
+// has the ring.
+uint64
+pcapopen(uint64 uf, int n)
+{
+  struct proc *p = myproc();
+  struct pcapinsn f[PCAP_MAXINSNS];
+  int i, perm;
+
+  if (n < 0 || n > PCAP_MAXINSNS)
+    return -1;
+  if (n > 0 && copyin(p->pagetable, (char *)f, uf, n * sizeof(f[0])) < 0)
+    return -1;
+  if (pcapcheck(f, n) < 0)
+    return -1;
+
+  acquire(&pcap.lock);
+  if (pcap.pagetable) {
+    release(&pcap.lock);
+    return -1;
+  }
+  pcap.pagetable = p->pagetable;
+  release(&pcap.lock);
+
+  // the ring is ours, but pcaptap() ignores it until on is set.
+  if (pcapalloc() < 0)
+    goto bad;
+  // the reader may only move tail, in the header page.
+  for (i = 0; i <= PCAP_DATAPAGES; i++) {
+    perm = i == 0 ? PTE_R | PTE_W | PTE_U : PTE_R | PTE_U;
+    if (mappages(p->pagetable, PCAPRING + i*PGSIZE, PGSIZE,
+                 i == 0 ? (uint64)pcap.ring : (uint64)pcap.data[i-1],
+                 perm) < 0) {
+      if (i > 0)
+        uvmunmap(p->pagetable, PCAPRING, i*PGSIZE, 0);
+      goto bad;
+    }
+  }
+  sfence_vma_asid(p->asid);
+
+  acquire(&pcap.lock);
+  memmove(pcap.filter, f, n * sizeof(f[0]));
+  pcap.nfilter = n;
+  pcap.head = pcap.drops = 0;
+  pcap.ring->head = pcap.ring->tail = pcap.ring->drops = 0;
+  pcap.ring->size = PCAP_SIZE;
+  pcap.ring->hz = MTIME_HZ;
+  pcap.on = 1;
+  release(&pcap.lock);
+  return PCAPRING;
+
+bad:
+  acquire(&pcap.lock);
+  pcap.pagetable = 0;
+  release(&pcap.lock);
+  return -1;
+}
+
+// Waits until the ring holds a record the current process,
+// which must have it mapped, hasn't consumed.
+int
+pcapwait(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&pcap.lock);
+  if (!pcap.on || pcap.pagetable != p->pagetable) {
+    release(&pcap.lock);
+    return -1;
+  }
+  while (pcap.head == pcap.ring->tail) {
+    if (p->killed) {
+      release(&pcap.lock);
+      return -1;
+    }
+    pcap.waiting = 1;
+    sleep(&pcap, &pcap.lock);
+  }
+  release(&pcap.lock);
+  return 0;
+}
+
+// Stops capturing and unmaps the ring, if pagetable is the one
+// it is mapped in. pcapclose() calls this, and so does freeing
+// a page table, so that exit() and exec() give up the ring.
+int
+pcapunmap(pagetable_t pagetable)
+{
+  acquire(&pcap.lock);
+  if (pagetable == 0 || pcap.pagetable != pagetable || !pcap.on) {
+    release(&pcap.lock);
+    return -1;
+  }
+  pcap.on = 0;
+  release(&pcap.lock);
+
+  uvmunmap(pagetable, PCAPRING, (1 + PCAP_DATAPAGES)*PGSIZE, 0);
+
+  acquire(&pcap.lock);
+  pcap.pagetable = 0;
+  release(&pcap.lock);
+  return 0;
+}
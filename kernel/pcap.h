@@ -0,0 +1,67 @@
+// Packet capture.
+// Both the kernel and user programs use this header file.
+//
+// pcapopen() maps a ring into the caller's address space: a
+// header page, struct pcapring, followed by PCAP_DATAPAGES pages
+// of records. The kernel appends a record for each frame that
+// the e1000 sends or receives and the filter accepts, and
+// advances head; the reader consumes records and advances tail.
+// Neither side makes a system call per frame; pcapwait() sleeps
+// until there is something to read.
+
+#define PCAP_DATAPAGES 16
+
+struct pcapring {
+  uint64 head;     // bytes ever written; advanced by the kernel
+  uint64 tail;     // bytes ever consumed; advanced by the reader
+  uint64 drops;    // frames lost because the ring was full
+  uint32 size;     // bytes of records, starting at PCAP_DATA()
+  uint32 hz;       // ticks per second of pcaprec.ts
+};
+
+#define PCAP_DATA(r)  ((char *)(r) + 4096)
+
+// a record, followed by caplen bytes of the frame.
+// records start at multiples of PCAP_ALIGN and never wrap.
+struct pcaprec {
+  uint64 ts;       // when the frame was captured
+  uint32 len;      // length of the frame
+  uint32 caplen;   // bytes of it captured
+  uint8  dir;      // PCAP_RX, PCAP_TX, or PCAP_PAD
+  uint8  pad[15];
+};
+
+#define PCAP_RX   1
+#define PCAP_TX   2
+#define PCAP_PAD  3  // no frame; the next record is at the ring's start
+
+#define PCAP_ALIGN  32
+#define PCAP_RECLEN(caplen) \
+  ((sizeof(struct pcaprec) + (caplen) + PCAP_ALIGN - 1) & ~(PCAP_ALIGN - 1))
+
+// bytes captured of each frame if there is no filter.
+#define PCAP_SNAPLEN 1514
+
+// A filter is a program for a subset of the classic BPF machine,
+// with the same instruction encoding. It runs over each frame
+// from its Ethernet header, and returns how many bytes of the
+// frame to capture; 0 skips it. Loads past the end of the frame
+// return 0. Jumps are forward only, relative to the next
+// instruction, and the last instruction must be a PCAP_RET.
+struct pcapinsn {
+  uint16 code;
+  uint8  jt;       // conditional jumps: skip this many if true
+  uint8  jf;       //                    and this many if false
+  uint32 k;
+};
+
+#define PCAP_LDB   0x30  // A = the byte at offset k
+#define PCAP_LDH   0x28  // A = the big-endian 16 bits at offset k
+#define PCAP_LDW   0x20  // A = the big-endian 32 bits at offset k
+#define PCAP_AND   0x54  // A &= k
+#define PCAP_JEQ   0x15  // jump if A == k
+#define PCAP_JGT   0x25  // jump if A > k
+#define PCAP_JSET  0x45  // jump if A & k
+#define PCAP_RET   0x06  // capture k bytes
+
+#define PCAP_MAXINSNS 32
@@ -7,6 +7,8 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
+#include "errno.h"
 
 #define PIPESIZE 512
 
@@ -17,6 +19,7 @@ struct pipe {
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct wq wq;   // poll() and epoll waiters
 };
 
 int
@@ -35,6 +38,7 @@ pipealloc(struct file **f0, struct file **f1)
   pi->nwrite = 0;
   pi->nread = 0;
   memset(&pi->lock, 0, sizeof(pi->lock));
+  wqinit(&pi->wq, "pipewq");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -66,6 +70,7 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  wqwakeup(&pi->wq);
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
     kfree((char*)pi);
@@ -73,8 +78,10 @@ pipeclose(struct pipe *pi, int writable)
     release(&pi->lock);
 }
 
+// If nonblock is set, write only what fits, and
+// return -EAGAIN if nothing does.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, uint64 addr, int n, int nonblock)
 {
   int i;
   char ch;
@@ -87,7 +94,14 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
         release(&pi->lock);
         return -1;
       }
+      if(nonblock){
+        wakeup(&pi->nread);
+        wqwakeup(&pi->wq);
+        release(&pi->lock);
+        return i > 0 ? i : -EAGAIN;
+      }
       wakeup(&pi->nread);
+      wqwakeup(&pi->wq);
       sleep(&pi->nwrite, &pi->lock);
     }
     if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
@@ -95,12 +109,15 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
     pi->data[pi->nwrite++ % PIPESIZE] = ch;
   }
   wakeup(&pi->nread);
+  wqwakeup(&pi->wq);
   release(&pi->lock);
   return n;
 }
 
+// If nonblock is set, return -EAGAIN instead of
+// waiting for data.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, uint64 addr, int n, int nonblock)
 {
   int i;
   struct proc *pr = myproc();
@@ -112,6 +129,10 @@ piperead(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
+    if(nonblock){
+      release(&pi->lock);
+      return -EAGAIN;
+    }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
   for(i = 0; i < n; i++){  //DOC: piperead-copy
@@ -122,6 +143,32 @@ piperead(struct pipe *pi, uint64 addr, int n)
       break;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  wqwakeup(&pi->wq);
   release(&pi->lock);
   return i;
 }
+
+// Report whether the read or write end of pi is ready,
+// first adding e to pi's wait queue if e is non-zero.
+int
+pipepoll(struct pipe *pi, int writable, struct wqent *e)
+{
+  int mask = 0;
+
+  if(e)
+    wqadd(&pi->wq, e);
+  acquire(&pi->lock);
+  if(writable){
+    if(pi->readopen == 0)
+      mask |= POLLERR;
+    else if(pi->nwrite < pi->nread + PIPESIZE)
+      mask |= POLLOUT;
+  } else {
+    if(pi->nread != pi->nwrite)
+      mask |= POLLIN;
+    if(pi->writeopen == 0)
+      mask |= POLLHUP;
+  }
+  release(&pi->lock);
+  return mask;
+}
@@ -35,6 +35,7 @@ plicinithart(void)
   uint32 enabled = 0;
   enabled |= (1 << UART0_IRQ);
   enabled |= (1 << VIRTIO0_IRQ);
+  enabled |= (1 << VIRTIO1_IRQ);
   *(uint32*)PLIC_SENABLE(hart) = enabled;
 
   // hack to get at next 32 IRQs for e1000
@@ -0,0 +1,478 @@
+//
+// Readiness multiplexing: wait queues, poll() and epoll.
+//
+// Pipes, sockets and the console each have a struct wq.
+// Whenever one of them may have become readable or writable,
+// it calls wqwakeup(), which runs the notify function of every
+// entry on the queue. poll() puts one entry per fd on the
+// queues for the duration of the call; an epoll instance keeps
+// one entry per registered fd on the queue until it is removed.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "poll.h"
+
+void
+wqinit(struct wq *wq, char *name)
+{
+  initlock(&wq->lock, name);
+  wq->head = 0;
+}
+
+// Add e to wq. e must not already be on a queue.
+void
+wqadd(struct wq *wq, struct wqent *e)
+{
+  acquire(&wq->lock);
+  e->wq = wq;
+  e->next = wq->head;
+  wq->head = e;
+  release(&wq->lock);
+}
+
+// Remove e from whatever queue it is on. Once this returns,
+// e->notify will not be called again.
+void
+wqdel(struct wqent *e)
+{
+  struct wq *wq = e->wq;
+  struct wqent **pp;
+
+  if(wq == 0)
+    return;
+  acquire(&wq->lock);
+  for(pp = &wq->head; *pp; pp = &(*pp)->next){
+    if(*pp == e){
+      *pp = e->next;
+      break;
+    }
+  }
+  e->wq = 0;
+  release(&wq->lock);
+}
+
+// Notify everyone waiting on wq.
+// Caller should hold the lock of the object that owns wq.
+void
+wqwakeup(struct wq *wq)
+{
+  struct wqent *e;
+
+  acquire(&wq->lock);
+  for(e = wq->head; e; e = e->next)
+    e->notify(e);
+  release(&wq->lock);
+}
+
+// Return the tick at which a wait of timeout ticks ends,
+// or 0 for none (timeout < 0 means wait forever).
+static uint
+deadline(int timeout)
+{
+  uint d;
+
+  if(timeout <= 0)
+    return 0;
+  d = ticks + timeout;
+  return d ? d : 1;
+}
+
+static int
+expired(uint d)
+{
+  return d && (int)(ticks - d) >= 0;
+}
+
+//
+// poll()
+//
+
+// the state shared by one poll() call and its wait queue entries.
+struct poller {
+  struct spinlock lock;
+  int ready;              // set when any entry is notified
+};
+
+static void
+pollnotify(struct wqent *e)
+{
+  struct poller *pl = (struct poller *)e->arg;
+
+  acquire(&pl->lock);
+  pl->ready = 1;
+  wakeup(pl);
+  release(&pl->lock);
+}
+
+#define NPOLLFD (PGSIZE / sizeof(struct wqent))
+
+// Wait until one of the nfds struct pollfds at user address
+// addr is ready, or timeout ticks pass (-1 means forever, 0
+// means don't wait). Returns the number of ready fds.
+int
+pollfds(uint64 addr, int nfds, int timeout)
+{
+  struct proc *p = myproc();
+  struct poller pl;
+  struct pollfd pfd;
+  struct wqent *ents, *e;
+  struct file *f;
+  uint end;
+  int i, n, registered;
+
+  if(nfds < 0 || nfds > NPOLLFD)
+    return -1;
+  if((ents = (struct wqent *)kalloc()) == 0)
+    return -1;
+  memset(ents, 0, PGSIZE);
+  initlock(&pl.lock, "poller");
+  pl.ready = 0;
+  end = deadline(timeout);
+  registered = 0;
+
+  for(;;){
+    n = 0;
+    for(i = 0; i < nfds; i++){
+      if(copyin(p->pagetable, (char *)&pfd, addr + i*sizeof(pfd), sizeof(pfd)) < 0){
+        n = -1;
+        goto out;
+      }
+      pfd.revents = 0;
+      if(pfd.fd >= 0){
+        if((f = fdfile(pfd.fd)) == 0){
+          pfd.revents = POLLNVAL;
+        } else {
+          // only the first pass needs to get on the wait queues.
+          e = 0;
+          if(!registered && timeout != 0){
+            e = &ents[i];
+            e->notify = pollnotify;
+            e->arg = &pl;
+          }
+          pfd.revents = filepoll(f, e) & (pfd.events | POLLERR | POLLHUP);
+        }
+      }
+      if(pfd.revents)
+        n++;
+      if(copyout(p->pagetable, addr + i*sizeof(pfd), (char *)&pfd, sizeof(pfd)) < 0){
+        n = -1;
+        goto out;
+      }
+    }
+    registered = 1;
+
+    if(n > 0 || timeout == 0 || expired(end))
+      break;
+
+    acquire(&pl.lock);
+    while(!pl.ready && !expired(end)){
+      if(p->killed){
+        release(&pl.lock);
+        n = -1;
+        goto out;
+      }
+      sleepuntil(&pl, &pl.lock, end);
+    }
+    pl.ready = 0;
+    release(&pl.lock);
+  }
+
+ out:
+  for(i = 0; i < nfds; i++)
+    wqdel(&ents[i]);
+  kfree((char *)ents);
+  return n;
+}
+
+//
+// epoll
+//
+// An epoll instance lives in one page. Each registered fd has
+// an epitem, which holds a reference to the fd's struct file
+// and stays on the file's wait queue until it is removed, so
+// closing a registered fd does not remove it; EPOLL_CTL_DEL does.
+//
+
+struct epitem {
+  struct file *f;          // registered file, or 0 if this slot is free
+  int fd;                  // fd the caller registered it under
+  uint events;             // requested EPOLL* events
+  uint64 data;             // returned with each event
+  int onrdlist;            // on ep->rdlist?
+  struct epitem *rdnext;
+  struct wqent wqe;        // on f's wait queue
+  struct epoll *ep;
+};
+
+struct epoll {
+  struct spinlock lock;    // protects rdlist, rdtail and onrdlist
+  struct sleeplock mtx;    // serializes epoll_ctl() and epoll_wait() scans
+  struct epitem *rdlist;   // items that may be ready
+  struct epitem *rdtail;
+  struct wq wq;            // for poll() on the epoll fd itself
+  struct epitem items[];
+};
+
+#define NEPITEM ((PGSIZE - sizeof(struct epoll)) / sizeof(struct epitem))
+
+// Queue it on its epoll's ready list.
+// Caller must hold ep->lock.
+static void
+eprdlist(struct epitem *it)
+{
+  struct epoll *ep = it->ep;
+
+  if(it->onrdlist)
+    return;
+  it->onrdlist = 1;
+  it->rdnext = 0;
+  if(ep->rdtail)
+    ep->rdtail->rdnext = it;
+  else
+    ep->rdlist = it;
+  ep->rdtail = it;
+  wakeup(ep);
+  wqwakeup(&ep->wq);
+}
+
+static void
+epnotify(struct wqent *e)
+{
+  struct epitem *it = (struct epitem *)e->arg;
+  struct epoll *ep = it->ep;
+
+  acquire(&ep->lock);
+  eprdlist(it);
+  release(&ep->lock);
+}
+
+int
+epollalloc(struct file **f)
+{
+  struct epoll *ep;
+
+  if((*f = filealloc()) == 0)
+    return -1;
+  if((ep = (struct epoll *)kalloc()) == 0){
+    fileclose(*f);
+    return -1;
+  }
+  memset(ep, 0, PGSIZE);
+  initlock(&ep->lock, "epoll");
+  initsleeplock(&ep->mtx, "epoll");
+  wqinit(&ep->wq, "epollwq");
+  (*f)->type = FD_EPOLL;
+  (*f)->readable = 1;
+  (*f)->writable = 0;
+  (*f)->ep = ep;
+  return 0;
+}
+
+void
+epollclose(struct epoll *ep)
+{
+  struct epitem *it;
+
+  for(it = ep->items; it < ep->items + NEPITEM; it++){
+    if(it->f){
+      wqdel(&it->wqe);
+      fileclose(it->f);
+    }
+  }
+  kfree((char *)ep);
+}
+
+// poll() support for an epoll fd: readable if anything
+// may be ready.
+int
+epollpoll(struct epoll *ep, struct wqent *e)
+{
+  int mask;
+
+  if(e)
+    wqadd(&ep->wq, e);
+  acquire(&ep->lock);
+  mask = ep->rdlist ? POLLIN : 0;
+  release(&ep->lock);
+  return mask;
+}
+
+static struct epitem *
+eplookup(struct epoll *ep, int fd)
+{
+  struct epitem *it;
+
+  for(it = ep->items; it < ep->items + NEPITEM; it++)
+    if(it->f && it->fd == fd)
+      return it;
+  return 0;
+}
+
+// Add, modify or remove the registration of fd (open as f;
+// f may be 0 for EPOLL_CTL_DEL). addr is a user virtual address,
+// pointing to a struct epoll_event (ignored for EPOLL_CTL_DEL).
+int
+epollctl(struct epoll *ep, int op, int fd, struct file *f, uint64 addr)
+{
+  struct proc *p = myproc();
+  struct epoll_event ev;
+  struct epitem *it;
+  int r = -1;
+
+  if(op != EPOLL_CTL_DEL &&
+     copyin(p->pagetable, (char *)&ev, addr, sizeof(ev)) < 0)
+    return -1;
+  // nesting epoll instances could create lock cycles.
+  if(f && f->type == FD_EPOLL)
+    return -1;
+
+  acquiresleep(&ep->mtx);
+  it = eplookup(ep, fd);
+  switch(op){
+  case EPOLL_CTL_ADD:
+    if(it)
+      break;
+    for(it = ep->items; it < ep->items + NEPITEM; it++)
+      if(it->f == 0)
+        break;
+    if(it == ep->items + NEPITEM)
+      break;
+    it->f = filedup(f);
+    it->fd = fd;
+    it->events = ev.events;
+    it->data = ev.data;
+    it->onrdlist = 0;
+    it->ep = ep;
+    it->wqe.notify = epnotify;
+    it->wqe.arg = it;
+    if(filepoll(f, &it->wqe) & (it->events | POLLERR | POLLHUP)){
+      acquire(&ep->lock);
+      eprdlist(it);
+      release(&ep->lock);
+    }
+    r = 0;
+    break;
+  case EPOLL_CTL_MOD:
+    if(it == 0)
+      break;
+    it->events = ev.events;
+    it->data = ev.data;
+    if(filepoll(it->f, 0) & (it->events | POLLERR | POLLHUP)){
+      acquire(&ep->lock);
+      eprdlist(it);
+      release(&ep->lock);
+    }
+    r = 0;
+    break;
+  case EPOLL_CTL_DEL:
+    if(it == 0)
+      break;
+    wqdel(&it->wqe);
+    acquire(&ep->lock);
+    if(it->onrdlist){
+      struct epitem **pp, *prev = 0;
+      for(pp = &ep->rdlist; *pp != it; pp = &(*pp)->rdnext)
+        prev = *pp;
+      *pp = it->rdnext;
+      if(ep->rdtail == it)
+        ep->rdtail = prev;
+      it->onrdlist = 0;
+    }
+    release(&ep->lock);
+    f = it->f;
+    it->f = 0;
+    fileclose(f);
+    r = 0;
+    break;
+  }
+  releasesleep(&ep->mtx);
+  return r;
+}
+
+// Wait for events on ep, storing at most maxevents struct
+// epoll_events at user address addr. timeout is as for poll().
+// Returns the number of events stored.
+int
+epollwait(struct epoll *ep, uint64 addr, int maxevents, int timeout)
+{
+  struct proc *p = myproc();
+  struct epoll_event ev;
+  struct epitem *it, *list;
+  uint end;
+  int n, err;
+
+  if(maxevents <= 0)
+    return -1;
+  end = deadline(timeout);
+
+  for(;;){
+    acquire(&ep->lock);
+    while(ep->rdlist == 0 && timeout != 0 && !expired(end)){
+      if(p->killed){
+        release(&ep->lock);
+        return -1;
+      }
+      sleepuntil(ep, &ep->lock, end);
+    }
+    release(&ep->lock);
+
+    acquiresleep(&ep->mtx);
+    // take the whole ready list. its items keep onrdlist
+    // set, so notifications leave them alone, until each
+    // is popped off below; a notification after that puts
+    // the item back on ep->rdlist.
+    acquire(&ep->lock);
+    list = ep->rdlist;
+    ep->rdlist = ep->rdtail = 0;
+    release(&ep->lock);
+
+    n = 0;
+    err = 0;
+    for(;;){
+      acquire(&ep->lock);
+      if((it = list) == 0){
+        release(&ep->lock);
+        break;
+      }
+      list = it->rdnext;
+      it->onrdlist = 0;
+      if(n >= maxevents || err){
+        // no room; leave it for the next call.
+        eprdlist(it);
+        release(&ep->lock);
+        continue;
+      }
+      release(&ep->lock);
+
+      ev.events = filepoll(it->f, 0) & (it->events | POLLERR | POLLHUP);
+      if(ev.events == 0)
+        continue;
+      ev.data = it->data;
+      if(copyout(p->pagetable, addr + n*sizeof(ev), (char *)&ev, sizeof(ev)) < 0)
+        err = 1;
+      else
+        n++;
+      // level-triggered items stay on the ready list
+      // until a scan finds them not ready.
+      if(err || (it->events & EPOLLET) == 0){
+        acquire(&ep->lock);
+        eprdlist(it);
+        release(&ep->lock);
+      }
+    }
+    releasesleep(&ep->mtx);
+
+    if(err && n == 0)
+      return -1;
+    if(n > 0 || timeout == 0 || expired(end))
+      return n;
+  }
+}
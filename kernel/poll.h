@@ -0,0 +1,31 @@
+// Readiness polling: poll() and epoll.
+// Both the kernel and user programs use this header file.
+
+// events for poll() and epoll
+#define POLLIN    0x001   // data may be read without blocking
+#define POLLOUT   0x004   // data may be written without blocking
+#define POLLERR   0x008   // error (e.g. pipe with no reader); always reported
+#define POLLHUP   0x010   // hang up (e.g. pipe with no writer); always reported
+#define POLLNVAL  0x020   // fd is not open; always reported
+
+struct pollfd {
+  int fd;         // file descriptor; ignored if negative
+  short events;   // requested events
+  short revents;  // returned events, filled in by the kernel
+};
+
+#define EPOLLIN   POLLIN
+#define EPOLLOUT  POLLOUT
+#define EPOLLERR  POLLERR
+#define EPOLLHUP  POLLHUP
+#define EPOLLET   0x80000000  // edge-triggered: report only on new events
+
+// operations for epoll_ctl()
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+struct epoll_event {
+  uint events;    // EPOLL* mask
+  uint64 data;    // returned as-is by epoll_wait()
+};
@@ -20,6 +20,7 @@ struct spinlock pid_lock;
 
 extern void forkret(void);
 static void wakeup1(struct proc *chan);
+static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
@@ -113,10 +114,29 @@ found:
     release(&p->lock);
     return 0;
   }
+  // for uservec to answer getpid() with.
+  p->tf->pid = p->pid;
 
   // An empty user page table.
   p->pagetable = proc_pagetable(p);
 
+  // No open files, and room for NOFILEINIT.
+  memset(p->ofile0, 0, sizeof(p->ofile0));
+  memset(p->fdused, 0, sizeof(p->fdused));
+  p->ofile = p->ofile0;
+  p->nofile = NOFILEINIT;
+
+  // No ASID yet; kvmswitch() picks one.
+  p->asidgen = 0;
+  p->asidcpu = -1;
+
+  // The kernel page table to run with, which kvmsync() fills in.
+  if((p->kpagetable = kvmcreate()) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof p->context);
@@ -135,10 +155,20 @@ freeproc(struct proc *p)
   if(p->tf)
     kfree((void*)p->tf);
   p->tf = 0;
+  if(p->ofile && p->ofile != p->ofile0)
+    kfree(p->ofile);
+  p->ofile = 0;
+  p->nofile = 0;
+  if(p->kpagetable)
+    kvmfree(p->kpagetable);
+  p->kpagetable = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  p->nseg = 0;
+  p->swapva = 0;
+  p->insyscall = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -163,12 +193,17 @@ proc_pagetable(struct proc *p)
   // only the supervisor uses it, on the way
   // to/from user space, so not PTE_U.
   mappages(pagetable, TRAMPOLINE, PGSIZE,
-           (uint64)trampoline, PTE_R | PTE_X);
+           (uint64)trampoline, PTE_R | PTE_X | PTE_G);
 
   // map the trapframe just below TRAMPOLINE, for trampoline.S.
   mappages(pagetable, TRAPFRAME, PGSIZE,
            (uint64)(p->tf), PTE_R | PTE_W);
 
+  // map the vDSO page, the same in every process, which
+  // the process may read but not write.
+  mappages(pagetable, VDSO, PGSIZE,
+           (uint64)vdso, PTE_R | PTE_U | PTE_G);
+
   return pagetable;
 }
 
@@ -179,6 +214,9 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, PGSIZE, 0);
   uvmunmap(pagetable, TRAPFRAME, PGSIZE, 0);
+  uvmunmap(pagetable, VDSO, PGSIZE, 0);
+  uvmunmap(pagetable, URING, PGSIZE, 1);
+  pcapunmap(pagetable);
   if(sz > 0)
     uvmfree(pagetable, sz);
 }
@@ -207,6 +245,7 @@ userinit(void)
   // allocate one user page and copy init's instructions
   // and data into it.
   uvminit(p->pagetable, initcode, sizeof(initcode));
+  kvmsync(p->kpagetable, p->pagetable);
   p->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
@@ -221,6 +260,22 @@ userinit(void)
   release(&p->lock);
 }
 
+// Start a kernel process, which runs fn() in the kernel and
+// never returns to user space. Like forkret(), fn() starts out
+// holding its p->lock, and must release it.
+void
+kproc(void (*fn)(void), char *name)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kproc");
+  p->context.ra = (uint64)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -231,12 +286,19 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
-      return -1;
+    // make room, swapping out our own pages too if need be.
+    while((sz = uvmalloc(p->pagetable, p->sz, p->sz + n, p->megapages)) == 0) {
+      if(swapreclaim(PGROUNDUP(n) / PGSIZE, 1) == 0)
+        return -1;
     }
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    // fails only if a megapage must be split, and can't be.
+    if((sz = uvmdealloc(p->pagetable, p->sz, p->sz + n)) == p->sz)
+      return -1;
   }
+  // new level-0 pages, or megapages split or gone.
+  kvmsync(p->kpagetable, p->pagetable);
+  sfence_vma_asid(p->asid);
   p->sz = sz;
   return 0;
 }
@@ -246,10 +308,15 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *p = myproc();
 
+  // Make room for the copy first: allocproc() returns with
+  // np->lock held, so no swapping out after that.
+  if(kfreepages() < p->sz / PGSIZE)
+    swapreclaim(p->sz / PGSIZE - kfreepages(), 1);
+
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
@@ -262,6 +329,7 @@ fork(void)
     return -1;
   }
   np->sz = p->sz;
+  kvmsync(np->kpagetable, np->pagetable);
 
   np->parent = p;
 
@@ -270,14 +338,23 @@ fork(void)
 
   // Cause fork to return 0 in the child.
   np->tf->a0 = 0;
+  // and getpid() its own pid; the copy has the parent's.
+  np->tf->pid = np->pid;
 
   // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
+  if(fdcopy(np, p) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
   np->cwd = idup(p->cwd);
+  if(p->exe)
+    np->exe = idup(p->exe);
+  np->nseg = p->nseg;
+  memmove(np->seg, p->seg, sizeof(p->seg));
 
   safestrcpy(np->name, p->name, sizeof(p->name));
+  np->megapages = p->megapages;
 
   pid = np->pid;
 
@@ -326,18 +403,21 @@ exit(int status)
     panic("init exiting");
 
   // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
+  for(int fd = 0; fd < p->nofile; fd++){
     if(p->ofile[fd]){
       struct file *f = p->ofile[fd];
       fileclose(f);
-      p->ofile[fd] = 0;
+      fdclear(fd);
     }
   }
 
   begin_op(ROOTDEV);
   iput(p->cwd);
+  if(p->exe)
+    iput(p->exe);
   end_op(ROOTDEV);
   p->cwd = 0;
+  p->exe = 0;
 
   // we might re-parent a child to init. we can't be precise about
   // waking up init, since we can't acquire its lock once we've
@@ -389,6 +469,10 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  // the copyout below can't load a page from the program.
+  if(addr != 0)
+    uvmfaultin(addr, sizeof(int));
+
   // hold p->lock for the whole time to avoid lost
   // wakeups from a child's exit().
   acquire(&p->lock);
@@ -466,7 +550,9 @@ scheduler(void)
         // before jumping back to us.
         p->state = RUNNING;
         c->proc = p;
+        kvmswitch(p);
         swtch(&c->scheduler, &p->context);
+        kvmswitch(0);
 
         // Process is done running for now.
         // It should have changed its p->state before coming back.
@@ -550,6 +636,15 @@ forkret(void)
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
+{
+  sleepuntil(chan, lk, 0);
+}
+
+// Like sleep(), but if deadline is non-zero, also wake up
+// once ticks reaches deadline (see wakeuptimeouts()).
+// Callers must re-check the deadline themselves.
+void
+sleepuntil(void *chan, struct spinlock *lk, uint deadline)
 {
   struct proc *p = myproc();
   
@@ -566,12 +661,14 @@ sleep(void *chan, struct spinlock *lk)
 
   // Go to sleep.
   p->chan = chan;
+  p->wakeat = deadline;
   p->state = SLEEPING;
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  p->wakeat = 0;
 
   // Reacquire original lock.
   if(lk != &p->lock){
@@ -596,6 +693,22 @@ wakeup(void *chan)
   }
 }
 
+// Wake up processes in sleepuntil() whose deadline has passed.
+// Called by the clock interrupt handler.
+void
+wakeuptimeouts(uint now)
+{
+  struct proc *p;
+
+  for(p = proc; p < &proc[NPROC]; p++) {
+    acquire(&p->lock);
+    if(p->state == SLEEPING && p->wakeat && (int)(now - p->wakeat) >= 0) {
+      p->state = RUNNABLE;
+    }
+    release(&p->lock);
+  }
+}
+
 // Wake up p if it is sleeping in wait(); used by exit().
 // Caller must hold p->lock.
 static void
@@ -24,6 +24,7 @@ struct cpu {
   struct context scheduler;   // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation the TLB has been flushed for
 };
 
 extern struct cpu cpus[NCPU];
@@ -78,6 +79,17 @@ struct trapframe {
   /* 264 */ uint64 t4;
   /* 272 */ uint64 t5;
   /* 280 */ uint64 t6;
+  /* 288 */ uint64 pid;           // p->pid, for uservec's getpid()
+};
+
+// A program segment that exec() left for uvmfault() to load
+// from the program's file, page by page as it is touched.
+struct execseg {
+  uint64 va;        // start, page-aligned
+  uint64 fileend;   // end of the bytes from the file
+  uint64 end;       // end of the segment; zeros after fileend
+  uint64 off;       // file offset of va
+  int perm;         // PTE_R, PTE_W and PTE_X
 };
 
 enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
@@ -93,14 +105,28 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  uint wakeat;                 // If non-zero, sleepuntil() deadline in ticks
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // Page table
+  pagetable_t kpagetable;      // Kernel page table, with user memory too
+  int asid;                    // Address-space ID of both page tables
+  uint64 asidgen;              // Generation asid is from (vm.c)
+  int asidcpu;                 // Hart that last ran with asid, or -1
+  int megapages;               // Grow memory in megapages where it can
+  int insyscall;               // In a system call; swap.c leaves it be
+  uint64 swapva;               // Where swapout() looks next
   struct trapframe *tf;        // data page for trampoline.S
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
+  struct file **ofile;         // Open files: ofile0, or a page of NOFILE
+  int nofile;                  // Room in ofile
+  uint64 fdused[NOFILE/64];    // Bitmap of the fds in use
+  struct file *ofile0[NOFILEINIT];
   struct inode *cwd;           // Current directory
+  struct inode *exe;           // Program file, for uvmfault()
+  int nseg;                    // Its segments that load on demand
+  struct execseg seg[NEXECSEG];
   char name[16];               // Process name (debugging)
 };
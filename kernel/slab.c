@@ -0,0 +1,95 @@
+//
+// slab allocator: objects of one size, carved out of pages
+// from kalloc(), for structures the kernel allocates and frees
+// often, like struct file. A slab keeps its pages that have
+// free objects on a list, each page with a list of its own
+// free objects, so allocating and freeing take constant time.
+// A page whose objects are all free goes back to kalloc(),
+// unless the slab would have no free objects left.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "slab.h"
+
+// at the start of each page a slab has.
+struct slabpage {
+  struct list link;     // on partial, while it has free objects
+  struct list free;     // its free objects
+  int inuse;            // its allocated objects
+};
+
+void
+slabinit(struct slab *s, char *name, uint size)
+{
+  initlock(&s->lock, name);
+  // a free object holds its place on the free list.
+  if(size < sizeof(struct list))
+    size = sizeof(struct list);
+  s->size = (size + 7) & ~7;
+  s->perpage = (PGSIZE - sizeof(struct slabpage)) / s->size;
+  if(s->perpage < 1)
+    panic("slabinit");
+  lst_init(&s->partial);
+  s->nfree = 0;
+}
+
+// Returns an object, uninitialized, or 0 if out of memory.
+void*
+slaballoc(struct slab *s)
+{
+  struct slabpage *pg;
+  char *o;
+  int i;
+
+  acquire(&s->lock);
+  if(lst_empty(&s->partial)){
+    if((pg = kalloc()) == 0){
+      release(&s->lock);
+      return 0;
+    }
+    lst_init(&pg->free);
+    pg->inuse = 0;
+    o = (char*)(pg + 1);
+    for(i = 0; i < s->perpage; i++)
+      lst_push(&pg->free, o + i*s->size);
+    lst_push(&s->partial, pg);
+    s->nfree += s->perpage;
+  }
+  pg = (struct slabpage*)s->partial.next;
+  o = lst_pop(&pg->free);
+  pg->inuse++;
+  s->nfree--;
+  if(lst_empty(&pg->free))
+    lst_remove(&pg->link);
+  release(&s->lock);
+  return o;
+}
+
+void
+slabfree(struct slab *s, void *o)
+{
+  struct slabpage *pg = (struct slabpage*)PGROUNDDOWN((uint64)o);
+
+  acquire(&s->lock);
+  if(pg->inuse < 1)
+    panic("slabfree");
+  if(lst_empty(&pg->free))
+    lst_push(&s->partial, pg);
+  lst_push(&pg->free, o);
+  pg->inuse--;
+  s->nfree++;
+  if(pg->inuse == 0 && s->nfree > s->perpage){
+    // another page has free objects too.
+    lst_remove(&pg->link);
+    s->nfree -= s->perpage;
+    release(&s->lock);
+    kfree(pg);
+    return;
+  }
+  release(&s->lock);
+}
@@ -0,0 +1,8 @@
+// A cache of objects of one size, carved out of pages.
+struct slab {
+  struct spinlock lock;
+  uint size;            // of each object
+  int perpage;          // objects that fit in a page
+  struct list partial;  // pages with free objects
+  int nfree;            // free objects in them
+};
@@ -0,0 +1,42 @@
+// Socket options and statistics.
+// Both the kernel and user programs use this header file.
+
+// options for setsockopt()
+#define SO_RCVBUF      1   // receive buffer limit, in bytes
+#define SO_JOINGROUP   2   // receive datagrams sent to multicast group val
+#define SO_LEAVEGROUP  3   // stop receiving those of group val
+
+// groups one socket may join.
+#define SOCK_MAXGROUPS 4
+
+// limits on SO_RCVBUF. each queued packet is charged for the
+// whole pages backing its mbufs, not just its payload.
+#define SOCK_RCVBUF_MIN      (2*4096)
+#define SOCK_RCVBUF_DEFAULT  (32*4096)
+#define SOCK_RCVBUF_MAX      (256*4096)
+
+// a TCP connection's send and receive buffers, in bytes.
+#define SOCK_TCPBUF          (4*4096)
+
+struct sockstat {
+  uint32 raddr;        // remote IPv4 address
+  uint16 lport;        // local port
+  uint16 rport;        // remote port
+  int rcvbuf;          // receive buffer limit (bytes)
+  int rxqlen;          // packets waiting to be read
+  int rxqbytes;        // bytes charged against rcvbuf
+  uint64 rxpkts;       // packets queued for reading
+  uint64 rxbytes;      // payload bytes queued for reading
+  uint64 rxdrops;      // packets dropped because rcvbuf was full
+  uint64 rxdropbytes;  // payload bytes dropped because rcvbuf was full
+};
+
+// one datagram for recvmmsg() and sendmmsg().
+struct mmsg {
+  uint64 buf;          // user address of the payload buffer
+  int len;             // size of buf
+  int n;               // bytes received or sent, filled in by the kernel
+  uint32 addr;         // the remote address and port: the sender, filled in
+  uint16 port;         // by recvmmsg(); the destination, for sendmmsg() on a
+                       // socket connected with a 0 raddr or rport
+};
@@ -0,0 +1,274 @@
+//
+// swap: when memory runs short, pages of user memory go to
+// the second virtio disk, and uvmfault() brings them back
+// when they are touched.
+//
+// kswapd, a kernel process, keeps at least SWAPLOW pages free,
+// taking them from the page cache first and then from user
+// memory. It sleeps until kalloc() finds free pages running
+// short. A process that can't get memory calls swapreclaim()
+// itself. Victims are picked with the clock algorithm: a page
+// whose PTE_A is set gets it cleared and another chance.
+//
+// A swapped-out page's PTE isn't valid; it has PTE_SW, the
+// page's permissions, and its swap slot (SLOT2PTE). fork()
+// shares slots, so each has a reference count.
+//
+// Only processes that aren't running, and are between system
+// calls, lose pages: a system call may hold on to user memory
+// it has loaded (see uvmfaultin()) across a sleep.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define SWAPHIGH  128  // kswapd frees up to this many at a time
+#define SWAPSCAN  512  // PTEs swapout() looks at in one go
+
+#define SLOTSECTOR(slot) ((uint64)(slot) * (PGSIZE / 512))
+
+extern struct proc proc[NPROC];
+
+struct {
+  struct spinlock lock;
+  int nslot;             // 0 if there's no swap disk
+  uchar ref[NSWAP];      // PTEs holding each slot
+  int hand;              // the process swapreclaim() tries next
+  int low;               // kalloc() found fewer than SWAPLOW free
+} swap;
+
+static void kswapd(void);
+
+void
+swapinit(void)
+{
+  uint64 n;
+
+  initlock(&swap.lock, "swap");
+  if((n = virtio_disk_capacity(SWAPDISK) / (PGSIZE / 512)) == 0)
+    return;
+  virtio_disk_init(SWAPDISK);
+  swap.nslot = n < NSWAP ? n : NSWAP;
+  kproc(kswapd, "kswapd");
+}
+
+// A free slot, with one reference, or -1.
+static int
+swapalloc(void)
+{
+  int i;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    if(swap.ref[i] == 0){
+      swap.ref[i] = 1;
+      release(&swap.lock);
+      return i;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Another PTE holds slot, as fork() copies it.
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0xff)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapfree");
+  swap.ref[slot]--;
+  release(&swap.lock);
+}
+
+// Can pages be taken from p? self says whether they can be
+// from the current process. Caller holds p->lock.
+static int
+swappable(struct proc *p, int self)
+{
+  if(p == myproc())
+    return self;
+  return (p->state == RUNNABLE || p->state == SLEEPING) &&
+         !p->insyscall && p->pagetable != 0;
+}
+
+// Writes a page of p out to swap, the first one from
+// p->swapva on whose PTE_A is clear. Returns 1, or 0 if there
+// is none among the next SWAPSCAN pages or no free slot.
+static int
+swapout(struct proc *p, int self)
+{
+  pagetable_t pagetable;
+  pte_t *pte;
+  uint64 va, pa;
+  int i, pid, slot;
+
+  if((slot = swapalloc()) < 0)
+    return 0;
+
+  acquire(&p->lock);
+  if(!swappable(p, self) || p->sz == 0){
+    release(&p->lock);
+    swapfree(slot);
+    return 0;
+  }
+  pte = 0;
+  va = p->swapva;
+  for(i = 0; i < SWAPSCAN; i++, va += PGSIZE){
+    if(va >= p->sz)
+      va = 0;
+    pte = uvmpte(p->pagetable, va);
+    if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) ||
+       krefcnt((void*)PTE2PA(*pte)) > 1){
+      pte = 0;
+      continue;
+    }
+    if((*pte & PTE_A) == 0)
+      break;
+    // give it another chance.
+    *pte &= ~PTE_A;
+    pte = 0;
+  }
+  p->swapva = va + PGSIZE;
+  if(pte == 0){
+    // every PTE_A cleared here must be set again, so the
+    // process flushes its TLB entries before it next runs.
+    p->asidcpu = -1;
+    release(&p->lock);
+    swapfree(slot);
+    return 0;
+  }
+
+  // write the page out with the process free to run, and
+  // then only take the page if it didn't change meanwhile.
+  *pte &= ~PTE_D;
+  p->asidcpu = -1;
+  if(p == myproc())
+    sfence_vma_asid(p->asid);
+  pa = PTE2PA(*pte);
+  kincref((void*)pa);
+  pagetable = p->pagetable;
+  pid = p->pid;
+  release(&p->lock);
+
+  virtio_disk_rwpage(SWAPDISK, SLOTSECTOR(slot), (void*)pa, 1);
+
+  acquire(&p->lock);
+  if(p->pid != pid || p->pagetable != pagetable || !swappable(p, self) ||
+     (pte = uvmpte(pagetable, va)) == 0 || (*pte & PTE_V) == 0 ||
+     PTE2PA(*pte) != pa || (*pte & PTE_D) || krefcnt((void*)pa) > 2){
+    release(&p->lock);
+    swapfree(slot);
+    kfree((void*)pa);
+    return 0;
+  }
+  *pte = SLOT2PTE(slot) | (*pte & (PTE_R|PTE_W|PTE_X|PTE_U)) | PTE_SW;
+  p->asidcpu = -1;
+  if(p == myproc())
+    sfence_vma_page(va, p->asid);
+  release(&p->lock);
+  kfree((void*)pa);
+  kfree((void*)pa);
+  return 1;
+}
+
+// Reads the page that *pte, at va in the current process, has
+// swapped out back in. Returns 0, or -1 if out of memory.
+int
+swapin(uint64 va, pte_t *pte)
+{
+  struct proc *p = myproc();
+  uint slot = PTE2SLOT(*pte);
+  char *mem;
+
+  if((mem = kalloc()) == 0 &&
+     (swapreclaim(1, !p->insyscall) == 0 || (mem = kalloc()) == 0))
+    return -1;
+  virtio_disk_rwpage(SWAPDISK, SLOTSECTOR(slot), mem, 0);
+  *pte = PA2PTE(mem) | (*pte & (PTE_R|PTE_W|PTE_X|PTE_U)) | PTE_V;
+  sfence_vma_page(va, p->asid);
+  swapfree(slot);
+  return 0;
+}
+
+// Frees up to n pages, from the page cache and then by swapping
+// out user memory, the current process's too if self is 1.
+// Returns how many it freed.
+int
+swapreclaim(int n, int self)
+{
+  struct proc *p;
+  int freed, tries;
+
+  freed = 0;
+  for(tries = 0; freed < n && tries < 2*NPROC; tries++){
+    freed += pcreclaim();
+    if(freed >= n || swap.nslot == 0)
+      break;
+    p = &proc[swap.hand];
+    if(swapout(p, self)){
+      freed++;
+      tries = 0;
+    } else {
+      swap.hand = (swap.hand + 1) % NPROC;
+    }
+  }
+  return freed;
+}
+
+// Called by kalloc() when fewer than SWAPLOW pages are left.
+// kalloc() may hold a p->lock, which wakeup() needs, so this
+// only notes it; swaptick() wakes kswapd.
+void
+swaplow(void)
+{
+  swap.low = 1;
+}
+
+// Called by the clock interrupt handler.
+void
+swaptick(void)
+{
+  if(!swap.low)
+    return;
+  acquire(&swap.lock);
+  swap.low = 0;
+  wakeup(&swap);
+  release(&swap.lock);
+}
+
+// Keeps SWAPLOW pages free, sleeping while there are.
+static void
+kswapd(void)
+{
+  // still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  for(;;){
+    acquire(&swap.lock);
+    while(kfreepages() >= SWAPLOW)
+      sleep(&swap, &swap.lock);
+    release(&swap.lock);
+    if(swapreclaim(SWAPHIGH - kfreepages(), 0) == 0){
+      // nothing to take for now; wait for the next report.
+      acquire(&swap.lock);
+      sleep(&swap, &swap.lock);
+      release(&swap.lock);
+    }
+  }
+}
@@ -106,6 +106,29 @@ extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
 extern uint64 sys_connect(void);
 extern uint64 sys_ntas(void);
+extern uint64 sys_setsockopt(void);
+extern uint64 sys_sockstat(void);
+extern uint64 sys_sendmmsg(void);
+extern uint64 sys_recvmmsg(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_epoll_create(void);
+extern uint64 sys_epoll_ctl(void);
+extern uint64 sys_epoll_wait(void);
+extern uint64 sys_pipe2(void);
+extern uint64 sys_fcntl(void);
+extern uint64 sys_tcpconnect(void);
+extern uint64 sys_listen(void);
+extern uint64 sys_accept(void);
+extern uint64 sys_pcapopen(void);
+extern uint64 sys_pcapwait(void);
+extern uint64 sys_pcapclose(void);
+extern uint64 sys_megapages(void);
+extern uint64 sys_uringsetup(void);
+extern uint64 sys_uringenter(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -131,6 +154,29 @@ static uint64 (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_connect] sys_connect,
 [SYS_ntas]    sys_ntas,
+[SYS_setsockopt] sys_setsockopt,
+[SYS_sockstat] sys_sockstat,
+[SYS_sendmmsg] sys_sendmmsg,
+[SYS_recvmmsg] sys_recvmmsg,
+[SYS_poll]    sys_poll,
+[SYS_epoll_create] sys_epoll_create,
+[SYS_epoll_ctl] sys_epoll_ctl,
+[SYS_epoll_wait] sys_epoll_wait,
+[SYS_pipe2]   sys_pipe2,
+[SYS_fcntl]   sys_fcntl,
+[SYS_tcpconnect] sys_tcpconnect,
+[SYS_listen]  sys_listen,
+[SYS_accept]  sys_accept,
+[SYS_pcapopen] sys_pcapopen,
+[SYS_pcapwait] sys_pcapwait,
+[SYS_pcapclose] sys_pcapclose,
+[SYS_megapages] sys_megapages,
+[SYS_uringsetup] sys_uringsetup,
+[SYS_uringenter] sys_uringenter,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
 };
 
 void
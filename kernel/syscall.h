@@ -24,3 +24,26 @@
 
 // System calls for labs
 #define SYS_ntas   23
+#define SYS_setsockopt 24
+#define SYS_sockstat 25
+#define SYS_sendmmsg 26
+#define SYS_recvmmsg 27
+#define SYS_poll   28
+#define SYS_epoll_create 29
+#define SYS_epoll_ctl 30
+#define SYS_epoll_wait 31
+#define SYS_pipe2  32
+#define SYS_fcntl  33
+#define SYS_tcpconnect 34
+#define SYS_listen 35
+#define SYS_accept 36
+#define SYS_pcapopen 37
+#define SYS_pcapwait 38
+#define SYS_pcapclose 39
+#define SYS_megapages 40
+#define SYS_uringsetup 41
+#define SYS_uringenter 42
+#define SYS_readv 43
+#define SYS_writev 44
+#define SYS_pread 45
+#define SYS_pwrite 46
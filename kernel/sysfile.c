@@ -15,6 +15,9 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "poll.h"
+#include "uring.h"
+#include "uio.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -26,7 +29,7 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((f = fdfile(fd)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -35,28 +38,25 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
-// Allocate a file descriptor for the given file.
-// Takes over file reference from caller on success.
 static int
-fdalloc(struct file *f)
+connect(uint32 raddr, uint32 lport, uint32 rport)
 {
+  struct file *f;
   int fd;
-  struct proc *p = myproc();
 
-  for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
-      return fd;
-    }
+  if(sockalloc(&f, raddr, lport, rport) < 0)
+    return -1;
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
   }
-  return -1;
+
+  return fd;
 }
 
 uint64
 sys_connect(void)
 {
-  struct file *f;
-  int fd;
   uint32 raddr;
   uint32 rport;
   uint32 lport;
@@ -66,8 +66,48 @@ sys_connect(void)
       argint(2, (int*)&rport) < 0) {
     return -1;
   }
+  return connect(raddr, lport, rport);
+}
 
-  if(sockalloc(&f, raddr, lport, rport) < 0)
+uint64
+sys_tcpconnect(void)
+{
+  struct file *f;
+  int fd, flags;
+  uint32 raddr;
+  uint32 rport;
+  uint32 lport;
+
+  if (argint(0, (int*)&raddr) < 0 ||
+      argint(1, (int*)&lport) < 0 ||
+      argint(2, (int*)&rport) < 0 ||
+      argint(3, &flags) < 0) {
+    return -1;
+  }
+  if(flags & ~O_NONBLOCK)
+    return -1;
+
+  if(socktcpconnect(&f, raddr, lport, rport, (flags & O_NONBLOCK) != 0) < 0)
+    return -1;
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+
+  return fd;
+}
+
+uint64
+sys_listen(void)
+{
+  struct file *f;
+  int fd, backlog;
+  uint32 lport;
+
+  if(argint(0, (int*)&lport) < 0 || argint(1, &backlog) < 0)
+    return -1;
+
+  if(socklisten(&f, lport, backlog) < 0)
     return -1;
   if((fd=fdalloc(f)) < 0){
     fileclose(f);
@@ -77,6 +117,164 @@ sys_connect(void)
   return fd;
 }
 
+uint64
+sys_accept(void)
+{
+  struct file *f, *nf;
+  int fd, r;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type != FD_SOCK)
+    return -1;
+
+  if((r = sockaccept(f->sock, &nf, f->nonblock)) < 0)
+    return r;
+  if((fd=fdalloc(nf)) < 0){
+    fileclose(nf);
+    return -1;
+  }
+
+  return fd;
+}
+
+uint64
+sys_setsockopt(void)
+{
+  struct file *f;
+  int opt, val;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &opt) < 0 || argint(2, &val) < 0)
+    return -1;
+  if(f->type != FD_SOCK)
+    return -1;
+  return socksetopt(f->sock, opt, val);
+}
+
+uint64
+sys_sockstat(void)
+{
+  struct file *f;
+  uint64 st; // user pointer to struct sockstat
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &st) < 0)
+    return -1;
+  if(f->type != FD_SOCK)
+    return -1;
+  return sockstat(f->sock, st);
+}
+
+uint64
+sys_sendmmsg(void)
+{
+  struct file *f;
+  int vlen;
+  uint64 vec; // user pointer to array of struct mmsg
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &vec) < 0 || argint(2, &vlen) < 0)
+    return -1;
+  if(f->type != FD_SOCK || f->writable == 0)
+    return -1;
+  return socksendmmsg(f->sock, vec, vlen);
+}
+
+uint64
+sys_recvmmsg(void)
+{
+  struct file *f;
+  int vlen;
+  uint64 vec; // user pointer to array of struct mmsg
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &vec) < 0 || argint(2, &vlen) < 0)
+    return -1;
+  if(f->type != FD_SOCK || f->readable == 0)
+    return -1;
+  return sockrecvmmsg(f->sock, vec, vlen, f->nonblock);
+}
+
+uint64
+sys_poll(void)
+{
+  uint64 fds; // user pointer to array of struct pollfd
+  int nfds, timeout;
+
+  if(argaddr(0, &fds) < 0 || argint(1, &nfds) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  return pollfds(fds, nfds, timeout);
+}
+
+uint64
+sys_epoll_create(void)
+{
+  struct file *f;
+  int fd;
+
+  if(epollalloc(&f) < 0)
+    return -1;
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+uint64
+sys_epoll_ctl(void)
+{
+  struct file *epf, *f;
+  int op, fd;
+  uint64 ev; // user pointer to struct epoll_event
+
+  if(argfd(0, 0, &epf) < 0 || argint(1, &op) < 0 ||
+     argint(2, &fd) < 0 || argaddr(3, &ev) < 0)
+    return -1;
+  if(epf->type != FD_EPOLL)
+    return -1;
+  // an fd that has since been closed can still be removed.
+  f = fdfile(fd);
+  if(f == 0 && op != EPOLL_CTL_DEL)
+    return -1;
+  return epollctl(epf->ep, op, fd, f, ev);
+}
+
+uint64
+sys_epoll_wait(void)
+{
+  struct file *f;
+  int maxevents, timeout;
+  uint64 evs; // user pointer to array of struct epoll_event
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &evs) < 0 ||
+     argint(2, &maxevents) < 0 || argint(3, &timeout) < 0)
+    return -1;
+  if(f->type != FD_EPOLL)
+    return -1;
+  return epollwait(f->ep, evs, maxevents, timeout);
+}
+
+uint64
+sys_pcapopen(void)
+{
+  uint64 filter; // user pointer to array of struct pcapinsn
+  int n;
+
+  if(argaddr(0, &filter) < 0 || argint(1, &n) < 0)
+    return -1;
+  return pcapopen(filter, n);
+}
+
+uint64
+sys_pcapwait(void)
+{
+  return pcapwait();
+}
+
+uint64
+sys_pcapclose(void)
+{
+  return pcapunmap(myproc()->pagetable);
+}
+
 uint64
 sys_dup(void)
 {
@@ -100,6 +298,9 @@ sys_read(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
     return -1;
+  // pipes, the console and sockets copy with spinlocks held.
+  if(n > 0)
+    uvmfaultin(p, n);
   return fileread(f, p, n);
 }
 
@@ -112,23 +313,121 @@ sys_write(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
     return -1;
+  if(n > 0)
+    uvmfaultin(p, n);
 
   return filewrite(f, p, n);
 }
 
-uint64
-sys_close(void)
+static int
+close(int fd)
 {
-  int fd;
   struct file *f;
 
-  if(argfd(0, &fd, &f) < 0)
+  if((f = fdfile(fd)) == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  fdclear(fd);
   fileclose(f);
   return 0;
 }
 
+// Fetch the nth and n+1th system call arguments as the user
+// address and number of the iovecs for readv() or writev(), and
+// copy them into iov, which has room for UIO_MAXIOV. Loads the
+// buffers they describe, like sys_read(). Returns the number.
+static int
+argiov(int n, struct iovec *iov)
+{
+  uint64 uiov;
+  int i, iovcnt;
+  uint total;
+
+  if(argaddr(n, &uiov) < 0 || argint(n+1, &iovcnt) < 0)
+    return -1;
+  if(iovcnt < 0 || iovcnt > UIO_MAXIOV)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, uiov, iovcnt*sizeof(iov[0])) < 0)
+    return -1;
+  for(total = 0, i = 0; i < iovcnt; i++){
+    // their sum must be an int, as read()'s count is.
+    if(iov[i].len < 0 || (total += iov[i].len) > 0x7fffffff)
+      return -1;
+    if(iov[i].len > 0)
+      uvmfaultin(iov[i].base, iov[i].len);
+  }
+  return iovcnt;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[UIO_MAXIOV];
+  int iovcnt;
+
+  if(argfd(0, 0, &f) < 0 || (iovcnt = argiov(1, iov)) < 0)
+    return -1;
+  return filereadv(f, iov, iovcnt, -1);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[UIO_MAXIOV];
+  int iovcnt;
+
+  if(argfd(0, 0, &f) < 0 || (iovcnt = argiov(1, iov)) < 0)
+    return -1;
+  return filewritev(f, iov, iovcnt, -1);
+}
+
+// read(), at offset off, leaving the file's offset alone.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int off;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &iov.base) < 0 ||
+     argint(2, &iov.len) < 0 || argint(3, &off) < 0)
+    return -1;
+  if(off < 0)
+    return -1;
+  if(iov.len > 0)
+    uvmfaultin(iov.base, iov.len);
+  return filereadv(f, &iov, 1, off);
+}
+
+// write(), at offset off, leaving the file's offset alone.
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int off;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &iov.base) < 0 ||
+     argint(2, &iov.len) < 0 || argint(3, &off) < 0)
+    return -1;
+  if(off < 0)
+    return -1;
+  if(iov.len > 0)
+    uvmfaultin(iov.base, iov.len);
+  return filewritev(f, &iov, 1, off);
+}
+
+uint64
+sys_close(void)
+{
+  int fd;
+
+  if(argint(0, &fd) < 0)
+    return -1;
+  return close(fd);
+}
+
 uint64
 sys_fstat(void)
 {
@@ -308,17 +607,12 @@ create(char *path, short type, short major, short minor)
   return ip;
 }
 
-uint64
-sys_open(void)
+static int
+open(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
-    return -1;
 
   begin_op(ROOTDEV);
 
@@ -366,6 +660,7 @@ sys_open(void)
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
 
   iunlock(ip);
   end_op(ROOTDEV);
@@ -373,6 +668,17 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
+    return -1;
+  return open(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -477,30 +783,30 @@ sys_exec(void)
   return -1;
 }
 
-uint64
-sys_pipe(void)
+static int
+pipe2(uint64 fdarray, int flags)
 {
-  uint64 fdarray; // user pointer to array of two integers
   struct file *rf, *wf;
   int fd0, fd1;
   struct proc *p = myproc();
 
-  if(argaddr(0, &fdarray) < 0)
+  if(flags & ~O_NONBLOCK)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
+  rf->nonblock = wf->nonblock = (flags & O_NONBLOCK) != 0;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdclear(fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdclear(fd0);
+    fdclear(fd1);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -508,3 +814,89 @@ sys_pipe(void)
   return 0;
 }
 
+uint64
+sys_pipe(void)
+{
+  uint64 fdarray; // user pointer to array of two integers
+
+  if(argaddr(0, &fdarray) < 0)
+    return -1;
+  return pipe2(fdarray, 0);
+}
+
+uint64
+sys_pipe2(void)
+{
+  uint64 fdarray; // user pointer to array of two integers
+  int flags;
+
+  if(argaddr(0, &fdarray) < 0 || argint(1, &flags) < 0)
+    return -1;
+  return pipe2(fdarray, flags);
+}
+
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  switch(cmd){
+  case F_GETFL:
+    return f->nonblock ? O_NONBLOCK : 0;
+  case F_SETFL:
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
+  }
+  return -1;
+}
+
+uint64
+sys_uringsetup(void)
+{
+  return uringsetup();
+}
+
+uint64
+sys_uringenter(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return uringenter(n);
+}
+
+// Carries out e, which uringenter() took from the submission
+// ring, as the system call it stands for would.
+int
+uringop(struct uringsqe *e)
+{
+  struct file *f;
+  char path[MAXPATH];
+
+  switch(e->op){
+  case URING_NOP:
+    return 0;
+  case URING_READ:
+  case URING_WRITE:
+    if((f = fdfile(e->fd)) == 0 || (int)e->len < 0)
+      return -1;
+    if(e->len > 0)
+      uvmfaultin(e->addr, e->len);
+    if(e->op == URING_READ)
+      return fileread(f, e->addr, e->len);
+    return filewrite(f, e->addr, e->len);
+  case URING_OPEN:
+    if(fetchstr(e->addr, path, MAXPATH) < 0)
+      return -1;
+    return open(path, e->len);
+  case URING_CLOSE:
+    return close(e->fd);
+  case URING_CONNECT:
+    return connect(e->addr, e->lport, e->rport);
+  }
+  return -1;
+}
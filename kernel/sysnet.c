@@ -13,16 +13,55 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "net.h"
+#include "socket.h"
+#include "poll.h"
+#include "errno.h"
+#include "netstat.h"
+#include "nettrace.h"
 
+// A UDP socket with a raddr or rport of 0 takes datagrams from
+// any remote address or port. Such wildcard sockets may share a
+// local port: a unicast datagram goes to the one socket that
+// matches it most closely, but a broadcast one goes to every
+// socket that matches, and a multicast one to every socket that
+// matches and has joined the group. They share one copy of it.
 struct sock {
   struct sock *next; // the next socket in the list
-  uint32 raddr;      // the remote IPv4 address
+  uint32 raddr;      // the remote IPv4 address; 0 for any
   uint16 lport;      // the local UDP port number
-  uint16 rport;      // the remote UDP port number
-  struct spinlock lock; // protects the rxq
+  uint16 rport;      // the remote UDP port number; 0 for any
+  uint32 groups[SOCK_MAXGROUPS]; // multicast groups joined,
+  int ngroups;                   // protected by the list's lock
+  struct spinlock lock; // protects everything below here
   struct mbufq rxq;  // a queue of packets waiting to be received
+  int rcvbuf;        // limit on rxqbytes (SO_RCVBUF)
+  int rxqlen;        // number of packets in rxq
+  int rxqbytes;      // bytes charged against rcvbuf by rxq
+  uint64 rxpkts;     // packets queued
+  uint64 rxbytes;    // payload bytes queued
+  uint64 rxdrops;    // packets dropped because rxq was full
+  uint64 rxdropbytes;// payload bytes dropped because rxq was full
+  struct wq wq;      // poll() and epoll waiters
+  struct tcb *tcb;   // TCP connection or listener; 0 for UDP
 };
 
+// each queued packet pins the pages holding its mbufs,
+// so that is what it is charged against rcvbuf.
+static int
+socktruesize(struct mbuf *m)
+{
+  int n;
+
+  for (n = 0; m; m = m->next)
+    n += PGSIZE;
+  return n;
+}
+
+// the headers net_rx_udp() pulled from the front of the
+// datagram m, which a clone shares.
+#define UDPHDR(m) ((struct udp *)((m)->head - sizeof(struct udp)))
+#define IPHDR(m)  ((struct ip *)((char *)UDPHDR(m) - sizeof(struct ip)))
+
 static struct spinlock lock;
 static struct sock *sockets;
 
@@ -45,11 +84,14 @@ sockalloc(struct file **f, uint32 raddr, uint16 lport, uint16 rport)
     goto bad;
 
   // initialize objects
+  memset(si, 0, sizeof(*si));
   si->raddr = raddr;
   si->lport = lport;
   si->rport = rport;
+  si->rcvbuf = SOCK_RCVBUF_DEFAULT;
   initlock(&si->lock, "sock");
   mbufq_init(&si->rxq);
+  wqinit(&si->wq, "sockwq");
   (*f)->type = FD_SOCK;
   (*f)->readable = 1;
   (*f)->writable = 1;
@@ -61,7 +103,8 @@ sockalloc(struct file **f, uint32 raddr, uint16 lport, uint16 rport)
   while (pos) {
     if (pos->raddr == raddr &&
         pos->lport == lport &&
-	pos->rport == rport) {
+	pos->rport == rport &&
+        raddr != 0 && rport != 0) {
       release(&lock);
       goto bad;
     }
@@ -80,96 +123,544 @@ bad:
   return -1;
 }
 
-//
-// Your code here.
-//
-// Add and wire in methods to handle closing, reading,
-// and writing for network sockets.
-//
+// Allocates a file for a TCP connection or listener. TCP
+// sockets stay off the UDP socket list.
+static int
+socktcpalloc(struct file **f, struct tcb *tcb)
+{
+  struct sock *si;
+
+  if ((*f = filealloc()) == 0)
+    return -1;
+  if ((si = (struct sock*)kalloc()) == 0) {
+    fileclose(*f);
+    return -1;
+  }
+  memset(si, 0, sizeof(*si));
+  si->tcb = tcb;
+  (*f)->type = FD_SOCK;
+  (*f)->readable = 1;
+  (*f)->writable = 1;
+  (*f)->sock = si;
+  return 0;
+}
+
+// Opens a TCP connection and a file for it. Unless nonblock
+// is set, waits until the connection is established.
+int
+socktcpconnect(struct file **f, uint32 raddr, uint16 lport, uint16 rport,
+               int nonblock)
+{
+  struct tcb *tcb;
+
+  tcb = 0;
+  if (tcpconnect(&tcb, raddr, lport, rport, nonblock) < 0) {
+    if (tcb)
+      tcpclose(tcb);
+    return -1;
+  }
+  if (socktcpalloc(f, tcb) < 0) {
+    tcpclose(tcb);
+    return -1;
+  }
+  (*f)->nonblock = nonblock;
+  return 0;
+}
+
+// Listens for TCP connections to lport.
+int
+socklisten(struct file **f, uint16 lport, int backlog)
+{
+  struct tcb *tcb;
+
+  if (tcplisten(&tcb, lport, backlog) < 0)
+    return -1;
+  if (socktcpalloc(f, tcb) < 0) {
+    tcpclose(tcb);
+    return -1;
+  }
+  return 0;
+}
+
+// Takes the next connection from listening socket si. Returns
+// -EAGAIN if nonblock is set and there is none yet.
+int
+sockaccept(struct sock *si, struct file **f, int nonblock)
+{
+  struct tcb *tcb;
+  int r;
+
+  if (si->tcb == 0)
+    return -1;
+  if ((r = tcpaccept(si->tcb, &tcb, nonblock)) < 0)
+    return r;
+  if (socktcpalloc(f, tcb) < 0) {
+    tcpclose(tcb);
+    return -1;
+  }
+  return 0;
+}
+
+// Unlinks si from the socket list and frees it, along with
+// any packets that were never read.
+void
+sockclose(struct sock *si)
+{
+  struct sock **pos;
+  struct mbuf *m;
+
+  if (si->tcb) {
+    tcpclose(si->tcb);
+    kfree((char*)si);
+    return;
+  }
 
-static void sockfree(struct sock* si) {
-  struct sock** pos = &sockets;
   acquire(&lock);
-  while (*pos != si) {
+  pos = &sockets;
+  while (*pos != si)
     pos = &(*pos)->next;
-  }
   *pos = si->next;
+  // wait out a sockrecvudp() that found si before it was
+  // unlinked; it locks si before letting go of the table.
+  acquire(&si->lock);
+  release(&si->lock);
   release(&lock);
+
+  while (si->ngroups > 0)
+    net_leavegroup(si->groups[--si->ngroups]);
+  // sockrecvudp() can no longer find si, so rxq is ours.
+  while ((m = mbufq_pophead(&si->rxq)) != 0)
+    mbuffree(m);
+  kfree((char*)si);
 }
 
-static struct sock* sockfind(uint32 raddr, uint16 lport, uint16 rport) {
-  struct sock* pos = sockets;
-  acquire(&lock);
-  while (pos) {
-    if (pos->raddr == raddr && pos->lport == lport && pos->rport == rport) {
-      release(&lock);
-      return pos;
-    }
-    pos = pos->next;
+// datagrams at least this long are sent straight from the
+// sender's pages instead of being copied into the mbuf.
+#define SOCK_ZEROCOPY_MIN 1024
+
+// Appends n bytes at user address addr to the chain m as
+// zero-copy fragments, one per page, counting them in *extdone.
+static int
+sockfrags(struct mbuf *m, uint64 addr, int n, int *extdone)
+{
+  struct proc *pr = myproc();
+  struct mbuf *frag;
+  uint64 va0, pa0;
+  int c;
+
+  uvmfaultin(addr, n);
+  while (m->next)
+    m = m->next;
+  for (; n > 0; n -= c, addr += c) {
+    va0 = PGROUNDDOWN(addr);
+    if ((pa0 = walkaddr(pr->pagetable, va0)) == 0)
+      return -1;
+    if ((frag = mbufalloc(0)) == 0)
+      return -1;
+    c = PGSIZE - (addr - va0);
+    if (c > n)
+      c = n;
+    // the kernel maps physical memory at the same address.
+    frag->head = (char *)(pa0 + (addr - va0));
+    frag->len = c;
+    frag->extdone = extdone;
+    (*extdone)++;
+    m->next = frag;
+    m = frag;
   }
-  release(&lock);
   return 0;
 }
 
-void sockclose(struct sock* si) {
-  sockfree(si);
-  kfree((char*)si);
-}
+// Sends one datagram of (at most) n bytes from user address addr
+// to raddr and rport. Large datagrams go out from the user's pages
+// without a copy, and socksend() waits until the e1000 has sent
+// them; those larger than the MTU are sent in fragments.
+static int
+socksend(struct sock *si, uint64 addr, int n, uint32 raddr, uint16 rport)
+{
+  unsigned int headroom = sizeof(struct eth) + sizeof(struct ip) +
+                          sizeof(struct udp);
+  struct proc *pr = myproc();
+  struct mbuf *m;
+  int extdone;
 
-int sockwrite(struct sock* si, uint64 addr, int n) {
-  unsigned int headroom_len = sizeof(struct eth) + sizeof(struct ip) +
-                              sizeof(struct udp);
-  struct mbuf* mbuf = mbufalloc(headroom_len);
-  struct proc* p = myproc();
-  acquire(&si->lock);
-  if (n > MBUF_SIZE-headroom_len)
-    n = MBUF_SIZE-headroom_len;
-  if (copyin(p->pagetable, mbuf->head, addr, n) == -1)
+  if (n < 0 || raddr == 0 || rport == 0)
     return -1;
-  mbufput(mbuf, n);
-  net_tx_udp(mbuf, si->raddr, si->lport, si->rport);
-  release(&si->lock);
+  if (n > IP_MAXPACKET - sizeof(struct ip) - sizeof(struct udp))
+    n = IP_MAXPACKET - sizeof(struct ip) - sizeof(struct udp);
+  if ((m = mbufalloc(headroom)) == 0)
+    return -1;
+  if (n >= SOCK_ZEROCOPY_MIN) {
+    extdone = 0;
+    if (sockfrags(m, addr, n, &extdone) < 0) {
+      mbuffree(m);
+      return -1;
+    }
+    net_tx_udp(m, raddr, si->lport, rport);
+    mbufwait(&extdone);
+    return n;
+  }
+  if (copyin(pr->pagetable, mbufput(m, n), addr, n) == -1) {
+    mbuffree(m);
+    return -1;
+  }
+  net_tx_udp(m, raddr, si->lport, rport);
   return n;
 }
 
-int sockread(struct sock* si, uint64 addr, int n) {
-  struct proc* p = myproc();
+// Waits until si has a packet, then dequeues up to max packets
+// onto q. Returns the number dequeued, -1 if killed, or -EAGAIN
+// if nonblock is set and there is nothing to dequeue.
+static int
+sockdequeue(struct sock *si, struct mbufq *q, int max, int nonblock)
+{
+  struct proc *pr = myproc();
+  struct mbuf *m;
+  int i;
+
   acquire(&si->lock);
   while (mbufq_empty(&si->rxq)) {
-    if(p->killed) {
+    if (pr->killed) {
       release(&si->lock);
       return -1;
     }
+    if (nonblock) {
+      release(&si->lock);
+      return -EAGAIN;
+    }
     sleep(&si->rxq, &si->lock);
   }
-  struct mbuf* mbuf = mbufq_pophead(&si->rxq);
-  if (n > mbuf->len)
-    n = mbuf->len;
+  for (i = 0; i < max && (m = mbufq_pophead(&si->rxq)) != 0; i++) {
+    si->rxqlen--;
+    si->rxqbytes -= socktruesize(m);
+    mbufq_pushtail(q, m);
+  }
+  release(&si->lock);
+  return i;
+}
+
+// Copies (at most) n bytes of the payload held by the chain m
+// to user address addr and frees m.
+static int
+sockdeliver(struct mbuf *m, uint64 addr, int n)
+{
+  struct proc *pr = myproc();
+  struct mbuf *seg;
+  int c, tot;
 
-  if (copyout(p->pagetable, addr, mbuf->head, n) == -1)
+  if (n < 0) {
+    mbuffree(m);
     return -1;
+  }
+  for (tot = 0, seg = m; seg && tot < n; seg = seg->next) {
+    c = n - tot < seg->len ? n - tot : seg->len;
+    if (copyout(pr->pagetable, addr + tot, seg->head, c) == -1) {
+      tot = -1;
+      break;
+    }
+    tot += c;
+  }
+  if (tot >= 0)
+    nettracedone(m);
+  mbuffree(m);
+  return tot;
+}
+
+int
+sockwrite(struct sock *si, uint64 addr, int n, int nonblock)
+{
+  if (si->tcb)
+    return tcpwrite(si->tcb, addr, n, nonblock);
+  return socksend(si, addr, n, si->raddr, si->rport);
+}
+
+int
+sockread(struct sock *si, uint64 addr, int n, int nonblock)
+{
+  struct mbufq q;
+  int r;
+
+  if (si->tcb)
+    return tcpread(si->tcb, addr, n, nonblock);
+  mbufq_init(&q);
+  if ((r = sockdequeue(si, &q, 1, nonblock)) < 0)
+    return r;
+  return sockdeliver(mbufq_pophead(&q), addr, n);
+}
+
+// Sends up to vlen datagrams described by the struct mmsg array
+// at user address addr, recording each one's length in its n.
+// A wildcard socket sends each to its addr and port. Returns
+// the number sent, or -1 if none could be.
+int
+socksendmmsg(struct sock *si, uint64 addr, int vlen)
+{
+  struct proc *pr = myproc();
+  struct mmsg mm;
+  int i;
+
+  if (si->tcb)
+    return -1;
+  for (i = 0; i < vlen; i++, addr += sizeof(mm)) {
+    if (copyin(pr->pagetable, (char *)&mm, addr, sizeof(mm)) < 0)
+      break;
+    if (si->raddr == 0 || si->rport == 0)
+      mm.n = socksend(si, mm.buf, mm.len, mm.addr, mm.port);
+    else
+      mm.n = socksend(si, mm.buf, mm.len, si->raddr, si->rport);
+    if (mm.n < 0)
+      break;
+    if (copyout(pr->pagetable, addr, (char *)&mm, sizeof(mm)) < 0)
+      break;
+  }
+  return i > 0 ? i : -1;
+}
+
+// Waits for at least one datagram, then receives as many as are
+// queued, up to vlen, into the struct mmsg array at user address
+// addr, along with their senders. Returns the number received,
+// or -1 if none could be (-EAGAIN if nonblock is set and none
+// were queued).
+int
+sockrecvmmsg(struct sock *si, uint64 addr, int vlen, int nonblock)
+{
+  struct proc *pr = myproc();
+  struct mbufq q;
+  struct mbuf *m;
+  struct mmsg mm;
+  int i;
+
+  if (vlen <= 0 || si->tcb)
+    return -1;
+  mbufq_init(&q);
+  if ((i = sockdequeue(si, &q, vlen, nonblock)) < 0)
+    return i;
+
+  for (i = 0; (m = mbufq_pophead(&q)) != 0; i++, addr += sizeof(mm)) {
+    if (copyin(pr->pagetable, (char *)&mm, addr, sizeof(mm)) < 0) {
+      mbuffree(m);
+      break;
+    }
+    mm.addr = ntohl(IPHDR(m)->ip_src);
+    mm.port = ntohs(UDPHDR(m)->sport);
+    if ((mm.n = sockdeliver(m, mm.buf, mm.len)) < 0 ||
+        copyout(pr->pagetable, addr, (char *)&mm, sizeof(mm)) < 0)
+      break;
+  }
+  // a bad user address loses the rest of the batch,
+  // as if the packets had been dropped.
+  while ((m = mbufq_pophead(&q)) != 0)
+    mbuffree(m);
+  return i > 0 ? i : -1;
+}
+
+// Report whether si is ready, first adding e to
+// si's wait queue if e is non-zero. Sending never blocks.
+int
+sockpoll(struct sock *si, struct wqent *e)
+{
+  int mask = POLLOUT;
 
-  mbuffree(mbuf);
+  if (si->tcb)
+    return tcppoll(si->tcb, e);
+  if (e)
+    wqadd(&si->wq, e);
+  acquire(&si->lock);
+  if (!mbufq_empty(&si->rxq))
+    mask |= POLLIN;
   release(&si->lock);
-  return n;
+  return mask;
 }
 
-// called by protocol handler layer to deliver UDP packets
-void
-sockrecvudp(struct mbuf *m, uint32 raddr, uint16 lport, uint16 rport)
-{
-  //
-  // Your code here.
-  //
-  // Find the socket that handles this mbuf and deliver it, waking
-  // any sleeping reader. Free the mbuf if there are no sockets
-  // registered to handle it.
-  //
-  struct sock* si = sockfind(raddr, lport, rport);
-  if (si) {
-    mbufq_pushtail(&si->rxq, m);
-    wakeup(&si->rxq);
+// Sets a socket option.
+int
+socksetopt(struct sock *si, int opt, int val)
+{
+  int i;
+
+  if (si->tcb)
+    return -1;
+  switch (opt) {
+  case SO_JOINGROUP:
+    if (net_joingroup(val) < 0)
+      return -1;
+    acquire(&lock);
+    for (i = 0; i < si->ngroups; i++) {
+      if (si->groups[i] == val)
+        break;
+    }
+    if (i < si->ngroups || si->ngroups == SOCK_MAXGROUPS) {
+      release(&lock);
+      net_leavegroup(val);
+      return -1;
+    }
+    si->groups[si->ngroups++] = val;
+    release(&lock);
+    return 0;
+  case SO_LEAVEGROUP:
+    acquire(&lock);
+    for (i = 0; i < si->ngroups; i++) {
+      if (si->groups[i] == val)
+        break;
+    }
+    if (i == si->ngroups) {
+      release(&lock);
+      return -1;
+    }
+    si->groups[i] = si->groups[--si->ngroups];
+    release(&lock);
+    net_leavegroup(val);
+    return 0;
+  case SO_RCVBUF:
+    if (val < SOCK_RCVBUF_MIN)
+      val = SOCK_RCVBUF_MIN;
+    if (val > SOCK_RCVBUF_MAX)
+      val = SOCK_RCVBUF_MAX;
+    // packets already queued stay; new ones are dropped
+    // until the queue drains below the new limit.
+    acquire(&si->lock);
+    si->rcvbuf = val;
+    release(&si->lock);
+    return 0;
+  }
+  return -1;
+}
+
+// Get the state and counters of socket si.
+// addr is a user virtual address, pointing to a struct sockstat.
+int
+sockstat(struct sock *si, uint64 addr)
+{
+  struct proc *pr = myproc();
+  struct sockstat st;
+
+  if (si->tcb)
+    return -1;
+  acquire(&si->lock);
+  st.raddr = si->raddr;
+  st.lport = si->lport;
+  st.rport = si->rport;
+  st.rcvbuf = si->rcvbuf;
+  st.rxqlen = si->rxqlen;
+  st.rxqbytes = si->rxqbytes;
+  st.rxpkts = si->rxpkts;
+  st.rxbytes = si->rxbytes;
+  st.rxdrops = si->rxdrops;
+  st.rxdropbytes = si->rxdropbytes;
+  release(&si->lock);
+
+  if (copyout(pr->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// How closely si matches a datagram from raddr and rport to
+// lport: -1 if not at all, and more for each field that isn't
+// a wildcard. Caller holds lock.
+static int
+sockmatch(struct sock *si, uint32 raddr, uint16 lport, uint16 rport)
+{
+  if (si->lport != lport ||
+      (si->raddr != 0 && si->raddr != raddr) ||
+      (si->rport != 0 && si->rport != rport))
+    return -1;
+  return (si->raddr != 0) + (si->rport != 0);
+}
+
+// Has si joined multicast group addr? Caller holds lock.
+static int
+sockingroup(struct sock *si, uint32 addr)
+{
+  int i;
+
+  for (i = 0; i < si->ngroups; i++) {
+    if (si->groups[i] == addr)
+      return 1;
+  }
+  return 0;
+}
+
+// Queues the datagram m on si, or drops it if si's receive
+// buffer is full.
+static void
+sockqueue(struct sock *si, struct mbuf *m)
+{
+  acquire(&si->lock);
+  if (si->rxqbytes + socktruesize(m) > si->rcvbuf) {
+    NETSTAT_INC(udpfullsock);
+    si->rxdrops++;
+    si->rxdropbytes += mbufchainlen(m);
+    release(&si->lock);
+    mbuffree(m);
     return;
   }
-  mbuffree(m);
+  NTRACE_STAMP(m, NTRACE_SOCK);
+  mbufq_pushtail(&si->rxq, m);
+  si->rxqlen++;
+  si->rxqbytes += socktruesize(m);
+  si->rxpkts++;
+  si->rxbytes += mbufchainlen(m);
+  wakeup(&si->rxq);
+  wqwakeup(&si->wq);
+  release(&si->lock);
+}
+
+// called by protocol handler layer to deliver UDP packets.
+// group is 0 for a datagram sent to us alone, 0xffffffff for
+// a broadcast one, and the group a multicast one was sent to.
+void
+sockrecvudp(struct mbuf *m, uint32 raddr, uint16 lport, uint16 rport,
+            uint32 group)
+{
+  struct sock *si, *best, *prev;
+  struct mbuf *c;
+  int match, bestmatch;
+
+  // hold the table lock while queueing, so that
+  // sockclose() can't free a socket underneath us.
+  acquire(&lock);
+  if (group == 0) {
+    best = 0;
+    bestmatch = -1;
+    for (si = sockets; si; si = si->next) {
+      if ((match = sockmatch(si, raddr, lport, rport)) > bestmatch) {
+        best = si;
+        bestmatch = match;
+      }
+    }
+    if (best) {
+      sockqueue(best, m);
+      m = 0;
+    }
+  } else {
+    // every subscriber but the last gets a clone.
+    prev = 0;
+    for (si = sockets; si; si = si->next) {
+      if (sockmatch(si, raddr, lport, rport) < 0 ||
+          (group != 0xffffffff && !sockingroup(si, group)))
+        continue;
+      if (prev) {
+        if ((c = mbufclone(m)) != 0) {
+          sockqueue(prev, c);
+        } else {
+          NETSTAT_INC(udpfullsock);
+          acquire(&prev->lock);
+          prev->rxdrops++;
+          prev->rxdropbytes += mbufchainlen(m);
+          release(&prev->lock);
+        }
+      }
+      prev = si;
+    }
+    if (prev) {
+      sockqueue(prev, m);
+      m = 0;
+    }
+  }
+  release(&lock);
+
+  if (m) {
+    mbuffree(m);
+    NETSTAT_INC(udpnoport);
+  }
 }
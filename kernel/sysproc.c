@@ -52,6 +52,21 @@ sys_sbrk(void)
   return addr;
 }
 
+// Makes sbrk() use 2MB megapages for the aligned megapages it
+// adds, if on, while there are free ones. Returns the old setting.
+uint64
+sys_megapages(void)
+{
+  struct proc *p = myproc();
+  int on, old;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  old = p->megapages;
+  p->megapages = on != 0;
+  return old;
+}
+
 uint64
 sys_sleep(void)
 {
@@ -0,0 +1,1159 @@
+//
+// TCP: connection state machine, sliding windows,
+// retransmission and Reno congestion control.
+//
+// Each connection is a struct tcb. A single lock protects
+// every tcb and the list of them; connections are few, and
+// one lock keeps listeners and their unaccepted connections
+// simple. Segments are acknowledged as soon as they arrive,
+// and out-of-order segments are dropped (the duplicate ACKs
+// they cause drive the sender's fast retransmit).
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "net.h"
+#include "netstat.h"
+#include "poll.h"
+#include "errno.h"
+#include "socket.h"
+
+// timer values are in clock ticks, about 1/10th second each.
+#define TCP_RTO_INIT   10    // before the first RTT sample
+#define TCP_RTO_MIN    2
+#define TCP_RTO_MAX    600
+#define TCP_MAXRXT     12    // retransmissions before giving up
+#define TCP_2MSL       20    // TIME_WAIT; much shorter than the RFC's
+#define TCP_FIN2_WAIT  600   // FIN_WAIT_2 after close()
+
+#define TCP_MSS        1460  // Ethernet MTU less IP and TCP headers
+#define TCP_MSS_DEFAULT 536  // if the peer does not say
+#define TCP_MAXBACKLOG 16
+#define TCP_PORT_FIRST 49152 // ephemeral ports
+
+// send and receive buffers are rings over separately allocated pages.
+#define TCP_BUFSIZE    SOCK_TCPBUF
+#define TCP_BUFPAGES   (TCP_BUFSIZE/PGSIZE)
+
+// sequence number comparisons, modulo 2^32.
+#define SEQ_LT(a, b)   ((int)((a) - (b)) < 0)
+#define SEQ_LEQ(a, b)  ((int)((a) - (b)) <= 0)
+#define SEQ_GT(a, b)   ((int)((a) - (b)) > 0)
+#define SEQ_GEQ(a, b)  ((int)((a) - (b)) >= 0)
+
+enum tcpstate { CLOSED, LISTEN, SYN_SENT, SYN_RCVD, ESTABLISHED, CLOSE_WAIT,
+                FIN_WAIT_1, FIN_WAIT_2, CLOSING, LAST_ACK, TIME_WAIT };
+
+struct tcpbuf {
+  char *pg[TCP_BUFPAGES];
+  uint off;            // ring offset of the first byte
+  uint len;            // number of bytes held
+};
+
+struct tcb {
+  struct tcb *next;    // in the list of connections
+  uint32 raddr;        // remote IPv4 address
+  uint16 lport;        // local port
+  uint16 rport;        // remote port
+  enum tcpstate state;
+  int detached;        // no file refers to this tcb; free once CLOSED
+  int err;             // reset or timed out
+  struct tcb *parent;  // listener, until accept()
+  int nchild;          // LISTEN: connections not yet accepted
+  int backlog;         // LISTEN: limit on nchild
+
+  // send side. snd holds the bytes from snd_una on.
+  uint32 iss;          // initial send sequence number
+  uint32 snd_una;      // oldest unacknowledged
+  uint32 snd_nxt;      // next to send
+  uint32 snd_max;      // highest sent, plus one
+  uint32 snd_wnd;      // peer's receive window
+  uint32 snd_wl1;      // seq of the segment that last updated snd_wnd
+  uint32 snd_wl2;      // ack of the segment that last updated snd_wnd
+  int sndfin;          // close() queued a FIN after snd
+  int finacked;        // the peer has acknowledged our FIN
+  struct tcpbuf snd;
+  uint mss;            // largest segment the peer accepts
+
+  // receive side. rcv holds bytes not yet read.
+  uint32 irs;          // initial receive sequence number
+  uint32 rcv_nxt;      // next expected
+  uint32 rcv_adv;      // right edge of the last advertised window
+  int rcvfin;          // the peer has sent a FIN
+  struct tcpbuf rcv;
+
+  // congestion control
+  uint cwnd;
+  uint ssthresh;
+  int dupacks;
+
+  // round-trip time and retransmission
+  int srtt;            // smoothed RTT, in ticks << 3
+  int rttvar;          // RTT variance, in ticks << 2
+  int rto;             // retransmission timeout
+  int rtt_timing;      // timing the segment at rtt_seq
+  uint32 rtt_seq;
+  uint rtt_start;
+  uint rexmt;          // tick at which the timer fires, or 0
+  int nrexmt;          // consecutive timeouts
+  int force;           // send at least one byte (zero-window probe)
+
+  struct wq wq;        // poll() and epoll waiters
+};
+
+static struct spinlock tcplock;
+static struct tcb *tcbs;
+static uint32 nextiss;
+static uint16 nextport = TCP_PORT_FIRST;
+
+void
+tcpinit(void)
+{
+  initlock(&tcplock, "tcp");
+}
+
+// Sleeps on chan, holding tcplock. What chan waits for may be
+// a segment that we sent ourselves, still on the loopback
+// interface, so deliver those instead if there are any. Either
+// way the caller must check again what it waits for.
+static void
+tcpsleep(void *chan)
+{
+  if (net_looppending()) {
+    release(&tcplock);
+    net_loopback();
+    acquire(&tcplock);
+    return;
+  }
+  sleep(chan, &tcplock);
+}
+
+static int
+tbufalloc(struct tcpbuf *b)
+{
+  int i;
+
+  for (i = 0; i < TCP_BUFPAGES; i++) {
+    if ((b->pg[i] = kalloc()) == 0)
+      return -1;
+  }
+  b->off = b->len = 0;
+  return 0;
+}
+
+static void
+tbuffree(struct tcpbuf *b)
+{
+  int i;
+
+  for (i = 0; i < TCP_BUFPAGES; i++) {
+    if (b->pg[i])
+      kfree(b->pg[i]);
+  }
+}
+
+// Copies n bytes between addr and the ring, starting off bytes
+// after its first byte: into the ring if tobuf is set, out of it
+// otherwise. user says whether addr is a user virtual address.
+// The caller adjusts b->len.
+static int
+tbufcopy(struct tcpbuf *b, uint off, int tobuf, int user, uint64 addr, uint n)
+{
+  uint i, p, c;
+  char *kaddr;
+  int r;
+
+  for (i = 0; i < n; i += c) {
+    p = (b->off + off + i) % TCP_BUFSIZE;
+    c = PGSIZE - p % PGSIZE;
+    if (c > n - i)
+      c = n - i;
+    kaddr = b->pg[p / PGSIZE] + p % PGSIZE;
+    if (tobuf)
+      r = either_copyin(kaddr, user, addr + i, c);
+    else
+      r = either_copyout(user, addr + i, kaddr, c);
+    if (r < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Discards the first n bytes of the ring.
+static void
+tbufdrop(struct tcpbuf *b, uint n)
+{
+  b->off = (b->off + n) % TCP_BUFSIZE;
+  b->len -= n;
+}
+
+static struct tcb *
+tcballoc(void)
+{
+  struct tcb *t;
+
+  if ((t = (struct tcb*)kalloc()) == 0)
+    return 0;
+  memset(t, 0, sizeof(*t));
+  if (tbufalloc(&t->snd) < 0 || tbufalloc(&t->rcv) < 0) {
+    tbuffree(&t->snd);
+    tbuffree(&t->rcv);
+    kfree((char*)t);
+    return 0;
+  }
+  t->mss = TCP_MSS_DEFAULT;
+  t->rto = TCP_RTO_INIT;
+  t->ssthresh = 65535;
+  wqinit(&t->wq, "tcpwq");
+  return t;
+}
+
+// Picks an initial sequence number for a new connection.
+static void
+tcp_initseq(struct tcb *t)
+{
+  nextiss += 64000;
+  t->iss = (ticks << 12) + nextiss;
+  t->snd_una = t->snd_nxt = t->snd_max = t->iss;
+}
+
+// Records the peer's MSS and sizes the initial
+// congestion window from it (RFC 3390).
+static void
+tcp_setmss(struct tcb *t, uint mss)
+{
+  if (mss < 64)
+    mss = TCP_MSS_DEFAULT;
+  t->mss = mss < TCP_MSS ? mss : TCP_MSS;
+  if (4*t->mss < 4380)
+    t->cwnd = 4*t->mss;
+  else
+    t->cwnd = 2*t->mss > 4380 ? 2*t->mss : 4380;
+}
+
+static int
+tcp_portused(uint16 lport)
+{
+  struct tcb *t;
+
+  for (t = tcbs; t; t = t->next) {
+    if (t->state != CLOSED && t->lport == lport)
+      return 1;
+  }
+  return 0;
+}
+
+// Wakes everyone waiting on t: readers, writers,
+// connect(), accept(), and poll().
+static void
+tcpwake(struct tcb *t)
+{
+  wakeup(t);
+  wqwakeup(&t->wq);
+}
+
+static uint
+tcp_parsemss(uint8 *opt, int len)
+{
+  int i;
+
+  for (i = 0; i < len && opt[i] != TCPOPT_EOL; ) {
+    if (opt[i] == TCPOPT_NOP) {
+      i++;
+      continue;
+    }
+    if (i + 1 >= len || opt[i+1] < 2 || i + opt[i+1] > len)
+      break;
+    if (opt[i] == TCPOPT_MSS && opt[i+1] == 4)
+      return (opt[i+2] << 8) | opt[i+3];
+    i += opt[i+1];
+  }
+  return TCP_MSS_DEFAULT;
+}
+
+// Fills in a TCP header at the start of m, leaving the checksum
+// to net_tx_tcp().
+static struct tcp *
+tcp_hdr(struct mbuf *m, uint16 lport, uint16 rport, uint32 seq, uint32 ack,
+        int flags, uint16 win)
+{
+  struct tcp *tcphdr;
+
+  tcphdr = mbufputhdr(m, *tcphdr);
+  tcphdr->sport = htons(lport);
+  tcphdr->dport = htons(rport);
+  tcphdr->seq = htonl(seq);
+  tcphdr->ack = htonl(ack);
+  tcphdr->off = (sizeof(*tcphdr) / 4) << 4;
+  tcphdr->flags = flags;
+  tcphdr->win = htons(win);
+  tcphdr->sum = 0;
+  tcphdr->urp = 0;
+  return tcphdr;
+}
+
+// Sends a segment of t starting at sequence number seq, carrying
+// len bytes that start off bytes into t->snd.
+static int
+tcp_send(struct tcb *t, uint32 seq, int flags, uint off, uint len)
+{
+  struct tcp *tcphdr;
+  struct mbuf *m;
+  uint8 *opt;
+  uint win;
+
+  if ((m = mbufalloc(MBUF_DEFAULT_HEADROOM)) == 0)
+    return -1;
+  win = TCP_BUFSIZE - t->rcv.len;
+  t->rcv_adv = t->rcv_nxt + win;
+  tcphdr = tcp_hdr(m, t->lport, t->rport, seq,
+                   (flags & TCP_ACK) ? t->rcv_nxt : 0, flags, win);
+  if (flags & TCP_SYN) {
+    opt = (uint8*)mbufput(m, 4);
+    opt[0] = TCPOPT_MSS;
+    opt[1] = 4;
+    opt[2] = TCP_MSS >> 8;
+    opt[3] = TCP_MSS & 0xff;
+    tcphdr->off = ((sizeof(*tcphdr) + 4) / 4) << 4;
+  }
+  if (len > 0)
+    tbufcopy(&t->snd, off, 0, 0, (uint64)mbufput(m, len), len);
+  net_tx_tcp(m, t->raddr);
+  return 0;
+}
+
+// Sends a pure ACK.
+static void
+tcp_ack(struct tcb *t)
+{
+  tcp_send(t, t->snd_nxt, TCP_ACK, 0, 0);
+}
+
+// Answers a segment that belongs to no connection with a reset.
+static void
+tcp_respond(uint32 raddr, uint16 lport, uint16 rport, uint32 seq,
+            uint32 ack, int flags)
+{
+  struct mbuf *m;
+
+  if ((m = mbufalloc(MBUF_DEFAULT_HEADROOM)) == 0)
+    return;
+  tcp_hdr(m, lport, rport, seq, ack, flags, 0);
+  net_tx_tcp(m, raddr);
+}
+
+// Sends what the windows allow: a SYN, new or retransmitted
+// data from snd_nxt on, and a FIN once snd has all been sent.
+// Returns the number of segments sent.
+static int
+tcp_output(struct tcb *t)
+{
+  uint off, len, win;
+  int flags, sent;
+
+  if (t->state == SYN_SENT || t->state == SYN_RCVD) {
+    if (t->snd_nxt != t->iss)
+      return 0;
+    flags = TCP_SYN | (t->state == SYN_RCVD ? TCP_ACK : 0);
+    if (tcp_send(t, t->iss, flags, 0, 0) < 0)
+      return 0;
+    if (!t->rtt_timing && t->snd_max == t->iss) {
+      t->rtt_timing = 1;
+      t->rtt_seq = t->iss;
+      t->rtt_start = ticks;
+    }
+    t->snd_nxt = t->snd_max = t->iss + 1;
+    if (t->rexmt == 0)
+      t->rexmt = ticks + t->rto;
+    return 1;
+  }
+  if (t->state != ESTABLISHED && t->state != CLOSE_WAIT &&
+      t->state != FIN_WAIT_1 && t->state != CLOSING && t->state != LAST_ACK)
+    return 0;
+
+  win = t->snd_wnd < t->cwnd ? t->snd_wnd : t->cwnd;
+  if (t->force && win == 0)
+    win = 1;
+  for (sent = 0; ; sent++) {
+    off = t->snd_nxt - t->snd_una;
+    if (off > t->snd.len)
+      break;  // the FIN has been sent
+    len = t->snd.len - off;
+    if (len > t->mss)
+      len = t->mss;
+    if (off + len > win)
+      len = win > off ? win - off : 0;
+    flags = TCP_ACK;
+    if (t->sndfin && off + len == t->snd.len)
+      flags |= TCP_FIN;
+    if (len == 0 && !(flags & TCP_FIN))
+      break;
+    if (len > 0 && off + len == t->snd.len)
+      flags |= TCP_PSH;
+    if (tcp_send(t, t->snd_nxt, flags, off, len) < 0)
+      break;
+    if (!t->rtt_timing && SEQ_GEQ(t->snd_nxt, t->snd_max)) {
+      t->rtt_timing = 1;
+      t->rtt_seq = t->snd_nxt;
+      t->rtt_start = ticks;
+    }
+    t->snd_nxt += len + ((flags & TCP_FIN) ? 1 : 0);
+    if (SEQ_GT(t->snd_nxt, t->snd_max))
+      t->snd_max = t->snd_nxt;
+    if (t->rexmt == 0)
+      t->rexmt = ticks + t->rto;
+    if (flags & TCP_FIN)
+      break;
+  }
+  // data is waiting behind a closed window: arm the
+  // timer, which then probes the window.
+  if (t->rexmt == 0 && t->snd.len > 0 && t->snd_una == t->snd_max)
+    t->rexmt = ticks + t->rto;
+  return sent;
+}
+
+// Moves t to CLOSED after a reset or a timeout, first
+// sending the peer a reset if rst is set.
+static void
+tcp_drop(struct tcb *t, int rst)
+{
+  if (rst)
+    tcp_send(t, t->snd_nxt, TCP_RST | TCP_ACK, 0, 0);
+  t->state = CLOSED;
+  t->err = 1;
+  t->rexmt = 0;
+  tcpwake(t);
+}
+
+// Updates the RTO estimate from a round-trip sample (RFC 6298).
+static void
+tcp_rttsample(struct tcb *t, int rtt)
+{
+  int delta;
+
+  if (t->srtt == 0) {
+    t->srtt = rtt << 3;
+    t->rttvar = rtt << 1;
+  } else {
+    delta = rtt - (t->srtt >> 3);
+    t->srtt += delta;
+    if (delta < 0)
+      delta = -delta;
+    t->rttvar += delta - (t->rttvar >> 2);
+  }
+  t->rto = (t->srtt >> 3) + t->rttvar;
+  if (t->rto < TCP_RTO_MIN)
+    t->rto = TCP_RTO_MIN;
+  if (t->rto > TCP_RTO_MAX)
+    t->rto = TCP_RTO_MAX;
+}
+
+// Handles an ACK that acknowledges new data (or our SYN or FIN).
+static void
+tcp_newack(struct tcb *t, uint32 ack)
+{
+  uint acked, incr;
+
+  acked = ack - t->snd_una;
+  if (t->snd_una == t->iss)
+    acked--;  // our SYN
+  if (t->rtt_timing && SEQ_GT(ack, t->rtt_seq)) {
+    tcp_rttsample(t, ticks - t->rtt_start);
+    t->rtt_timing = 0;
+  }
+  if (acked > t->snd.len) {
+    t->finacked = 1;
+    acked = t->snd.len;
+  }
+  tbufdrop(&t->snd, acked);
+
+  // Reno: leave fast recovery, or grow the window
+  // exponentially below ssthresh and linearly above it.
+  if (t->dupacks >= 3)
+    t->cwnd = t->ssthresh;
+  else if (t->cwnd < t->ssthresh)
+    t->cwnd += t->mss;
+  else {
+    incr = t->mss * t->mss / t->cwnd;
+    t->cwnd += incr > 0 ? incr : 1;
+  }
+  if (t->cwnd > 4*TCP_BUFSIZE)
+    t->cwnd = 4*TCP_BUFSIZE;
+  t->dupacks = 0;
+
+  t->snd_una = ack;
+  if (SEQ_LT(t->snd_nxt, t->snd_una))
+    t->snd_nxt = t->snd_una;
+  t->nrexmt = 0;
+  t->rexmt = t->snd_una == t->snd_max ? 0 : ticks + t->rto;
+  tcpwake(t);
+}
+
+// Handles a duplicate ACK: the third starts fast retransmit
+// and fast recovery; later ones inflate the window.
+static void
+tcp_dupack(struct tcb *t)
+{
+  uint32 nxt;
+  uint flight;
+
+  if (++t->dupacks == 3) {
+    NETSTAT_INC(tcpfastrexmt);
+    flight = t->snd_max - t->snd_una;
+    t->ssthresh = flight / 2 > 2*t->mss ? flight / 2 : 2*t->mss;
+    nxt = t->snd_nxt;
+    t->snd_nxt = t->snd_una;
+    t->cwnd = t->mss;
+    t->rtt_timing = 0;
+    tcp_output(t);
+    if (SEQ_GT(nxt, t->snd_nxt))
+      t->snd_nxt = nxt;
+    t->cwnd = t->ssthresh + 3*t->mss;
+  } else if (t->dupacks > 3) {
+    t->cwnd += t->mss;
+    tcp_output(t);
+  }
+}
+
+// A SYN arrived for listener l: start a connection in SYN_RCVD.
+// It stays detached, belonging to l, until accept() takes it.
+static void
+tcp_passiveopen(struct tcb *l, uint32 raddr, uint16 rport, uint32 seq,
+                uint16 win, uint mss)
+{
+  struct tcb *t;
+
+  if (l->nchild >= l->backlog)
+    return;  // the peer will retry the SYN
+  if ((t = tcballoc()) == 0)
+    return;
+  t->raddr = raddr;
+  t->lport = l->lport;
+  t->rport = rport;
+  t->state = SYN_RCVD;
+  t->detached = 1;
+  t->parent = l;
+  l->nchild++;
+  tcp_setmss(t, mss);
+  t->irs = seq;
+  t->rcv_nxt = seq + 1;
+  t->snd_wnd = win;
+  t->snd_wl1 = seq;
+  tcp_initseq(t);
+  t->next = tcbs;
+  tcbs = t;
+  tcp_output(t);
+}
+
+// Processes a segment for t in SYN_SENT.
+static void
+tcp_synsent(struct tcb *t, struct tcp *tcphdr, uint mss)
+{
+  uint32 seq = ntohl(tcphdr->seq);
+  uint32 ack = ntohl(tcphdr->ack);
+  int flags = tcphdr->flags;
+
+  if ((flags & TCP_ACK) && (SEQ_LEQ(ack, t->iss) || SEQ_GT(ack, t->snd_max))) {
+    if (!(flags & TCP_RST))
+      tcp_respond(t->raddr, t->lport, t->rport, ack, 0, TCP_RST);
+    return;
+  }
+  if (flags & TCP_RST) {
+    if (flags & TCP_ACK)
+      tcp_drop(t, 0);  // connection refused
+    return;
+  }
+  if (!(flags & TCP_SYN))
+    return;
+
+  t->irs = seq;
+  t->rcv_nxt = seq + 1;
+  tcp_setmss(t, mss);
+  t->snd_wnd = ntohs(tcphdr->win);
+  t->snd_wl1 = seq;
+  t->snd_wl2 = ack;
+  if (flags & TCP_ACK) {
+    t->state = ESTABLISHED;
+    tcp_newack(t, ack);
+    if (tcp_output(t) == 0)
+      tcp_ack(t);
+  } else {
+    // simultaneous open: send SYN,ACK from the same iss.
+    t->state = SYN_RCVD;
+    t->snd_nxt = t->iss;
+    tcp_output(t);
+  }
+}
+
+// Processes a segment for t in any state but CLOSED,
+// LISTEN and SYN_SENT. m holds the segment's data.
+static void
+tcp_input(struct tcb *t, struct tcp *tcphdr, struct mbuf *m)
+{
+  uint32 seq = ntohl(tcphdr->seq);
+  uint32 ack = ntohl(tcphdr->ack);
+  uint16 win = ntohs(tcphdr->win);
+  int flags = tcphdr->flags;
+  int needack = 0;
+  uint trim, n;
+
+  // a retransmitted SYN carries the sequence number
+  // just before the first data byte.
+  if ((flags & TCP_SYN) && seq == t->irs) {
+    flags &= ~TCP_SYN;
+    seq++;
+  }
+
+  // trim what was already received, and drop what does
+  // not start at rcv_nxt, ACKing to report what is missing.
+  if (SEQ_LT(seq, t->rcv_nxt)) {
+    trim = t->rcv_nxt - seq;
+    if (trim > m->len) {
+      NETSTAT_INC(tcpdup);
+      if (!(flags & TCP_RST))
+        tcp_ack(t);
+      return;
+    }
+    mbufpull(m, trim);
+    seq += trim;
+  }
+  if (seq != t->rcv_nxt) {
+    NETSTAT_INC(tcpoutoforder);
+    if (!(flags & TCP_RST))
+      tcp_ack(t);
+    return;
+  }
+
+  if (flags & TCP_RST) {
+    tcp_drop(t, 0);
+    return;
+  }
+  if (flags & TCP_SYN) {
+    // RFC 5961: answer an unexpected SYN with an ACK.
+    tcp_ack(t);
+    return;
+  }
+  if (!(flags & TCP_ACK))
+    return;
+
+  if (t->state == SYN_RCVD) {
+    if (SEQ_LEQ(ack, t->snd_una) || SEQ_GT(ack, t->snd_max)) {
+      tcp_respond(t->raddr, t->lport, t->rport, ack, 0, TCP_RST);
+      return;
+    }
+    t->state = ESTABLISHED;
+    t->snd_wnd = win;
+    t->snd_wl1 = seq;
+    t->snd_wl2 = ack;
+    if (t->parent)
+      tcpwake(t->parent);
+  }
+
+  if (SEQ_GT(ack, t->snd_max)) {
+    tcp_ack(t);
+    return;
+  }
+  if (SEQ_GT(ack, t->snd_una))
+    tcp_newack(t, ack);
+  else if (ack == t->snd_una && m->len == 0 && !(flags & TCP_FIN) &&
+           win == t->snd_wnd && t->snd_max != t->snd_una)
+    tcp_dupack(t);
+  if (SEQ_LT(t->snd_wl1, seq) ||
+      (t->snd_wl1 == seq && SEQ_LEQ(t->snd_wl2, ack))) {
+    if (win > t->snd_wnd)
+      tcpwake(t);
+    t->snd_wnd = win;
+    t->snd_wl1 = seq;
+    t->snd_wl2 = ack;
+  }
+
+  if (t->finacked) {
+    switch (t->state) {
+    case FIN_WAIT_1:
+      t->state = FIN_WAIT_2;
+      // we only send a FIN on close(), so nobody can read
+      // any more: don't wait forever for the peer's FIN.
+      t->rexmt = ticks + TCP_FIN2_WAIT;
+      break;
+    case CLOSING:
+      t->state = TIME_WAIT;
+      t->rexmt = ticks + TCP_2MSL;
+      break;
+    case LAST_ACK:
+      t->state = CLOSED;
+      tcpwake(t);
+      return;
+    default:
+      break;
+    }
+  }
+
+  if (t->state == ESTABLISHED || t->state == FIN_WAIT_1 ||
+      t->state == FIN_WAIT_2) {
+    if (m->len > 0) {
+      n = TCP_BUFSIZE - t->rcv.len;
+      if (n < m->len) {
+        NETSTAT_INC(tcprcvfull);
+        flags &= ~TCP_FIN;  // the FIN lies beyond what fits
+      } else {
+        n = m->len;
+      }
+      tbufcopy(&t->rcv, t->rcv.len, 1, 0, (uint64)m->head, n);
+      t->rcv.len += n;
+      t->rcv_nxt += n;
+      needack = 1;
+      tcpwake(t);
+    }
+    if (flags & TCP_FIN) {
+      t->rcv_nxt++;
+      t->rcvfin = 1;
+      needack = 1;
+      tcpwake(t);
+      if (t->state == ESTABLISHED) {
+        t->state = CLOSE_WAIT;
+      } else if (t->state == FIN_WAIT_1) {
+        t->state = CLOSING;
+      } else {
+        t->state = TIME_WAIT;
+        t->rexmt = ticks + TCP_2MSL;
+      }
+    }
+  }
+
+  if (tcp_output(t) == 0 && needack)
+    tcp_ack(t);
+}
+
+// called by net_rx_tcp() with a checksummed segment, which
+// starts at m->head; frees m.
+void
+tcp_rx(struct mbuf *m, uint32 raddr, uint16 lport, uint16 rport)
+{
+  struct tcp *tcphdr;
+  struct tcb *t, *l;
+  uint32 seq, ack;
+  uint8 *opt;
+  int optlen, seglen;
+  uint mss;
+
+  tcphdr = mbufpullhdr(m, *tcphdr);
+  if (!tcphdr)
+    goto done;
+  optlen = (tcphdr->off >> 4) * 4 - sizeof(*tcphdr);
+  if (optlen < 0 || (opt = (uint8*)mbufpull(m, optlen)) == 0) {
+    NETSTAT_INC(tcpbadhdr);
+    goto done;
+  }
+  mss = TCP_MSS_DEFAULT;
+  if (tcphdr->flags & TCP_SYN)
+    mss = tcp_parsemss(opt, optlen);
+  seq = ntohl(tcphdr->seq);
+  ack = ntohl(tcphdr->ack);
+
+  acquire(&tcplock);
+  l = 0;
+  for (t = tcbs; t; t = t->next) {
+    if (t->state == CLOSED || t->lport != lport)
+      continue;
+    if (t->state == LISTEN)
+      l = t;
+    else if (t->raddr == raddr && t->rport == rport)
+      break;
+  }
+
+  if (t == 0 && l &&
+      (tcphdr->flags & (TCP_SYN|TCP_ACK|TCP_RST)) == TCP_SYN) {
+    tcp_passiveopen(l, raddr, rport, seq, ntohs(tcphdr->win), mss);
+  } else if (t == 0) {
+    // no such connection: reset the sender, per RFC 793.
+    NETSTAT_INC(tcpnoport);
+    if (!(tcphdr->flags & TCP_RST)) {
+      if (tcphdr->flags & TCP_ACK) {
+        tcp_respond(raddr, lport, rport, ack, 0, TCP_RST);
+      } else {
+        seglen = m->len + ((tcphdr->flags & TCP_SYN) ? 1 : 0) +
+                 ((tcphdr->flags & TCP_FIN) ? 1 : 0);
+        tcp_respond(raddr, lport, rport, 0, seq + seglen, TCP_RST | TCP_ACK);
+      }
+    }
+  } else if (t->state == SYN_SENT) {
+    tcp_synsent(t, tcphdr, mss);
+  } else {
+    tcp_input(t, tcphdr, m);
+  }
+  release(&tcplock);
+
+done:
+  mbuffree(m);
+}
+
+// Fires t's retransmission timer, which also times out
+// TIME_WAIT and an abandoned FIN_WAIT_2.
+static void
+tcp_timeout(struct tcb *t)
+{
+  uint flight;
+
+  if (t->state == TIME_WAIT || t->state == FIN_WAIT_2) {
+    t->state = CLOSED;
+    tcpwake(t);
+    return;
+  }
+
+  if (t->snd_una == t->snd_max) {
+    // nothing in flight, so the peer's window must be
+    // closed: probe it with one byte.
+    if (t->snd.len > 0) {
+      t->force = 1;
+      tcp_output(t);
+      t->force = 0;
+      t->rto = t->rto*2 < TCP_RTO_MAX ? t->rto*2 : TCP_RTO_MAX;
+    }
+    return;
+  }
+
+  // a zero window keeps the connection alive while
+  // the peer keeps acknowledging the probes.
+  if (t->snd_wnd > 0 && ++t->nrexmt > TCP_MAXRXT) {
+    NETSTAT_INC(tcptimedout);
+    tcp_drop(t, 1);
+    return;
+  }
+  NETSTAT_INC(tcprexmt);
+  flight = t->snd_max - t->snd_una;
+  t->ssthresh = flight / 2 > 2*t->mss ? flight / 2 : 2*t->mss;
+  t->cwnd = t->mss;
+  t->dupacks = 0;
+  t->rtt_timing = 0;  // Karn: don't time retransmissions
+  t->rto = t->rto*2 < TCP_RTO_MAX ? t->rto*2 : TCP_RTO_MAX;
+  t->snd_nxt = t->snd_una;
+  t->force = 1;
+  tcp_output(t);
+  t->force = 0;
+}
+
+// called from clockintr() on every tick: runs timers, and
+// frees connections that are both closed and detached.
+void
+tcptimer(void)
+{
+  struct tcb **pp, *t;
+
+  acquire(&tcplock);
+  pp = &tcbs;
+  while ((t = *pp) != 0) {
+    if (t->state == CLOSED && t->detached) {
+      *pp = t->next;
+      if (t->parent)
+        t->parent->nchild--;
+      tbuffree(&t->snd);
+      tbuffree(&t->rcv);
+      kfree((char*)t);
+      continue;
+    }
+    if (t->rexmt && (int)(ticks - t->rexmt) >= 0) {
+      t->rexmt = 0;
+      tcp_timeout(t);
+    }
+    pp = &t->next;
+  }
+  release(&tcplock);
+}
+
+// Opens a connection to raddr:rport from lport, or from an
+// ephemeral port if lport is 0. Waits until it is established,
+// unless nonblock is set.
+int
+tcpconnect(struct tcb **tp, uint32 raddr, uint16 lport, uint16 rport,
+           int nonblock)
+{
+  struct proc *pr = myproc();
+  struct tcb *t, *pos;
+  int i;
+
+  if ((t = tcballoc()) == 0)
+    return -1;
+  acquire(&tcplock);
+  for (i = 0; lport == 0 && i < 65536 - TCP_PORT_FIRST; i++) {
+    if (!tcp_portused(nextport))
+      lport = nextport;
+    if (++nextport == 0)
+      nextport = TCP_PORT_FIRST;
+  }
+  for (pos = tcbs; pos; pos = pos->next) {
+    if (pos->state != CLOSED && pos->lport == lport &&
+        pos->raddr == raddr && pos->rport == rport)
+      break;
+  }
+  if (lport == 0 || pos) {
+    release(&tcplock);
+    tbuffree(&t->snd);
+    tbuffree(&t->rcv);
+    kfree((char*)t);
+    return -1;
+  }
+  t->raddr = raddr;
+  t->lport = lport;
+  t->rport = rport;
+  t->state = SYN_SENT;
+  tcp_initseq(t);
+  t->next = tcbs;
+  tcbs = t;
+  tcp_output(t);
+  *tp = t;
+
+  // on failure, the caller's close() frees t.
+  while (!nonblock && (t->state == SYN_SENT || t->state == SYN_RCVD)) {
+    if (pr->killed) {
+      release(&tcplock);
+      return -1;
+    }
+    tcpsleep(t);
+  }
+  i = t->err ? -1 : 0;
+  release(&tcplock);
+  return i;
+}
+
+// Starts listening for connections to lport.
+int
+tcplisten(struct tcb **tp, uint16 lport, int backlog)
+{
+  struct tcb *t, *pos;
+
+  if (lport == 0 || (t = tcballoc()) == 0)
+    return -1;
+  acquire(&tcplock);
+  for (pos = tcbs; pos; pos = pos->next) {
+    if (pos->state == LISTEN && pos->lport == lport)
+      break;
+  }
+  if (pos) {
+    release(&tcplock);
+    tbuffree(&t->snd);
+    tbuffree(&t->rcv);
+    kfree((char*)t);
+    return -1;
+  }
+  t->lport = lport;
+  t->state = LISTEN;
+  if (backlog < 1)
+    backlog = 1;
+  t->backlog = backlog < TCP_MAXBACKLOG ? backlog : TCP_MAXBACKLOG;
+  t->next = tcbs;
+  tcbs = t;
+  release(&tcplock);
+  *tp = t;
+  return 0;
+}
+
+// Returns the oldest established connection waiting on
+// listener l, or 0.
+static struct tcb *
+tcp_acceptable(struct tcb *l)
+{
+  struct tcb *t, *oldest;
+
+  oldest = 0;
+  for (t = tcbs; t; t = t->next) {
+    if (t->parent == l && (t->state == ESTABLISHED || t->state == CLOSE_WAIT))
+      oldest = t;  // new connections go on the front
+  }
+  return oldest;
+}
+
+// Waits for a connection to listener l and takes it.
+int
+tcpaccept(struct tcb *l, struct tcb **tp, int nonblock)
+{
+  struct proc *pr = myproc();
+  struct tcb *t;
+
+  acquire(&tcplock);
+  while (l->state == LISTEN && (t = tcp_acceptable(l)) == 0) {
+    if (pr->killed) {
+      release(&tcplock);
+      return -1;
+    }
+    if (nonblock) {
+      release(&tcplock);
+      return -EAGAIN;
+    }
+    tcpsleep(l);
+  }
+  if (l->state != LISTEN) {
+    release(&tcplock);
+    return -1;
+  }
+  t->parent = 0;
+  t->detached = 0;
+  l->nchild--;
+  release(&tcplock);
+  *tp = t;
+  return 0;
+}
+
+// Reads up to n bytes into user address addr. Returns 0 once
+// the peer has closed its side and everything has been read.
+int
+tcpread(struct tcb *t, uint64 addr, int n, int nonblock)
+{
+  struct proc *pr = myproc();
+  uint win;
+
+  acquire(&tcplock);
+  if (t->state == LISTEN) {
+    release(&tcplock);
+    return -1;
+  }
+  while (t->rcv.len == 0 && !t->rcvfin && !t->err && t->state != CLOSED) {
+    if (pr->killed) {
+      release(&tcplock);
+      return -1;
+    }
+    if (nonblock) {
+      release(&tcplock);
+      return -EAGAIN;
+    }
+    tcpsleep(t);
+  }
+  if (t->rcv.len == 0) {
+    release(&tcplock);
+    return t->err ? -1 : 0;
+  }
+  if (n > t->rcv.len)
+    n = t->rcv.len;
+  if (n < 0 || tbufcopy(&t->rcv, 0, 0, 1, addr, n) < 0) {
+    release(&tcplock);
+    return -1;
+  }
+  tbufdrop(&t->rcv, n);
+
+  // tell the peer once the window has opened by a full
+  // segment, so it doesn't wait for the persist timer.
+  win = TCP_BUFSIZE - t->rcv.len;
+  if (!t->rcvfin && (int)(t->rcv_nxt + win - t->rcv_adv) >= (int)t->mss)
+    tcp_ack(t);
+  release(&tcplock);
+  return n;
+}
+
+// Queues up to n bytes from user address addr for sending,
+// waiting for buffer space unless nonblock is set.
+int
+tcpwrite(struct tcb *t, uint64 addr, int n, int nonblock)
+{
+  struct proc *pr = myproc();
+  uint c;
+  int i;
+
+  acquire(&tcplock);
+  for (i = 0; i < n; i += c) {
+    if (t->err || t->sndfin ||
+        (t->state != ESTABLISHED && t->state != CLOSE_WAIT &&
+         t->state != SYN_SENT && t->state != SYN_RCVD)) {
+      release(&tcplock);
+      return i > 0 ? i : -1;
+    }
+    c = TCP_BUFSIZE - t->snd.len;
+    if (c == 0) {
+      if (pr->killed) {
+        release(&tcplock);
+        return -1;
+      }
+      if (nonblock) {
+        release(&tcplock);
+        return i > 0 ? i : -EAGAIN;
+      }
+      tcpsleep(t);
+      continue;
+    }
+    if (c > n - i)
+      c = n - i;
+    if (tbufcopy(&t->snd, t->snd.len, 1, 1, addr + i, c) < 0)
+      break;
+    t->snd.len += c;
+    tcp_output(t);
+  }
+  release(&tcplock);
+  return i > 0 ? i : -1;
+}
+
+// Report whether t is ready, first adding e to t's
+// wait queue if e is non-zero.
+int
+tcppoll(struct tcb *t, struct wqent *e)
+{
+  int mask = 0;
+
+  if (e)
+    wqadd(&t->wq, e);
+  acquire(&tcplock);
+  if (t->state == LISTEN) {
+    if (tcp_acceptable(t))
+      mask |= POLLIN;
+  } else {
+    if (t->rcv.len > 0 || t->rcvfin)
+      mask |= POLLIN;
+    if ((t->state == ESTABLISHED || t->state == CLOSE_WAIT) &&
+        t->snd.len < TCP_BUFSIZE && !t->sndfin)
+      mask |= POLLOUT;
+    if (t->err)
+      mask |= POLLERR;
+    if (t->err || t->state == CLOSED)
+      mask |= POLLHUP;
+  }
+  release(&tcplock);
+  return mask;
+}
+
+// Called when the last file referring to t is closed. Sends
+// a FIN after any data still queued; tcptimer() frees t once
+// the connection has closed.
+void
+tcpclose(struct tcb *t)
+{
+  struct tcb *c;
+
+  acquire(&tcplock);
+  t->detached = 1;
+  switch (t->state) {
+  case LISTEN:
+    for (c = tcbs; c; c = c->next) {
+      if (c->parent == t) {
+        c->parent = 0;
+        t->nchild--;
+        tcp_drop(c, 1);
+      }
+    }
+    t->state = CLOSED;
+    break;
+  case SYN_SENT:
+    t->state = CLOSED;
+    break;
+  case SYN_RCVD:
+    tcp_drop(t, 1);
+    break;
+  case ESTABLISHED:
+    t->sndfin = 1;
+    t->state = FIN_WAIT_1;
+    tcp_output(t);
+    break;
+  case CLOSE_WAIT:
+    t->sndfin = 1;
+    t->state = LAST_ACK;
+    tcp_output(t);
+    break;
+  default:
+    break;
+  }
+  release(&tcplock);
+}
@@ -5,15 +5,22 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "vdso.h"
 
 struct spinlock tickslock;
 uint ticks;
 
+// the page every process maps at VDSO.
+struct vdso *vdso;
+
 extern char trampoline[], uservec[], userret[];
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
+// in uaccess.S, for copyin() and copyout().
+extern char uaccessfault[], uaccessend[];
+
 extern int devintr();
 
 static const char *
@@ -23,6 +30,9 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  if((vdso = (struct vdso*)kalloc()) == 0)
+    panic("trapinit");
+  memset(vdso, 0, PGSIZE);
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -67,7 +77,14 @@ usertrap(void)
     // so don't enable until done with those registers.
     intr_on();
 
+    p->insyscall = 1;
     syscall();
+    p->insyscall = 0;
+    // deliver what the system call sent to ourselves.
+    net_loopback();
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            uvmfault(p, r_stval()) == 0){
+    // a page of the program, loaded on first touch.
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -121,7 +138,7 @@ usertrapret(void)
   w_sepc(p->tf->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = MAKE_SATP(p->pagetable, p->asid);
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -146,14 +163,24 @@ kerneltrap()
     panic("kerneltrap: interrupts enabled");
 
   if((which_dev = devintr()) == 0){
-    printf("scause %p (%s)\n", scause, scause_desc(scause));
-    printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
-    panic("kerneltrap");
+    if((scause == 5 || scause == 7 || scause == 13 || scause == 15) &&
+       sepc >= (uint64)uaccesscopy && sepc < (uint64)uaccessend){
+      // a bad user address in copyin() or copyout(),
+      // which return -1 from uaccessfault.
+      sepc = (uint64)uaccessfault;
+    } else {
+      printf("scause %p (%s)\n", scause, scause_desc(scause));
+      printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
+      panic("kerneltrap");
+    }
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  // give up the CPU if this is a timer interrupt. whatever runs
+  // meanwhile shouldn't see user memory, if we were copying it.
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING){
+    w_sstatus(r_sstatus() & ~SSTATUS_SUM);
     yield();
+  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -166,8 +193,12 @@ clockintr()
 {
   acquire(&tickslock);
   ticks++;
+  vdso->ticks = ticks;
   wakeup(&ticks);
+  wakeuptimeouts(ticks);
   release(&tickslock);
+  net_timer();
+  swaptick();
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -0,0 +1,9 @@
+// Buffers for readv() and writev().
+// Both the kernel and user programs use this header file.
+
+#define UIO_MAXIOV 16   // most buffers in one call
+
+struct iovec {
+  uint64 base;          // user address of the buffer
+  int len;              // its size
+};
@@ -0,0 +1,80 @@
+//
+// submission and completion rings: a process queues system
+// calls in a page it shares with the kernel, and uringenter()
+// carries out a batch of them for one trap.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "uring.h"
+
+// The current process's ring, or 0 if it has none.
+static struct uring *
+uringget(void)
+{
+  pte_t *pte;
+
+  if((pte = uvmpte(myproc()->pagetable, URING)) == 0 || (*pte & PTE_V) == 0)
+    return 0;
+  return (struct uring *)PTE2PA(*pte);
+}
+
+// Maps a zeroed ring into the current process at URING.
+// Returns URING, or -1 if it has one already. exec() and
+// exit() free it, with the rest of the page table.
+uint64
+uringsetup(void)
+{
+  struct proc *p = myproc();
+  char *mem;
+
+  if(uringget() != 0)
+    return -1;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(p->pagetable, URING, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  sfence_vma_page(URING, p->asid);
+  return URING;
+}
+
+// Carries out up to n of the calls queued on the current
+// process's ring, in order, stopping early if the completion
+// ring fills up. Returns how many, or -1 if there is no ring.
+int
+uringenter(int n)
+{
+  struct proc *p = myproc();
+  struct uring *r;
+  struct uringsqe e;
+  struct uringcqe *c;
+  int done, res;
+
+  if((r = uringget()) == 0)
+    return -1;
+  for(done = 0; done < n && !p->killed; done++){
+    if(r->sqhead == r->sqtail || r->cqtail - r->cqhead >= URING_ENTRIES)
+      break;
+    // read the entry after seeing sqtail, and only once,
+    // since the process can change it meanwhile.
+    __sync_synchronize();
+    e = r->sq[r->sqhead % URING_ENTRIES];
+    r->sqhead++;
+    res = uringop(&e);
+    c = &r->cq[r->cqtail % URING_ENTRIES];
+    c->data = e.data;
+    c->res = res;
+    // the process must see the completion before cqtail.
+    __sync_synchronize();
+    r->cqtail++;
+  }
+  return done;
+}
@@ -0,0 +1,47 @@
+// Submission and completion rings.
+// Both the kernel and user programs use this header file.
+//
+// uringsetup() maps a page, struct uring, into the caller's
+// address space. The process queues system calls on the
+// submission ring, sq, and advances sqtail; uringenter() carries
+// them out in order, advancing sqhead, and posts each one's
+// result on the completion ring, cq, advancing cqtail. The
+// process consumes completions and advances cqhead. So a batch
+// of calls costs one trap.
+
+#define URING_ENTRIES 64
+
+// a queued system call.
+struct uringsqe {
+  uint32 op;        // URING_*
+  int    fd;        // URING_READ, URING_WRITE, URING_CLOSE
+  uint64 addr;      // buffer, path (URING_OPEN), or IP address (URING_CONNECT)
+  uint32 len;       // bytes, or open()'s flags
+  uint16 lport;     // URING_CONNECT
+  uint16 rport;
+  uint64 data;      // anything; copied to the completion
+};
+
+#define URING_NOP     0
+#define URING_READ    1  // read(fd, addr, len)
+#define URING_WRITE   2  // write(fd, addr, len)
+#define URING_OPEN    3  // open(addr, len)
+#define URING_CLOSE   4  // close(fd)
+#define URING_CONNECT 5  // connect(addr, lport, rport)
+
+// its result.
+struct uringcqe {
+  uint64 data;      // the uringsqe's
+  int    res;       // what the system call returned
+  int    pad;
+};
+
+struct uring {
+  uint32 sqhead;    // entries ever carried out; advanced by the kernel
+  uint32 sqtail;    // entries ever queued; advanced by the process
+  uint32 cqhead;    // completions ever consumed; by the process
+  uint32 cqtail;    // completions ever posted; by the kernel
+  uint32 pad[12];
+  struct uringsqe sq[URING_ENTRIES];
+  struct uringcqe cq[URING_ENTRIES];
+};
@@ -0,0 +1,7 @@
+// The vDSO page, which the kernel maps read-only into every
+// process at VDSO, for it to read without a system call.
+// Both the kernel and user programs use this header file.
+
+struct vdso {
+  uint ticks;           // clock ticks since boot, as uptime() returns
+};
@@ -39,7 +39,7 @@ struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    int *busy;     // cleared, and woken, when done
     char status;
   } info[NUM];
 
@@ -51,6 +51,17 @@ struct disk {
   
 
 
+// The capacity of disk n in 512-byte sectors,
+// or 0 if qemu has no disk n.
+uint64
+virtio_disk_capacity(int n)
+{
+  if(*R(n, VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
+     *R(n, VIRTIO_MMIO_DEVICE_ID) != 2)
+    return 0;
+  return *(volatile uint64 *)R(n, VIRTIO_MMIO_CONFIG);
+}
+
 void
 virtio_disk_init(int n)
 {
@@ -177,11 +188,11 @@ alloc3_desc(int n, int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(int n, struct buf *b, int write)
+// Read or write the len bytes at data, from or to disk n
+// starting at sector. *busy is 1 until the disk is done.
+static void
+virtio_disk_io(int n, uint64 sector, void *data, uint len, int write, int *busy)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
   acquire(&disk[n].vdisk_lock);
 
   // the spec says that legacy block operations use three
@@ -220,8 +231,8 @@ virtio_disk_rw(int n, struct buf *b, int write)
   disk[n].desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk[n].desc[idx[0]].next = idx[1];
 
-  disk[n].desc[idx[1]].addr = (uint64) b->data;
-  disk[n].desc[idx[1]].len = BSIZE;
+  disk[n].desc[idx[1]].addr = (uint64) data;
+  disk[n].desc[idx[1]].len = len;
   if(write)
     disk[n].desc[idx[1]].flags = 0; // device reads b->data
   else
@@ -235,9 +246,9 @@ virtio_disk_rw(int n, struct buf *b, int write)
   disk[n].desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
   disk[n].desc[idx[2]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk[n].info[idx[0]].b = b;
+  // record the busy flag for virtio_disk_intr().
+  *busy = 1;
+  disk[n].info[idx[0]].busy = busy;
 
   // avail[0] is flags
   // avail[1] tells the device how far to look in avail[2...].
@@ -250,16 +261,32 @@ virtio_disk_rw(int n, struct buf *b, int write)
   *R(n, VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
   // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk[n].vdisk_lock);
+  while(*busy == 1) {
+    sleep(busy, &disk[n].vdisk_lock);
   }
 
-  disk[n].info[idx[0]].b = 0;
+  disk[n].info[idx[0]].busy = 0;
   free_chain(n, idx[0]);
 
   release(&disk[n].vdisk_lock);
 }
 
+void
+virtio_disk_rw(int n, struct buf *b, int write)
+{
+  virtio_disk_io(n, b->blockno * (BSIZE / 512), b->data, BSIZE, write, &b->disk);
+}
+
+// Read or write the page at physical address pa, from or to
+// disk n starting at sector.
+void
+virtio_disk_rwpage(int n, uint64 sector, void *pa, int write)
+{
+  int busy;
+
+  virtio_disk_io(n, sector, pa, PGSIZE, write, &busy);
+}
+
 void
 virtio_disk_intr(int n)
 {
@@ -271,8 +298,8 @@ virtio_disk_intr(int n)
     if(disk[n].info[id].status != 0)
       panic("virtio_disk_intr status");
     
-    disk[n].info[id].b->disk = 0;   // disk is done with buf
-    wakeup(disk[n].info[id].b);
+    *disk[n].info[id].busy = 0;   // disk is done with the data
+    wakeup(disk[n].info[id].busy);
 
     disk[n].used_idx = (disk[n].used_idx + 1) % NUM;
   }
@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -11,6 +13,19 @@
  */
 pagetable_t kernel_pagetable;
 
+// uvmunmap() flushes ranges of more pages than this
+// by flushing the whole address space.
+#define UVM_MAXPAGEFLUSH 32
+
+// address-space identifiers. each process gets one, used by
+// both its page tables, from those of the current generation.
+// running out starts a new generation, and each hart flushes
+// its whole TLB before it uses an ASID from it.
+struct spinlock asidlock;
+uint64 asidgen = 1;
+int nextasid = 1;
+int maxasid;     // 0: no ASIDs; flush on every process switch
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
@@ -25,6 +40,7 @@ void print(pagetable_t);
 void
 kvminit()
 {
+  initlock(&asidlock, "asid");
   kernel_pagetable = (pagetable_t) kalloc();
   memset(kernel_pagetable, 0, PGSIZE);
 
@@ -43,9 +59,6 @@ kvminit()
   // pci.c maps the e1000's registers here.
   kvmmap(0x40000000L, 0x40000000L, 0x20000, PTE_R | PTE_W);
 
-  // CLINT
-  kvmmap(CLINT, CLINT, 0x10000, PTE_R | PTE_W);
-
   // PLIC
   kvmmap(PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
@@ -61,17 +74,119 @@ kvminit()
 }
 
 // Switch h/w page table register to the kernel's page table,
-// and enable paging.
+// and enable paging. Also find out how many ASIDs there are,
+// from the bits of satp's ASID field that stick.
 void
 kvminithart()
 {
-  w_satp(MAKE_SATP(kernel_pagetable));
+  w_satp(MAKE_SATP(kernel_pagetable, 0) | SATP_ASIDMASK);
+  maxasid = (r_satp() & SATP_ASIDMASK) >> SATP_ASIDSHIFT;
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
   sfence_vma();
 }
 
-// Return the address of the PTE in page table pagetable
-// that corresponds to virtual address va.  If alloc!=0,
-// create any required page-table pages.
+// Switch this hart to p's kernel page table, or to the kernel's
+// if p is 0. Gives p an ASID if it has none from the current
+// generation, and flushes only what may be stale: the whole TLB
+// if this hart hasn't since a new generation began, or p's
+// entries if p last ran elsewhere, since it may have changed
+// its page table there. Kernel mappings are global, so the
+// kernel's page table, ASID 0, needs no flush unless processes
+// use ASID 0 too.
+// Caller holds p->lock.
+void
+kvmswitch(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  int flush;
+
+  if(p == 0){
+    w_satp(MAKE_SATP(kernel_pagetable, 0));
+    if(maxasid == 0)
+      sfence_vma();
+    return;
+  }
+
+  acquire(&asidlock);
+  if(maxasid == 0){
+    p->asid = 0;
+  } else if(p->asidgen != asidgen){
+    if(nextasid > maxasid){
+      asidgen++;
+      nextasid = 1;
+    }
+    p->asid = nextasid++;
+    p->asidgen = asidgen;
+  }
+  flush = maxasid == 0 || c->asidgen != asidgen;
+  c->asidgen = asidgen;
+  release(&asidlock);
+
+  w_satp(MAKE_SATP(p->kpagetable, p->asid));
+  if(flush)
+    sfence_vma();
+  else if(p->asidcpu != cpuid())
+    sfence_vma_asid(p->asid);
+  p->asidcpu = cpuid();
+}
+
+// Create a kernel page table for a process. It shares all of
+// kernel_pagetable's page-table pages but the level-1 page for
+// the first 1GB, which is its own so that kvmsync() can add the
+// process's memory below MAXUSZ. Returns 0 if out of memory.
+pagetable_t
+kvmcreate(void)
+{
+  pagetable_t kpagetable, l1, kl1;
+  int i;
+
+  if((kpagetable = (pagetable_t) kalloc()) == 0)
+    return 0;
+  if((l1 = (pagetable_t) kalloc()) == 0){
+    kfree(kpagetable);
+    return 0;
+  }
+  memset(l1, 0, PGSIZE);
+  kl1 = (pagetable_t) PTE2PA(kernel_pagetable[0]);
+  for(i = PX(1, MAXUSZ); i < 512; i++)
+    l1[i] = kl1[i];
+  kpagetable[0] = PA2PTE(l1) | PTE_V;
+  for(i = 1; i < 512; i++)
+    kpagetable[i] = kernel_pagetable[i];
+  return kpagetable;
+}
+
+// Make a process's kernel page table map the user memory of
+// pagetable below MAXUSZ, by copying its level-1 PTEs, which
+// point at its level-0 pages or are megapages. Call after
+// anything that may change those PTEs, and before freeing the
+// level-0 pages they point at.
+void
+kvmsync(pagetable_t kpagetable, pagetable_t pagetable)
+{
+  pagetable_t l1, ul1;
+  int i;
+
+  l1 = (pagetable_t) PTE2PA(kpagetable[0]);
+  ul1 = (pagetable[0] & PTE_V) ? (pagetable_t) PTE2PA(pagetable[0]) : 0;
+  for(i = 0; i < PX(1, MAXUSZ); i++)
+    l1[i] = ul1 ? ul1[i] : 0;
+}
+
+// Free a page table from kvmcreate(), but none of what it
+// shares with kernel_pagetable or the user page table.
+void
+kvmfree(pagetable_t kpagetable)
+{
+  kfree((void *) PTE2PA(kpagetable[0]));
+  kfree((void *) kpagetable);
+}
+
+// Return the address of the PTE at *level in page table
+// pagetable that corresponds to virtual address va: level 0
+// for a page, 1 for a megapage. If alloc!=0, create any
+// required page-table pages. If a leaf at a higher level
+// maps va, returns that PTE instead, and sets *level.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -82,14 +197,18 @@ kvminithart()
 //   12..20 -- 9 bits of level-0 index.
 //    0..12 -- 12 bits of byte offset within the page.
 static pte_t *
-walk(pagetable_t pagetable, uint64 va, int alloc)
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int *level)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > *level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte)){
+        *level = l;
+        return pte;
+      }
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
       if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
@@ -98,7 +217,16 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(*level, va)];
+}
+
+// The PTE for the page or megapage that maps va.
+static pte_t *
+walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  int level = 0;
+
+  return walklevel(pagetable, va, alloc, &level);
 }
 
 // Look up a virtual address, return the physical address,
@@ -109,28 +237,30 @@ walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   uint64 pa;
+  int level = 0;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walklevel(pagetable, va, 0, &level);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = PTE2PA(*pte) + (PGROUNDDOWN(va) & (PXSIZE(level) - 1));
   return pa;
 }
 
-// add a mapping to the kernel page table.
+// add a mapping to the kernel page table, global since every
+// process's kernel page table shares it.
 // only used when booting.
 // does not flush TLB or enable paging.
 void
 kvmmap(uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kernel_pagetable, va, sz, pa, perm) != 0)
+  if(mappages(kernel_pagetable, va, sz, pa, perm | PTE_G) != 0)
     panic("kvmmap");
 }
 
@@ -141,76 +271,135 @@ kvmmap(uint64 va, uint64 pa, uint64 sz, int perm)
 uint64
 kvmpa(uint64 va)
 {
-  uint64 off = va % PGSIZE;
   pte_t *pte;
   uint64 pa;
+  int level = 0;
   
-  pte = walk(kernel_pagetable, va, 0);
+  pte = walklevel(kernel_pagetable, va, 0, &level);
   if(pte == 0)
     panic("kvmpa");
   if((*pte & PTE_V) == 0)
     panic("kvmpa");
   pa = PTE2PA(*pte);
-  return pa+off;
+  return pa + (va & (PXSIZE(level) - 1));
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. Uses a megapage wherever both va and pa are
+// at a megapage boundary and the rest of the range covers it.
+// Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
   uint64 a, last;
   pte_t *pte;
+  int level;
 
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    level = a % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 &&
+            last - a >= MEGAPGSIZE - PGSIZE;
+    if((pte = walklevel(pagetable, a, 1, &level)) == 0)
       return -1;
     if(*pte & PTE_V)
       panic("remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
+    if(last - a < PXSIZE(level))
       break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    a += PXSIZE(level);
+    pa += PXSIZE(level);
   }
   return 0;
 }
 
-// Remove mappings from a page table. The mappings in
-// the given range must exist. Optionally free the
-// physical memory.
+// Replace the megapage leaf *pte with a page-table page that
+// maps the same pages one by one, so that some can be unmapped.
+// Returns -1, leaving *pte alone, if there is no memory.
+static int
+megasplit(pte_t *pte)
+{
+  pagetable_t l0;
+  uint64 pa = PTE2PA(*pte);
+
+  if((l0 = (pagetable_t) kalloc()) == 0)
+    return -1;
+  for(int i = 0; i < 512; i++)
+    l0[i] = PA2PTE(pa + i*PGSIZE) | PTE_FLAGS(*pte);
+  *pte = PA2PTE(l0) | PTE_V;
+  return 0;
+}
+
+// The ASID whose TLB entries on this hart may hold pagetable's
+// mappings, or -1 if it isn't the current process's. Another
+// process's entries here are flushed when it next runs here.
+static int
+uvmasid(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || p->pagetable != pagetable)
+    return -1;
+  return p->asid;
+}
+
+// Remove mappings from a page table. Pages in the range
+// that were never loaded are skipped, and swapped-out ones
+// have their swap slot freed. Optionally free the physical
+// memory. Flushes the TLB entries for the range, page by
+// page unless there are too many.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 size, int do_free)
 {
   uint64 a, last;
   pte_t *pte;
   uint64 pa;
+  int asid, pageflush, level;
 
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
+  asid = uvmasid(pagetable);
+  pageflush = (last - a) / PGSIZE < UVM_MAXPAGEFLUSH;
   for(;;){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0){
-      printf("va=%p pte=%p\n", a, *pte);
-      panic("uvmunmap: not mapped");
+    level = 0;
+    if((pte = walklevel(pagetable, a, 0, &level)) == 0 || (*pte & PTE_V) == 0){
+      // a page of the program that was never touched,
+      // or one that is swapped out.
+      if(pte && (*pte & PTE_SW)){
+        swapfree(PTE2SLOT(*pte));
+        *pte = 0;
+      }
+      if(a == last)
+        break;
+      a += PGSIZE;
+      continue;
     }
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
-    if(do_free){
-      pa = PTE2PA(*pte);
-      kfree((void*)pa);
+    if(level > 0 && (a % MEGAPGSIZE != 0 || last - a < MEGAPGSIZE - PGSIZE)){
+      // only part of a megapage. megapages lie wholly below
+      // p->sz, and uvmdealloc() splits the one a shrink starts
+      // in beforehand, so this can't happen on a user's behalf.
+      if(megasplit(pte) < 0)
+        panic("uvmunmap: megasplit");
+      continue;
     }
+    pa = PTE2PA(*pte);
     *pte = 0;
-    if(a == last)
+    if(asid >= 0 && pageflush)
+      sfence_vma_page(a, asid);
+    if(do_free && level > 0)
+      kmegafree((void*)pa);
+    else if(do_free)
+      kfree((void*)pa);
+    if(last - a < PXSIZE(level))
       break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    a += PXSIZE(level);
   }
+  if(asid >= 0 && !pageflush)
+    sfence_vma_asid(asid);
 }
 
 // create an empty user page table.
@@ -241,28 +430,50 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
   memmove(mem, src, sz);
 }
 
+// Is the level-1 PTE for va free, for a megapage?
+static int
+megaslotfree(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  int level = 1;
+
+  pte = walklevel(pagetable, va, 0, &level);
+  return pte == 0 || *pte == 0;
+}
+
 // Allocate PTEs and physical memory to grow process from oldsz to
-// newsz, which need not be page aligned.  Returns new size or 0 on error.
+// newsz, which need not be page aligned.  If mega!=0, use megapages
+// for the aligned megapages in between when there are free ones.
+// Returns new size or 0 on error.
 uint64
-uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
+uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int mega)
 {
   char *mem;
-  uint64 a;
+  uint64 a, n;
 
   if(newsz < oldsz)
     return oldsz;
+  if(newsz > MAXUSZ)
+    return 0;
 
   oldsz = PGROUNDUP(oldsz);
   a = oldsz;
-  for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
-    if(mem == 0){
+  for(; a < newsz; a += n){
+    if(mega && a % MEGAPGSIZE == 0 && newsz - a >= MEGAPGSIZE &&
+       megaslotfree(pagetable, a) && (mem = kmegaalloc()) != 0){
+      n = MEGAPGSIZE;
+    } else if((mem = kalloc()) != 0){
+      n = PGSIZE;
+    } else {
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
-    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
-      kfree(mem);
+    memset(mem, 0, n);
+    if(mappages(pagetable, a, n, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+      if(n == MEGAPGSIZE)
+        kmegafree(mem);
+      else
+        kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
@@ -273,14 +484,23 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, or oldsz, with
+// nothing freed, if newsz is in the middle of a megapage and
+// there's no memory to split it with.
 uint64
 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
+  pte_t *pte;
+  int level = 0;
+
   if(newsz >= oldsz)
     return oldsz;
 
   uint64 newup = PGROUNDUP(newsz);
+  if(newup % MEGAPGSIZE != 0 && newup < PGROUNDUP(oldsz) &&
+     (pte = walklevel(pagetable, newup, 0, &level)) != 0 && level > 0 &&
+     (*pte & PTE_V) && megasplit(pte) < 0)
+    return oldsz;
   if(newup < PGROUNDUP(oldsz))
     uvmunmap(pagetable, newup, oldsz - newup, 1);
 
@@ -325,23 +545,50 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
-  uint64 pa, i;
+  pte_t *pte, *npte;
+  uint64 pa, i, n;
   uint flags;
   char *mem;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
+  int level;
+
+  for(i = 0; i < sz; i += n){
+    level = 0;
+    n = PGSIZE;
+    if((pte = walklevel(old, i, 0, &level)) == 0 || (*pte & PTE_V) == 0){
+      if(pte && (*pte & PTE_SW)){
+        // the child shares the swap slot.
+        if((npte = walk(new, i, 1)) == 0)
+          goto err;
+        swapdup(PTE2SLOT(*pte));
+        *npte = *pte;
+      }
+      continue; // else left for uvmfault()
+    }
+    pa = PTE2PA(*pte) + (i & (PXSIZE(level) - 1));
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if((flags & PTE_W) == 0 && level == 0){
+      // read-only, so the child can share it.
+      kincref((void*)pa);
+      if(mappages(new, i, n, pa, flags) != 0){
+        kfree((void*)pa);
+        goto err;
+      }
+      continue;
+    }
+    // a megapage for a megapage if there's one free,
+    // else its pages one at a time.
+    if(level > 0 && i % MEGAPGSIZE == 0 && (mem = kmegaalloc()) != 0)
+      n = MEGAPGSIZE;
+    else if((mem = kalloc()) != 0)
+      n = PGSIZE;
+    else
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    memmove(mem, (char*)pa, n);
+    if(mappages(new, i, n, (uint64)mem, flags) != 0){
+      if(n == MEGAPGSIZE)
+        kmegafree(mem);
+      else
+        kfree(mem);
       goto err;
     }
   }
@@ -352,17 +599,137 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
-// mark a PTE invalid for user access.
-// used by exec for the user stack guard page.
+// unmap and free the page at va, so that neither the process
+// nor copyin() and copyout(), which don't check for PTE_U (see
+// uaccessok()), can touch it. used by exec for the user stack
+// guard page.
 void
 uvmclear(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
-  
+
   pte = walk(pagetable, va, 0);
-  if(pte == 0)
+  if(pte == 0 || (*pte & PTE_V) == 0)
     panic("uvmclear");
-  *pte &= ~PTE_U;
+  uvmunmap(pagetable, va, PGSIZE, 1);
+}
+
+// Can the current process's kernel page table, which satp
+// holds, reach [va, va+len) of pagetable at the same addresses?
+static int
+uaccessok(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+
+  return p != 0 && pagetable == p->pagetable &&
+         va < MAXUSZ && len <= MAXUSZ - va;
+}
+
+// The level-0 PTE for va, or 0 if there's no page-table page for
+// it or a megapage maps it.
+pte_t *
+uvmpte(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  int level = 0;
+
+  if((pte = walklevel(pagetable, va, 0, &level)) == 0 || level > 0)
+    return 0;
+  return pte;
+}
+
+// Load the page at va of the current process, the first time
+// the process touches it, from the program segment it's in, or
+// back from swap. Clean read-only pages of the program are the
+// page cache's own, shared with every other process running it.
+// With spinlocks held, only pages that needn't be read from the
+// disk can be loaded. Returns 0, or -1 if va isn't in a segment
+// waiting to be loaded or swapped out, or there's no memory;
+// then the access is a real fault.
+int
+uvmfault(struct proc *p, uint64 va)
+{
+  struct execseg *s;
+  pte_t *pte;
+  uint64 a, pa, off, n;
+  char *mem;
+  int canblock;
+
+  va = PGROUNDDOWN(va);
+  if(va >= p->sz)
+    return -1;
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V))
+    return -1;
+
+  push_off();
+  canblock = mycpu()->noff == 1;
+  pop_off();
+
+  if(pte && (*pte & PTE_SW))
+    return canblock ? swapin(va, pte) : -1;
+  for(s = p->seg; s < p->seg + p->nseg; s++)
+    if(va >= s->va && va < s->end)
+      break;
+  if(s == p->seg + p->nseg)
+    return -1;
+
+  off = s->off + (va - s->va);
+  if((s->perm & PTE_W) == 0 && off % PGSIZE == 0 &&
+     (va + PGSIZE <= s->fileend || s->fileend == s->end)){
+    if((pa = pcget(p->exe, off / PGSIZE, canblock)) == 0)
+      return -1;
+  } else {
+    // a private copy: writable, or partly zeros, or the
+    // segment's file offset isn't page-aligned.
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    for(a = va; a < va + PGSIZE && a < s->fileend; a += n){
+      off = s->off + (a - s->va);
+      n = PGSIZE - off % PGSIZE;
+      if(n > va + PGSIZE - a)
+        n = va + PGSIZE - a;
+      if(n > s->fileend - a)
+        n = s->fileend - a;
+      if((pa = pcget(p->exe, off / PGSIZE, canblock)) == 0){
+        kfree(mem);
+        return -1;
+      }
+      memmove(mem + (a - va), (char*)pa + off % PGSIZE, n);
+      kfree((void*)pa);
+    }
+    pa = (uint64)mem;
+  }
+  if(mappages(p->pagetable, va, PGSIZE, pa, s->perm | PTE_U) != 0){
+    kfree((void*)pa);
+    return -1;
+  }
+  kvmsync(p->kpagetable, p->pagetable);
+  sfence_vma_page(va, p->asid);
+  return 0;
+}
+
+// Load the pages in [va, va+len) of the current process that
+// exec() left for uvmfault(), or that are swapped out, so that
+// the kernel can then copy to and from them with locks held.
+// Returns how many it loaded.
+int
+uvmfaultin(uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint64 a, end;
+  int n = 0;
+
+  if(p == 0 || va >= p->sz)
+    return 0;
+  end = len < p->sz - va ? va + len : p->sz;
+  for(a = PGROUNDDOWN(va); a < end; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if((pte == 0 || (*pte & PTE_V) == 0) && uvmfault(p, a) == 0)
+      n++;
+  }
+  return n;
 }
 
 // Copy from kernel to user.
@@ -373,6 +740,15 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  // a page the program hasn't touched yet faults.
+  if(uaccessok(pagetable, dstva, len)){
+    if(uaccesscopy((void *)dstva, src, len) == 0)
+      return 0;
+    if(uvmfaultin(dstva, len) == 0)
+      return -1;
+    return uaccesscopy((void *)dstva, src, len);
+  }
+
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
     pa0 = walkaddr(pagetable, va0);
@@ -398,6 +774,14 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(uaccessok(pagetable, srcva, len)){
+    if(uaccesscopy(dst, (void *)srcva, len) == 0)
+      return 0;
+    if(uvmfaultin(srcva, len) == 0)
+      return -1;
+    return uaccesscopy(dst, (void *)srcva, len);
+  }
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
@@ -425,6 +809,18 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  // user memory ends at MAXUSZ, so a string that runs into it
+  // has no end.
+  if(uaccessok(pagetable, srcva, 1)){
+    if(max > MAXUSZ - srcva)
+      max = MAXUSZ - srcva;
+    if(uaccesscopystr(dst, (char *)srcva, max) == 0)
+      return 0;
+    if(uvmfaultin(srcva, max) == 0)
+      return -1;
+    return uaccesscopystr(dst, (char *)srcva, max);
+  }
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
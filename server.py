@@ -1,13 +1,39 @@
 import socket
 import sys
+import threading
+
+def tcp_echo(conn):
+    while True:
+        buf = conn.recv(4096)
+        if not buf:
+            break
+        conn.sendall(buf)
+    conn.close()
+
+def tcp_server(addr):
+    lsock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    lsock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    lsock.bind(addr)
+    lsock.listen(5)
+    while True:
+        conn, raddr = lsock.accept()
+        print >>sys.stderr, 'tcp connection from %s port %s' % raddr
+        t = threading.Thread(target=tcp_echo, args=(conn,))
+        t.daemon = True
+        t.start()
 
 sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
 addr = ('localhost', int(sys.argv[1]))
 print >>sys.stderr, 'listening on %s port %s' % addr
 sock.bind(addr)
 
+# the same port echoes TCP streams too.
+t = threading.Thread(target=tcp_server, args=(addr,))
+t.daemon = True
+t.start()
+
 while True:
-    buf, raddr = sock.recvfrom(4096)
+    buf, raddr = sock.recvfrom(65535)
     print >>sys.stderr, buf
     if buf:
         sent = sock.sendto(buf, raddr)
@@ -0,0 +1,252 @@
+//
+// measure UDP round trips and throughput against the echo
+// service of the host's server.py (make server), or with -l
+// against an echo process of our own over loopback. each run
+// prints one line of name=value pairs, for scripts to compare.
+//
+// usage: netbench [-l] [-n count] [-s size] [-b batch] [-k socks]
+//                 [rr | stream | echo]
+//
+// with no mode, runs a sweep of sizes, batches and sockets.
+// echo serves host-side clients (make bench) on port 2000.
+//
+
+#include "kernel/types.h"
+#include "kernel/net.h"
+#include "kernel/socket.h"
+#include "kernel/fcntl.h"
+#include "kernel/poll.h"
+#include "kernel/errno.h"
+#include "user/user.h"
+
+#define HZ          10000000 // qemu's time CSR counts at 10 MHz
+#define MAXSIZE     8000
+#define MAXBATCH    16
+#define MAXSOCKS    8
+#define MAXSAMPLES  8192
+#define STREAMWIN   32       // datagrams in flight per socket
+#define TIMEOUT     10       // ticks without an echo before giving up
+#define FIRSTPORT   3100     // our local ports
+#define ECHOPORT    2000     // where echo listens
+
+static char sbuf[MAXBATCH][MAXSIZE];
+static char rbuf[MAXBATCH][MAXSIZE];
+static uint64 rtts[MAXSAMPLES];
+static int nrtts;
+
+static inline uint64
+rdtime(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+static uint64
+us(uint64 t)
+{
+  return t * 1000000 / HZ;
+}
+
+static void
+sortrtts(void)
+{
+  int gap, i, j;
+  uint64 t;
+
+  for(gap = nrtts / 2; gap > 0; gap /= 2){
+    for(i = gap; i < nrtts; i++){
+      t = rtts[i];
+      for(j = i; j >= gap && rtts[j - gap] > t; j -= gap)
+        rtts[j] = rtts[j - gap];
+      rtts[j] = t;
+    }
+  }
+}
+
+static uint64
+percentile(int p)
+{
+  return nrtts == 0 ? 0 : us(rtts[(nrtts - 1) * p / 100]);
+}
+
+static void
+report(char *name, int size, int socks, int batch, int sent, int recv,
+       uint64 elapsed)
+{
+  if(elapsed == 0)
+    elapsed = 1;
+  sortrtts();
+  printf("netbench %s size=%d socks=%d batch=%d sent=%d recv=%d lost=%d",
+         name, size, socks, batch, sent, recv, sent - recv);
+  printf(" us=%l pps=%l kbps=%l", us(elapsed),
+         (uint64)recv * HZ / elapsed,
+         (uint64)recv * size * 8 * (HZ / 1000) / elapsed);
+  printf(" p50_us=%l p90_us=%l p99_us=%l max_us=%l\n",
+         percentile(50), percentile(90), percentile(99), percentile(100));
+}
+
+// Sends n datagrams of size bytes to dst and dport over socks
+// sockets, batch at a time with sendmmsg(), keeping up to win
+// in flight on each, and times their echoes. Each datagram
+// carries the time it was sent.
+static void
+run(char *name, uint32 dst, uint16 dport, int size, int socks, int batch,
+    int win, int n)
+{
+  struct mmsg vec[MAXBATCH];
+  struct pollfd pfd[MAXSOCKS];
+  int inflight[MAXSOCKS];
+  int k, j, r, nb, sent, recv;
+  uint64 start;
+
+  for(k = 0; k < socks; k++){
+    if((pfd[k].fd = connect(dst, FIRSTPORT + k, dport)) < 0){
+      fprintf(2, "netbench: connect() failed\n");
+      exit(1);
+    }
+    fcntl(pfd[k].fd, F_SETFL, O_NONBLOCK);
+    pfd[k].events = POLLIN;
+    inflight[k] = 0;
+  }
+  nrtts = 0;
+  sent = recv = 0;
+  start = rdtime();
+  while(recv < sent || sent < n){
+    for(k = 0; k < socks; k++){
+      while(sent < n && inflight[k] + batch <= win){
+        nb = n - sent < batch ? n - sent : batch;
+        for(j = 0; j < nb; j++){
+          *(uint64 *)sbuf[j] = rdtime();
+          vec[j].buf = (uint64)sbuf[j];
+          vec[j].len = size;
+        }
+        if((r = sendmmsg(pfd[k].fd, vec, nb)) <= 0){
+          fprintf(2, "netbench: sendmmsg() failed\n");
+          exit(1);
+        }
+        sent += r;
+        inflight[k] += r;
+      }
+    }
+    // a lost datagram would hold its slot forever; give
+    // up on the rest once the echoes stop coming.
+    if(poll(pfd, socks, TIMEOUT) <= 0)
+      break;
+    for(k = 0; k < socks; k++){
+      if(!(pfd[k].revents & POLLIN))
+        continue;
+      for(j = 0; j < batch; j++){
+        vec[j].buf = (uint64)rbuf[j];
+        vec[j].len = MAXSIZE;
+      }
+      if((r = recvmmsg(pfd[k].fd, vec, batch)) <= 0)
+        continue;
+      for(j = 0; j < r; j++){
+        if(vec[j].n >= sizeof(uint64) && nrtts < MAXSAMPLES)
+          rtts[nrtts++] = rdtime() - *(uint64 *)rbuf[j];
+      }
+      recv += r;
+      inflight[k] -= r;
+    }
+  }
+  report(name, size, socks, batch, sent, recv, rdtime() - start);
+  for(k = 0; k < socks; k++)
+    close(pfd[k].fd);
+}
+
+// Echoes every datagram sent to port back to its sender, a
+// batch at a time. Never returns.
+static void
+echo(uint16 port)
+{
+  struct mmsg vec[MAXBATCH];
+  int fd, j, r;
+
+  if((fd = connect(0, port, 0)) < 0){
+    fprintf(2, "netbench: echo: connect() failed\n");
+    exit(1);
+  }
+  for(;;){
+    for(j = 0; j < MAXBATCH; j++){
+      vec[j].buf = (uint64)rbuf[j];
+      vec[j].len = MAXSIZE;
+    }
+    if((r = recvmmsg(fd, vec, MAXBATCH)) <= 0)
+      continue;
+    // each reply goes back to the sender recvmmsg() filled in.
+    for(j = 0; j < r; j++)
+      vec[j].len = vec[j].n;
+    sendmmsg(fd, vec, r);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  static int sizes[] = { 64, 512, 1400, MAXSIZE };
+  int i, pid, loop = 0, n = 2000, size = 0, batch = 1, socks = 1;
+  char *mode = 0;
+  uint32 dst;
+  uint16 dport;
+
+  for(i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-l") == 0)
+      loop = 1;
+    else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      n = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      size = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+      batch = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+      socks = atoi(argv[++i]);
+    else if(mode == 0 && argv[i][0] != '-')
+      mode = argv[i];
+    else
+      goto usage;
+  }
+  if(n <= 0 || size < 0 || size > MAXSIZE || (size > 0 && size < sizeof(uint64)) ||
+     batch < 1 || batch > MAXBATCH || socks < 1 || socks > MAXSOCKS)
+    goto usage;
+  if(mode && strcmp(mode, "echo") == 0)
+    echo(ECHOPORT);
+
+  pid = 0;
+  if(loop){
+    dst = (127 << 24) | (0 << 16) | (0 << 8) | (1 << 0);
+    dport = ECHOPORT + 1;
+    if((pid = fork()) == 0)
+      echo(dport);
+  } else {
+    dst = (10 << 24) | (0 << 16) | (2 << 8) | (2 << 0);
+    dport = NET_TESTS_PORT;
+  }
+
+  if(mode == 0){
+    for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++)
+      run("rr", dst, dport, sizes[i], 1, 1, 1, n / 2);
+    for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+      run("stream", dst, dport, sizes[i], 1, 1, STREAMWIN, n);
+      run("stream", dst, dport, sizes[i], 1, MAXBATCH, STREAMWIN, n);
+      run("stream", dst, dport, sizes[i], 4, MAXBATCH, STREAMWIN, n);
+    }
+  } else if(strcmp(mode, "rr") == 0){
+    run("rr", dst, dport, size ? size : 64, 1, 1, 1, n);
+  } else if(strcmp(mode, "stream") == 0){
+    run("stream", dst, dport, size ? size : 1400, socks, batch,
+        STREAMWIN < batch ? batch : STREAMWIN, n);
+  } else {
+    goto usage;
+  }
+
+  if(pid > 0){
+    kill(pid);
+    wait(0);
+  }
+  exit(0);
+
+usage:
+  fprintf(2, "usage: netbench [-l] [-n count] [-s size] [-b batch] [-k socks] [rr | stream | echo]\n");
+  exit(1);
+}
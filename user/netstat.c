@@ -0,0 +1,67 @@
+//
+// print the network stack's counters, which the kernel
+// keeps from boot and the netstat device reports.
+//
+// usage: netstat [-a]
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/netstat.h"
+#include "user/user.h"
+
+#define F(name) { #name, __builtin_offsetof(struct netstat, name) }
+
+static struct {
+  char *name;
+  int off;
+} fields[] = {
+  F(rxframes), F(rxbytes), F(rxnombuf), F(txframes), F(txbytes),
+  F(txringfull),
+  F(hwrxgood), F(hwtxgood), F(hwmissed), F(hwnobuf), F(hwcrcerrs),
+  F(hwrxerrs), F(hwlenerrs), F(hwundersize), F(hwoversize),
+  F(ethshort), F(ethnotype), F(arprx), F(arptx), F(arpbad),
+  F(arpnoentry), F(arpoverflow), F(arptimeout),
+  F(iprx), F(iptx), F(ipbadhdr), F(ipbadsum), F(ipnotours),
+  F(ipnoproto), F(ipfragsrx), F(ipreassembled), F(ipfragdrops),
+  F(ipfragstx), F(ipfragfails),
+  F(udprx), F(udptx), F(udpbadlen), F(udpbadsum), F(udpnoport),
+  F(udpfullsock),
+  F(tcprx), F(tcptx), F(tcpbadhdr), F(tcpbadsum), F(tcpnoport),
+  F(tcpdup), F(tcpoutoforder), F(tcprcvfull), F(tcprexmt),
+  F(tcpfastrexmt), F(tcptimedout),
+  F(looppkts), F(loopdrops),
+  F(csumrxhw), F(csumtxhw),
+};
+
+int
+main(int argc, char *argv[])
+{
+  struct netstat st;
+  uint64 v;
+  int fd, i, all = 0;
+
+  if(argc == 2 && strcmp(argv[1], "-a") == 0){
+    all = 1;
+  } else if(argc != 1){
+    fprintf(2, "usage: netstat [-a]\n");
+    exit(1);
+  }
+
+  if((fd = open("netstat", O_RDONLY)) < 0){
+    mknod("netstat", NETSTAT, 0);
+    fd = open("netstat", O_RDONLY);
+  }
+  if(fd < 0 || read(fd, &st, sizeof(st)) != sizeof(st)){
+    fprintf(2, "netstat: cannot read netstat\n");
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < sizeof(fields)/sizeof(fields[0]); i++){
+    v = *(uint64 *)((char *)&st + fields[i].off);
+    if(v != 0 || all)
+      printf("%s %l\n", fields[i].name, v);
+  }
+  exit(0);
+}
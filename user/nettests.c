@@ -1,6 +1,12 @@
 #include "kernel/types.h"
 #include "kernel/net.h"
 #include "kernel/stat.h"
+#include "kernel/socket.h"
+#include "kernel/fcntl.h"
+#include "kernel/poll.h"
+#include "kernel/pcap.h"
+#include "kernel/netstat.h"
+#include "kernel/nettrace.h"
 #include "user/user.h"
 
 //
@@ -47,6 +53,327 @@ ping(uint16 sport, uint16 dport, int attempts)
   }
 }
 
+//
+// shrink a socket's receive buffer, let the host echo more
+// packets than fit, and check that the overflow is dropped
+// and counted.
+//
+static void
+rcvbuf(uint16 sport, uint16 dport)
+{
+  int fd, n;
+  char obuf[13] = "hello world!";
+  char ibuf[128];
+  struct sockstat st;
+  uint32 dst;
+
+  dst = (10 << 24) | (0 << 16) | (2 << 8) | (2 << 0);
+  if((fd = connect(dst, sport, dport)) < 0){
+    fprintf(2, "rcvbuf: connect() failed\n");
+    exit(1);
+  }
+  if(setsockopt(fd, SO_RCVBUF, SOCK_RCVBUF_MIN) < 0){
+    fprintf(2, "rcvbuf: setsockopt() failed\n");
+    exit(1);
+  }
+
+  n = 2 * SOCK_RCVBUF_MIN / 4096;
+  for(int i = 0; i < n; i++){
+    if(write(fd, obuf, sizeof(obuf)) < 0){
+      fprintf(2, "rcvbuf: send() failed\n");
+      exit(1);
+    }
+  }
+  // give the host time to echo everything back.
+  sleep(10);
+
+  if(sockstat(fd, &st) < 0){
+    fprintf(2, "rcvbuf: sockstat() failed\n");
+    exit(1);
+  }
+  if(st.rcvbuf != SOCK_RCVBUF_MIN || st.rxqlen != SOCK_RCVBUF_MIN / 4096 ||
+     st.rxpkts != st.rxqlen || st.rxdrops == 0 ||
+     st.rxdropbytes != st.rxdrops * sizeof(obuf)){
+    fprintf(2, "rcvbuf: bad counters: qlen %d pkts %d drops %d\n",
+            st.rxqlen, (int)st.rxpkts, (int)st.rxdrops);
+    exit(1);
+  }
+
+  for(int i = 0; i < st.rxqlen; i++){
+    if(read(fd, ibuf, sizeof(ibuf)) != sizeof(obuf)){
+      fprintf(2, "rcvbuf: recv() failed\n");
+      exit(1);
+    }
+  }
+  if(sockstat(fd, &st) < 0 || st.rxqlen != 0 || st.rxqbytes != 0){
+    fprintf(2, "rcvbuf: queue not drained\n");
+    exit(1);
+  }
+  close(fd);
+}
+
+//
+// send a batch of pings with one sendmmsg() and collect
+// the echoes with recvmmsg().
+//
+static void
+mmsg(uint16 sport, uint16 dport)
+{
+  #define NMSG 8
+  int fd, n, got;
+  char obuf[NMSG][16];
+  char ibuf[NMSG][128];
+  struct mmsg vec[NMSG];
+  uint32 dst;
+
+  dst = (10 << 24) | (0 << 16) | (2 << 8) | (2 << 0);
+  if((fd = connect(dst, sport, dport)) < 0){
+    fprintf(2, "mmsg: connect() failed\n");
+    exit(1);
+  }
+
+  for(int i = 0; i < NMSG; i++){
+    memset(obuf[i], 0, sizeof(obuf[i]));
+    strcpy(obuf[i], "mmsg ping ");
+    obuf[i][10] = 'a' + i;
+    vec[i].buf = (uint64)obuf[i];
+    vec[i].len = 11 + i;
+    vec[i].n = -1;
+  }
+  if(sendmmsg(fd, vec, NMSG) != NMSG){
+    fprintf(2, "mmsg: sendmmsg() failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < NMSG; i++){
+    if(vec[i].n != 11 + i){
+      fprintf(2, "mmsg: sendmmsg() reported %d bytes\n", vec[i].n);
+      exit(1);
+    }
+  }
+
+  // the echoes may trickle in over several calls.
+  for(got = 0; got < NMSG; got += n){
+    for(int i = got; i < NMSG; i++){
+      vec[i].buf = (uint64)ibuf[i];
+      vec[i].len = sizeof(ibuf[i]);
+      vec[i].n = -1;
+    }
+    if((n = recvmmsg(fd, vec + got, NMSG - got)) <= 0){
+      fprintf(2, "mmsg: recvmmsg() failed\n");
+      exit(1);
+    }
+  }
+  for(int i = 0; i < NMSG; i++){
+    if(vec[i].n != 11 + i || memcmp(ibuf[i], obuf[i], vec[i].n) != 0){
+      fprintf(2, "mmsg: bad echo %d\n", i);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+//
+// ping through a socket that takes datagrams from any remote,
+// which must name the destination and learn the sender, and
+// join and leave a multicast group on it.
+//
+static void
+wildcard(uint16 sport, uint16 dport)
+{
+  char obuf[16] = "wildcard ping";
+  char ibuf[128];
+  struct mmsg mm;
+  uint32 dst, group;
+  int fd, fd2;
+
+  dst = (10 << 24) | (0 << 16) | (2 << 8) | (2 << 0);
+  group = (239 << 24) | (1 << 16) | (2 << 8) | (3 << 0);
+  if((fd = connect(0, sport, 0)) < 0 || (fd2 = connect(0, sport, 0)) < 0){
+    fprintf(2, "wildcard: connect() failed\n");
+    exit(1);
+  }
+  close(fd2);
+  if(write(fd, obuf, sizeof(obuf)) >= 0){
+    fprintf(2, "wildcard: write() without a destination succeeded\n");
+    exit(1);
+  }
+
+  mm.buf = (uint64)obuf;
+  mm.len = sizeof(obuf);
+  mm.addr = dst;
+  mm.port = dport;
+  if(sendmmsg(fd, &mm, 1) != 1 || mm.n != sizeof(obuf)){
+    fprintf(2, "wildcard: sendmmsg() failed\n");
+    exit(1);
+  }
+  mm.buf = (uint64)ibuf;
+  mm.len = sizeof(ibuf);
+  mm.addr = mm.port = 0;
+  if(recvmmsg(fd, &mm, 1) != 1 || mm.n != sizeof(obuf) ||
+     memcmp(ibuf, obuf, mm.n) != 0){
+    fprintf(2, "wildcard: recvmmsg() failed\n");
+    exit(1);
+  }
+  if(mm.addr != dst || mm.port != dport){
+    fprintf(2, "wildcard: wrong sender %x port %d\n", mm.addr, mm.port);
+    exit(1);
+  }
+
+  if(setsockopt(fd, SO_JOINGROUP, group) < 0 ||
+     setsockopt(fd, SO_JOINGROUP, group) == 0 ||
+     setsockopt(fd, SO_JOINGROUP, dst) == 0 ||
+     setsockopt(fd, SO_LEAVEGROUP, group) < 0 ||
+     setsockopt(fd, SO_LEAVEGROUP, group) == 0){
+    fprintf(2, "wildcard: SO_JOINGROUP/SO_LEAVEGROUP failed\n");
+    exit(1);
+  }
+  // close() leaves the groups still joined.
+  if(setsockopt(fd, SO_JOINGROUP, group) < 0){
+    fprintf(2, "wildcard: SO_JOINGROUP failed\n");
+    exit(1);
+  }
+  close(fd);
+}
+
+//
+// send datagrams and a TCP stream to ourselves, and fan a
+// multicast datagram out to the sockets in its group.
+//
+static void
+loopback(uint16 port)
+{
+  static char obuf[8000], ibuf[8000];
+  struct sockstat st;
+  uint32 lo, group;
+  int a, b, m1, m2, m3, l, c, s, i, n, cc;
+
+  lo = (127 << 24) | (0 << 16) | (0 << 8) | (1 << 0);
+  group = (239 << 24) | (1 << 16) | (2 << 8) | (3 << 0);
+  for(i = 0; i < sizeof(obuf); i++)
+    obuf[i] = i * 13;
+
+  // large enough to be sent zero-copy, which must not
+  // wait for the receiver.
+  if((a = connect(lo, port, port + 1)) < 0 ||
+     (b = connect(lo, port + 1, port)) < 0){
+    fprintf(2, "loopback: connect() failed\n");
+    exit(1);
+  }
+  if(write(a, obuf, sizeof(obuf)) != sizeof(obuf) ||
+     read(b, ibuf, sizeof(ibuf)) != sizeof(obuf) ||
+     memcmp(obuf, ibuf, sizeof(obuf)) != 0){
+    fprintf(2, "loopback: datagram lost\n");
+    exit(1);
+  }
+  close(a);
+  close(b);
+
+  // m1 and m2 join the group; m3 shares their port but not the group.
+  if((m1 = connect(0, port + 2, 0)) < 0 || (m2 = connect(0, port + 2, 0)) < 0 ||
+     (m3 = connect(0, port + 2, 0)) < 0 || (a = connect(group, port + 3, port + 2)) < 0){
+    fprintf(2, "loopback: connect() failed\n");
+    exit(1);
+  }
+  if(setsockopt(m1, SO_JOINGROUP, group) < 0 || setsockopt(m2, SO_JOINGROUP, group) < 0){
+    fprintf(2, "loopback: SO_JOINGROUP failed\n");
+    exit(1);
+  }
+  if(write(a, obuf, 100) != 100 ||
+     read(m1, ibuf, sizeof(ibuf)) != 100 || memcmp(obuf, ibuf, 100) != 0 ||
+     read(m2, ibuf, sizeof(ibuf)) != 100 || memcmp(obuf, ibuf, 100) != 0){
+    fprintf(2, "loopback: multicast datagram lost\n");
+    exit(1);
+  }
+  if(sockstat(m3, &st) < 0 || st.rxqlen != 0){
+    fprintf(2, "loopback: multicast datagram to a non-member\n");
+    exit(1);
+  }
+  close(a);
+  close(m1);
+  close(m2);
+  close(m3);
+
+  if((l = listen(port + 4, 1)) < 0 || (c = tcpconnect(lo, 0, port + 4, 0)) < 0 ||
+     (s = accept(l)) < 0){
+    fprintf(2, "loopback: TCP connection failed\n");
+    exit(1);
+  }
+  for(i = 0; i < 8; i++){
+    if(write(c, obuf, sizeof(obuf)) != sizeof(obuf)){
+      fprintf(2, "loopback: TCP write() failed\n");
+      exit(1);
+    }
+    for(n = 0; n < sizeof(ibuf); n += cc){
+      if((cc = read(s, ibuf + n, sizeof(ibuf) - n)) <= 0){
+        fprintf(2, "loopback: TCP read() failed\n");
+        exit(1);
+      }
+    }
+    if(memcmp(obuf, ibuf, sizeof(obuf)) != 0){
+      fprintf(2, "loopback: TCP data corrupted\n");
+      exit(1);
+    }
+  }
+  close(c);
+  close(s);
+  close(l);
+}
+
+//
+// fill a TCP receive buffer exactly with a segment that also
+// carries the sender's FIN, and check that the FIN is taken
+// along with the data rather than waiting for a retransmit.
+//
+static void
+tcpfin(uint16 port)
+{
+  static char buf[1460];
+  uint32 lo;
+  int l, c, s, n, cc;
+
+  lo = (127 << 24) | (0 << 16) | (0 << 8) | (1 << 0);
+  if((l = listen(port, 1)) < 0 || (c = tcpconnect(lo, 0, port, 0)) < 0 ||
+     (s = accept(l)) < 0){
+    fprintf(2, "tcpfin: TCP connection failed\n");
+    exit(1);
+  }
+
+  // one segment more than s can hold, so the last byte, and
+  // with it the FIN, can't be sent until s reads that much.
+  for(n = 0; n < SOCK_TCPBUF + sizeof(buf); n += cc){
+    cc = SOCK_TCPBUF + sizeof(buf) - n;
+    if(cc > sizeof(buf))
+      cc = sizeof(buf);
+    if(write(c, buf, cc) != cc){
+      fprintf(2, "tcpfin: write() failed\n");
+      exit(1);
+    }
+  }
+  close(c);
+
+  // at least a segment has been acknowledged, so s holds that
+  // much. the window reopens by just what is read here, and the
+  // data that's left, FIN and all, fills the buffer to the byte.
+  if(read(s, buf, sizeof(buf)) != sizeof(buf)){
+    fprintf(2, "tcpfin: read() failed\n");
+    exit(1);
+  }
+  sleep(1);
+  for(n = sizeof(buf); n < SOCK_TCPBUF + sizeof(buf); n += cc){
+    if((cc = read(s, buf, sizeof(buf))) <= 0){
+      fprintf(2, "tcpfin: read() failed\n");
+      exit(1);
+    }
+  }
+  fcntl(s, F_SETFL, O_NONBLOCK);
+  if(read(s, buf, sizeof(buf)) != 0){
+    fprintf(2, "tcpfin: FIN lost with the data that filled the buffer\n");
+    exit(1);
+  }
+  close(s);
+  close(l);
+}
+
 // Encode a DNS name
 static void
 encode_qname(char *qn, char *host)
@@ -109,6 +436,220 @@ dns_req(uint8 *obuf)
   return len;
 }
 
+//
+// echo a datagram of n bytes, large enough to be sent zero-copy,
+// from a buffer that straddles a page boundary, and check that
+// the payload survived. datagrams larger than the MTU go out and
+// come back in fragments.
+//
+static void
+bigping(uint16 sport, uint16 dport, int n)
+{
+  static char obuf[4*4096], ibuf[3*4096];
+  char *p;
+  uint32 dst;
+  int fd, i, cc;
+
+  dst = (10 << 24) | (0 << 16) | (2 << 8) | (2 << 0);
+  if((fd = connect(dst, sport, dport)) < 0){
+    fprintf(2, "bigping: connect() failed\n");
+    exit(1);
+  }
+  p = (char *)(((uint64)obuf + 4096) & ~4095) - 700;
+  for(i = 0; i < n; i++)
+    p[i] = i * 7;
+  if(write(fd, p, n) != n){
+    fprintf(2, "bigping: send() failed\n");
+    exit(1);
+  }
+  // the kernel is done with p once write() returns.
+  memset(p, 0, n);
+  cc = read(fd, ibuf, sizeof(ibuf));
+  close(fd);
+  if(cc != n){
+    fprintf(2, "bigping: recv() returned %d\n", cc);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(ibuf[i] != (char)(i * 7)){
+      fprintf(2, "bigping: wrong payload at %d\n", i);
+      exit(1);
+    }
+  }
+}
+
+//
+// capture a ping's request and reply with a filter for its
+// source port, and check that nothing else was captured.
+//
+static void
+capture(uint16 sport, uint16 dport)
+{
+  struct pcapinsn filter[] = {
+    { PCAP_LDH, 0, 0, 12 },
+    { PCAP_JEQ, 0, 5, ETHTYPE_IP },
+    { PCAP_LDH, 0, 0, 34 },             // UDP source port
+    { PCAP_JEQ, 2, 0, sport },
+    { PCAP_LDH, 0, 0, 36 },             // UDP destination port
+    { PCAP_JEQ, 0, 1, sport },
+    { PCAP_RET, 0, 0, 64 },
+    { PCAP_RET, 0, 0, 0 },
+  };
+  struct pcapring *ring;
+  struct pcaprec *r;
+  uint8 *udp;
+  int rx, tx;
+
+  ring = pcapopen(filter, sizeof(filter)/sizeof(filter[0]));
+  if(ring == (struct pcapring *)-1){
+    fprintf(2, "capture: pcapopen() failed\n");
+    exit(1);
+  }
+  ping(sport, dport, 1);
+  ping(sport + 1, dport, 1);
+
+  rx = tx = 0;
+  while(ring->tail != ring->head){
+    r = (struct pcaprec *)(PCAP_DATA(ring) + ring->tail % ring->size);
+    if(r->dir != PCAP_PAD){
+      udp = (uint8 *)(r + 1) + sizeof(struct eth) + sizeof(struct ip);
+      if(r->caplen != (r->len < 64 ? r->len : 64) ||
+         ((udp[0] << 8 | udp[1]) != sport && (udp[2] << 8 | udp[3]) != sport)){
+        fprintf(2, "capture: unexpected frame\n");
+        exit(1);
+      }
+      if(r->dir == PCAP_RX)
+        rx++;
+      else
+        tx++;
+      ring->tail += PCAP_RECLEN(r->caplen);
+    } else {
+      ring->tail += ring->size - ring->tail % ring->size;
+    }
+  }
+  if(pcapclose() < 0 || rx != 1 || tx != 1){
+    fprintf(2, "capture: captured %d rx, %d tx\n", rx, tx);
+    exit(1);
+  }
+}
+
+static void
+readstats(struct netstat *st)
+{
+  int fd;
+
+  if((fd = open("netstat", O_RDONLY)) < 0){
+    mknod("netstat", NETSTAT, 0);
+    fd = open("netstat", O_RDONLY);
+  }
+  if(fd < 0 || read(fd, st, sizeof(*st)) != sizeof(*st)){
+    fprintf(2, "stats: cannot read netstat\n");
+    exit(1);
+  }
+  close(fd);
+}
+
+//
+// check that a ping is counted on its way out and back in.
+//
+static void
+stats(uint16 sport, uint16 dport)
+{
+  struct netstat before, after;
+
+  readstats(&before);
+  ping(sport, dport, 1);
+  readstats(&after);
+  if(after.udptx <= before.udptx || after.udprx <= before.udprx ||
+     after.iptx <= before.iptx || after.iprx <= before.iprx ||
+     after.txframes <= before.txframes || after.rxframes <= before.rxframes){
+    fprintf(2, "stats: ping not counted\n");
+    exit(1);
+  }
+}
+
+//
+// trace the latency of a ping's reply through the stack.
+//
+static void
+trace(uint16 sport, uint16 dport)
+{
+  struct nettrace t;
+  int fd, on;
+
+  if((fd = open("nettrace", O_RDWR)) < 0){
+    mknod("nettrace", NETTRACE, 0);
+    fd = open("nettrace", O_RDWR);
+  }
+  on = 1;
+  if(fd < 0 || write(fd, &on, sizeof(on)) != sizeof(on)){
+    fprintf(2, "trace: cannot turn tracing on\n");
+    exit(1);
+  }
+  ping(sport, dport, 1);
+  on = 0;
+  if(write(fd, &on, sizeof(on)) != sizeof(on) ||
+     read(fd, &t, sizeof(t)) != sizeof(t)){
+    fprintf(2, "trace: cannot read nettrace\n");
+    exit(1);
+  }
+  close(fd);
+  if(t.on || t.stages[NTRACE_TOTAL].count != 1 ||
+     t.stages[NTRACE_IP].count != 1 || t.stages[NTRACE_WAKEUP].count != 1 ||
+     t.stages[NTRACE_TOTAL].sum < t.stages[NTRACE_WAKEUP].sum){
+    fprintf(2, "trace: ping not traced\n");
+    exit(1);
+  }
+}
+
+//
+// stream data through server.py's TCP echo service, starting
+// with a non-blocking connect.
+//
+static void
+tcpecho(uint16 dport)
+{
+  static char obuf[1024], ibuf[1024];
+  struct pollfd pfd;
+  uint32 dst;
+  int fd, i, j, n, cc;
+
+  dst = (10 << 24) | (0 << 16) | (2 << 8) | (2 << 0);
+  if((fd = tcpconnect(dst, 0, dport, O_NONBLOCK)) < 0){
+    fprintf(2, "tcpecho: tcpconnect() failed\n");
+    exit(1);
+  }
+  pfd.fd = fd;
+  pfd.events = POLLOUT;
+  if(poll(&pfd, 1, 50) != 1 || pfd.revents != POLLOUT){
+    fprintf(2, "tcpecho: connection not established\n");
+    exit(1);
+  }
+  fcntl(fd, F_SETFL, 0);
+
+  // more than the send and receive buffers hold, a
+  // block at a time so that neither side can stall.
+  for(i = 0; i < 64; i++){
+    for(j = 0; j < sizeof(obuf); j++)
+      obuf[j] = i + j;
+    if(write(fd, obuf, sizeof(obuf)) != sizeof(obuf)){
+      fprintf(2, "tcpecho: write() failed\n");
+      exit(1);
+    }
+    for(n = 0; n < sizeof(ibuf); n += cc){
+      if((cc = read(fd, ibuf + n, sizeof(ibuf) - n)) <= 0){
+        fprintf(2, "tcpecho: read() failed\n");
+        exit(1);
+      }
+    }
+    if(memcmp(obuf, ibuf, sizeof(obuf)) != 0){
+      fprintf(2, "tcpecho: wrong data echoed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
 // Process DNS response
 static void
 dns_rep(uint8 *ibuf, int cc)
@@ -252,6 +793,50 @@ main(int argc, char *argv[])
   }
   printf("OK\n");
   
+  printf("testing receive buffer limits: ");
+  rcvbuf(2000, dport);
+  printf("OK\n");
+
+  printf("testing batched send/recv: ");
+  mmsg(2000, dport);
+  printf("OK\n");
+
+  printf("testing wildcard sockets: ");
+  wildcard(2000, dport);
+  printf("OK\n");
+
+  printf("testing loopback: ");
+  loopback(3000);
+  printf("OK\n");
+
+  printf("testing TCP FIN into a full window: ");
+  tcpfin(3005);
+  printf("OK\n");
+
+  printf("testing zero-copy send: ");
+  bigping(2000, dport, 1400);
+  printf("OK\n");
+
+  printf("testing IP fragmentation: ");
+  bigping(2000, dport, 8000);
+  printf("OK\n");
+
+  printf("testing packet capture: ");
+  capture(2000, dport);
+  printf("OK\n");
+
+  printf("testing network statistics: ");
+  stats(2000, dport);
+  printf("OK\n");
+
+  printf("testing latency tracing: ");
+  trace(2000, dport);
+  printf("OK\n");
+
+  printf("testing TCP echo: ");
+  tcpecho(dport);
+  printf("OK\n");
+
   printf("testing DNS\n");
   dns();
   printf("DNS OK\n");
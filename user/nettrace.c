@@ -0,0 +1,89 @@
+//
+// turn per-packet latency tracing on or off, or print the
+// latency histograms that the kernel has collected.
+//
+// usage: nettrace [on | off]
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/nettrace.h"
+#include "user/user.h"
+
+static char *stagenames[NTRACE_NSTAGES] = {
+  [NTRACE_IP]     "ip",
+  [NTRACE_LOOKUP] "lookup",
+  [NTRACE_WAKEUP] "wakeup",
+  [NTRACE_TOTAL]  "total",
+};
+
+// prints ticks of a clock running at hz as microseconds.
+static void
+printus(uint64 ticks, uint32 hz)
+{
+  printf("%lus", ticks * 1000000 / hz);
+}
+
+static void
+printhist(char *name, struct nettrace_hist *h, uint32 hz)
+{
+  int i;
+
+  printf("%s: %l packets", name, h->count);
+  if(h->count == 0){
+    printf("\n");
+    return;
+  }
+  printf(", mean ");
+  printus(h->sum / h->count, hz);
+  printf(", max ");
+  printus(h->max, hz);
+  printf("\n");
+  for(i = 0; i < NTRACE_NBUCKETS; i++){
+    if(h->buckets[i] == 0)
+      continue;
+    printf("  < ");
+    printus(2ULL << i, hz);
+    printf(": %l\n", h->buckets[i]);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct nettrace t;
+  int fd, i, on;
+
+  if(argc > 2 || (argc == 2 && strcmp(argv[1], "on") != 0 &&
+                  strcmp(argv[1], "off") != 0)){
+    fprintf(2, "usage: nettrace [on | off]\n");
+    exit(1);
+  }
+
+  if((fd = open("nettrace", O_RDWR)) < 0){
+    mknod("nettrace", NETTRACE, 0);
+    fd = open("nettrace", O_RDWR);
+  }
+  if(fd < 0){
+    fprintf(2, "nettrace: cannot open nettrace\n");
+    exit(1);
+  }
+
+  if(argc == 2){
+    on = strcmp(argv[1], "on") == 0;
+    if(write(fd, &on, sizeof(on)) != sizeof(on)){
+      fprintf(2, "nettrace: cannot turn tracing %s\n", argv[1]);
+      exit(1);
+    }
+    exit(0);
+  }
+
+  if(read(fd, &t, sizeof(t)) != sizeof(t)){
+    fprintf(2, "nettrace: cannot read nettrace\n");
+    exit(1);
+  }
+  printf("tracing is %s\n", t.on ? "on" : "off");
+  for(i = 0; i < NTRACE_NSTAGES; i++)
+    printhist(stagenames[i], &t.stages[i], t.hz);
+  exit(0);
+}
@@ -0,0 +1,186 @@
+//
+// print the frames the e1000 sends and receives, as the kernel
+// captures them into the ring that pcapopen() maps.
+//
+// usage: pcapdump [-c count] [-x] [arp | ip | udp | tcp | port n]
+//
+
+#include "kernel/types.h"
+#include "kernel/net.h"
+#include "kernel/pcap.h"
+#include "user/user.h"
+
+#define INSN(c, t, f, kk) { .code = (c), .jt = (t), .jf = (f), .k = (kk) }
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+// frames whose Ethernet type is ETHTYPE_ARP.
+static struct pcapinsn arpfilter[] = {
+  INSN(PCAP_LDH, 0, 0, 12),
+  INSN(PCAP_JEQ, 0, 1, ETHTYPE_ARP),
+  INSN(PCAP_RET, 0, 0, 0xffff),
+  INSN(PCAP_RET, 0, 0, 0),
+};
+
+// frames whose Ethernet type is ETHTYPE_IP.
+static struct pcapinsn ipfilter[] = {
+  INSN(PCAP_LDH, 0, 0, 12),
+  INSN(PCAP_JEQ, 0, 1, ETHTYPE_IP),
+  INSN(PCAP_RET, 0, 0, 0xffff),
+  INSN(PCAP_RET, 0, 0, 0),
+};
+
+// IP packets of protocol protofilter[3].k.
+static struct pcapinsn protofilter[] = {
+  INSN(PCAP_LDH, 0, 0, 12),
+  INSN(PCAP_JEQ, 0, 3, ETHTYPE_IP),
+  INSN(PCAP_LDB, 0, 0, 23),
+  INSN(PCAP_JEQ, 0, 1, 0),
+  INSN(PCAP_RET, 0, 0, 0xffff),
+  INSN(PCAP_RET, 0, 0, 0),
+};
+
+// TCP and UDP to or from port portfilter[6].k (and [8].k),
+// assuming IP headers without options.
+static struct pcapinsn portfilter[] = {
+  INSN(PCAP_LDH, 0, 0, 12),
+  INSN(PCAP_JEQ, 0, 8, ETHTYPE_IP),
+  INSN(PCAP_LDB, 0, 0, 23),
+  INSN(PCAP_JEQ, 1, 0, IPPROTO_TCP),
+  INSN(PCAP_JEQ, 0, 5, IPPROTO_UDP),
+  INSN(PCAP_LDH, 0, 0, 34),
+  INSN(PCAP_JEQ, 2, 0, 0),
+  INSN(PCAP_LDH, 0, 0, 36),
+  INSN(PCAP_JEQ, 0, 1, 0),
+  INSN(PCAP_RET, 0, 0, 0xffff),
+  INSN(PCAP_RET, 0, 0, 0),
+};
+
+static int hexdump;
+
+static uint
+get16(uint8 *p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+static void
+printip(uint8 *p)
+{
+  printf("%d.%d.%d.%d", p[0], p[1], p[2], p[3]);
+}
+
+static void
+printframe(struct pcaprec *r, uint32 hz)
+{
+  uint8 *p = (uint8 *)(r + 1);
+  uint8 *l4;
+  uint type;
+  int i;
+
+  printf("%l.%d %s len %d: ", r->ts / hz, (int)((r->ts % hz) * 1000 / hz),
+         r->dir == PCAP_RX ? "rx" : "tx", r->len);
+  if(r->caplen < sizeof(struct eth)){
+    printf("short\n");
+    return;
+  }
+  type = get16(p + 12);
+  if(type == ETHTYPE_ARP && r->caplen >= sizeof(struct eth) + sizeof(struct arp)){
+    p += sizeof(struct eth);
+    printf("arp %s ", get16(p + 6) == ARP_OP_REQUEST ? "who-has" : "reply");
+    printip(p + 24);
+    printf(" from ");
+    printip(p + 14);
+  } else if(type == ETHTYPE_IP && r->caplen >= sizeof(struct eth) + sizeof(struct ip)){
+    p += sizeof(struct eth);
+    l4 = p + (p[0] & 0xf) * 4;
+    printip(p + 12);
+    printf(" > ");
+    printip(p + 16);
+    if(get16(p + 6) & (IP_MF | IP_OFFMASK))
+      printf(" frag id %d off %d", get16(p + 4), (get16(p + 6) & IP_OFFMASK) * 8);
+    else if(p[9] == IPPROTO_UDP && l4 + 8 <= (uint8 *)(r + 1) + r->caplen)
+      printf(" udp %d > %d len %d", get16(l4), get16(l4 + 2), get16(l4 + 4) - 8);
+    else if(p[9] == IPPROTO_TCP && l4 + 20 <= (uint8 *)(r + 1) + r->caplen)
+      printf(" tcp %d > %d seq %l ack %l flags %x", get16(l4), get16(l4 + 2),
+             (uint64)((get16(l4 + 4) << 16) | get16(l4 + 6)),
+             (uint64)((get16(l4 + 8) << 16) | get16(l4 + 10)), l4[13]);
+    else
+      printf(" proto %d", p[9]);
+  } else {
+    printf("type %x", type);
+  }
+  printf("\n");
+
+  if(hexdump){
+    p = (uint8 *)(r + 1);
+    for(i = 0; i < r->caplen; i++)
+      printf("%x%s", p[i], (i % 16 == 15 || i == r->caplen - 1) ? "\n" : " ");
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct pcapinsn *filter = 0;
+  struct pcapring *ring;
+  struct pcaprec *r;
+  int i, n = 0, count = -1;
+  uint64 drops = 0;
+
+  for(i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-c") == 0 && i + 1 < argc){
+      count = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-x") == 0){
+      hexdump = 1;
+    } else if(strcmp(argv[i], "arp") == 0){
+      filter = arpfilter;
+      n = NELEM(arpfilter);
+    } else if(strcmp(argv[i], "ip") == 0){
+      filter = ipfilter;
+      n = NELEM(ipfilter);
+    } else if(strcmp(argv[i], "udp") == 0 || strcmp(argv[i], "tcp") == 0){
+      protofilter[3].k = argv[i][0] == 'u' ? IPPROTO_UDP : IPPROTO_TCP;
+      filter = protofilter;
+      n = NELEM(protofilter);
+    } else if(strcmp(argv[i], "port") == 0 && i + 1 < argc){
+      portfilter[6].k = portfilter[8].k = atoi(argv[++i]);
+      filter = portfilter;
+      n = NELEM(portfilter);
+    } else {
+      fprintf(2, "usage: pcapdump [-c count] [-x] [arp | ip | udp | tcp | port n]\n");
+      exit(1);
+    }
+  }
+
+  ring = pcapopen(filter, n);
+  if(ring == (struct pcapring *)-1){
+    fprintf(2, "pcapdump: pcapopen failed; is another capture running?\n");
+    exit(1);
+  }
+
+  while(count != 0){
+    if(ring->tail == ring->head && pcapwait() < 0)
+      break;
+    // read head before the records it covers.
+    __sync_synchronize();
+    while(ring->tail != ring->head && count != 0){
+      r = (struct pcaprec *)(PCAP_DATA(ring) + ring->tail % ring->size);
+      if(r->dir == PCAP_PAD){
+        ring->tail += ring->size - ring->tail % ring->size;
+        continue;
+      }
+      printframe(r, ring->hz);
+      // done with the record before the kernel may reuse it.
+      __sync_synchronize();
+      ring->tail += PCAP_RECLEN(r->caplen);
+      if(count > 0)
+        count--;
+    }
+    if(ring->drops != drops){
+      printf("pcapdump: %l frames dropped\n", ring->drops - drops);
+      drops = ring->drops;
+    }
+  }
+  pcapclose();
+  exit(0);
+}
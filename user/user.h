@@ -1,5 +1,13 @@
 struct stat;
 struct rtcdate;
+struct sockstat;
+struct mmsg;
+struct pollfd;
+struct epoll_event;
+struct pcapinsn;
+struct pcapring;
+struct uring;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -28,6 +36,29 @@ int ntas();
 int crash(const char*, int);
 int mount(char*, char *);
 int umount(char*);
+int setsockopt(int, int, int);
+int sockstat(int, struct sockstat*);
+int sendmmsg(int, struct mmsg*, int);
+int recvmmsg(int, struct mmsg*, int);
+int poll(struct pollfd*, int, int);
+int epoll_create(void);
+int epoll_ctl(int, int, int, struct epoll_event*);
+int epoll_wait(int, struct epoll_event*, int, int);
+int pipe2(int*, int);
+int fcntl(int, int, int);
+int tcpconnect(uint32, uint16, uint16, int);
+int listen(uint16, int);
+int accept(int);
+struct pcapring* pcapopen(struct pcapinsn*, int);
+int pcapwait(void);
+int pcapclose(void);
+int megapages(int);
+struct uring* uringsetup(void);
+int uringenter(int);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -4,9 +4,14 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/poll.h"
+#include "kernel/errno.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/vdso.h"
+#include "kernel/uring.h"
+#include "kernel/uio.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -389,6 +394,209 @@ pipe1(char *s)
   }
 }
 
+// poll() on several pipes: timeouts, readiness, and hang-up.
+void
+pollpipe(char *s)
+{
+  int a[2], b[2], pid, xstatus;
+  struct pollfd pfd[3];
+  char c;
+
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pfd[0].fd = a[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = b[0];
+  pfd[1].events = POLLIN;
+  pfd[2].fd = a[1];
+  pfd[2].events = POLLOUT;
+
+  // nothing to read yet, but a[1] is writable.
+  if(poll(pfd, 3, 0) != 1 || pfd[0].revents || pfd[1].revents ||
+     pfd[2].revents != POLLOUT){
+    printf("%s: poll on empty pipes\n", s);
+    exit(1);
+  }
+  if(poll(pfd, 2, 2) != 0){
+    printf("%s: poll did not time out\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(2);
+    write(b[1], "x", 1);
+    exit(0);
+  }
+  if(poll(pfd, 2, -1) != 1 || pfd[0].revents || pfd[1].revents != POLLIN){
+    printf("%s: poll missed a write\n", s);
+    exit(1);
+  }
+  if(read(b[0], &c, 1) != 1 || c != 'x'){
+    printf("%s: read after poll\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+
+  close(b[1]);
+  if(poll(pfd, 2, -1) != 1 || pfd[1].revents != POLLHUP){
+    printf("%s: poll missed a hang-up\n", s);
+    exit(1);
+  }
+  pfd[0].fd = 100;
+  if(poll(pfd, 1, 0) != 1 || pfd[0].revents != POLLNVAL){
+    printf("%s: poll on a bad fd\n", s);
+    exit(1);
+  }
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+}
+
+// epoll over pipes, level- and edge-triggered.
+void
+epollpipe(char *s)
+{
+  int a[2], b[2], ep, pid, xstatus;
+  struct epoll_event ev, evs[4];
+  char c;
+
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if((ep = epoll_create()) < 0){
+    printf("%s: epoll_create() failed\n", s);
+    exit(1);
+  }
+  ev.events = EPOLLIN;
+  ev.data = 'a';
+  if(epoll_ctl(ep, EPOLL_CTL_ADD, a[0], &ev) < 0){
+    printf("%s: epoll_ctl() failed\n", s);
+    exit(1);
+  }
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data = 'b';
+  if(epoll_ctl(ep, EPOLL_CTL_ADD, b[0], &ev) < 0 ||
+     epoll_ctl(ep, EPOLL_CTL_ADD, b[0], &ev) == 0){
+    printf("%s: epoll_ctl() add twice\n", s);
+    exit(1);
+  }
+  if(epoll_wait(ep, evs, 4, 0) != 0 || epoll_wait(ep, evs, 4, 2) != 0){
+    printf("%s: epoll_wait() on empty pipes\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(2);
+    write(a[1], "xy", 2);
+    write(b[1], "xy", 2);
+    exit(0);
+  }
+  wait(&xstatus);
+
+  // both are reported once.
+  if(epoll_wait(ep, evs, 4, -1) != 2 ||
+     evs[0].data + evs[1].data != 'a' + 'b' ||
+     evs[0].events != EPOLLIN || evs[1].events != EPOLLIN){
+    printf("%s: epoll_wait() missed events\n", s);
+    exit(1);
+  }
+  // a is level-triggered and still has data; b is edge-triggered.
+  if(epoll_wait(ep, evs, 4, 0) != 1 || evs[0].data != 'a'){
+    printf("%s: epoll_wait() trigger modes\n", s);
+    exit(1);
+  }
+  read(a[0], &c, 1);
+  read(a[0], &c, 1);
+  if(epoll_wait(ep, evs, 4, 0) != 0){
+    printf("%s: epoll_wait() after drain\n", s);
+    exit(1);
+  }
+  // new data re-arms the edge-triggered fd.
+  write(b[1], "z", 1);
+  if(epoll_wait(ep, evs, 4, 0) != 1 || evs[0].data != 'b'){
+    printf("%s: epoll_wait() edge re-arm\n", s);
+    exit(1);
+  }
+
+  if(epoll_ctl(ep, EPOLL_CTL_DEL, b[0], 0) < 0){
+    printf("%s: epoll_ctl() del\n", s);
+    exit(1);
+  }
+  write(b[1], "z", 1);
+  if(epoll_wait(ep, evs, 4, 0) != 0){
+    printf("%s: epoll_wait() after del\n", s);
+    exit(1);
+  }
+  close(ep);
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+  close(b[1]);
+}
+
+// O_NONBLOCK pipes: -EAGAIN when empty or full, partial writes,
+// and fcntl() to switch modes.
+void
+nonblockpipe(char *s)
+{
+  int fds[2], n, total;
+  char buf[128];
+
+  if(pipe2(fds, O_NONBLOCK) != 0){
+    printf("%s: pipe2() failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_GETFL, 0) != O_NONBLOCK){
+    printf("%s: F_GETFL\n", s);
+    exit(1);
+  }
+  if(read(fds[0], buf, sizeof(buf)) != -EAGAIN){
+    printf("%s: read of empty pipe did not fail with EAGAIN\n", s);
+    exit(1);
+  }
+
+  // fill the pipe; the last write is cut short, then nothing fits.
+  memset(buf, 'x', sizeof(buf));
+  total = 0;
+  while((n = write(fds[1], buf, 100)) > 0)
+    total += n;
+  if(n != -EAGAIN || total == 0 || total % 100 == 0){
+    printf("%s: filling pipe: n %d total %d\n", s, n, total);
+    exit(1);
+  }
+  while((n = read(fds[0], buf, sizeof(buf))) > 0)
+    total -= n;
+  if(n != -EAGAIN || total != 0){
+    printf("%s: draining pipe: n %d left %d\n", s, n, total);
+    exit(1);
+  }
+
+  // back to blocking: a read now sees end-of-file.
+  if(fcntl(fds[0], F_SETFL, 0) != 0 || fcntl(fds[0], F_GETFL, 0) != 0){
+    printf("%s: F_SETFL\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  if(read(fds[0], buf, sizeof(buf)) != 0){
+    printf("%s: read after close\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(char *s)
@@ -1796,6 +2004,549 @@ sbrkarg(char *s)
   } 
 }
 
+// do system calls given user addresses that are unmapped, or
+// that run off the end of memory, fail rather than fault in
+// the kernel?
+void
+badcopy(char *s)
+{
+  char *bad[3], *end, buf[100];
+  int fds[2], i;
+
+  end = sbrk(PGSIZE) + PGSIZE;
+  bad[0] = end + 10*PGSIZE;
+  bad[1] = end - 10;
+  bad[2] = (char *)0x0c000000 - 8;
+
+  memset(buf, 'x', sizeof(buf));
+  for(i = 0; i < 3; i++){
+    if(open(bad[i] + 10, 0) != -1){
+      printf("%s: open %p succeeded\n", s, bad[i] + 10);
+      exit(1);
+    }
+    if(pipe((int *)(bad[i] + 8)) != -1){
+      printf("%s: pipe %p succeeded\n", s, bad[i] + 8);
+      exit(1);
+    }
+    if(pipe(fds) != 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    if(write(fds[1], bad[i], sizeof(buf)) == sizeof(buf)){
+      printf("%s: write from %p succeeded\n", s, bad[i]);
+      exit(1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    if(pipe(fds) != 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    write(fds[1], buf, sizeof(buf));
+    if(read(fds[0], bad[i], sizeof(buf)) == sizeof(buf)){
+      printf("%s: read to %p succeeded\n", s, bad[i]);
+      exit(1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+  }
+}
+
+// sbrk() with megapages: fork copies them, and shrinking into
+// the middle of one keeps the rest.
+void
+megapagetest(char *s)
+{
+  enum { MEGA = 2*1024*1024 };
+  char *a, *p, buf[9];
+  uint64 top;
+  int fds[2], pid, xstatus;
+
+  top = (uint64)sbrk(0);
+  sbrk(((top + MEGA - 1) & ~(MEGA - 1)) - top);
+  megapages(1);
+  a = sbrk(2*MEGA + 3*PGSIZE);
+  if(a == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  if(megapages(0) != 1){
+    printf("%s: megapages was off\n", s);
+    exit(1);
+  }
+  for(p = a; p < a + 2*MEGA + 3*PGSIZE; p += PGSIZE)
+    *p = (p - a) / PGSIZE;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + 2*MEGA + 3*PGSIZE; p += PGSIZE)
+      if(*p != (char)((p - a) / PGSIZE))
+        exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw the wrong memory\n", s);
+    exit(1);
+  }
+
+  sbrk(-(MEGA/2 + 3*PGSIZE));
+  for(p = a; p < a + MEGA + MEGA/2; p += PGSIZE){
+    if(*p != (char)((p - a) / PGSIZE)){
+      printf("%s: lost memory at %p\n", s, p);
+      exit(1);
+    }
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    a[2*MEGA - PGSIZE] = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: memory past the break is still there\n", s);
+    exit(1);
+  }
+
+  // copyout() across the boundary between megapages.
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  write(fds[1], "megapage", 9);
+  if(read(fds[0], a + MEGA - 4, 9) != 9 || strcmp(a + MEGA - 4, "megapage") != 0){
+    printf("%s: read into megapages failed\n", s);
+    exit(1);
+  }
+  write(fds[1], a + MEGA - 4, 9);
+  if(read(fds[0], buf, 9) != 9 || strcmp(buf, "megapage") != 0){
+    printf("%s: write from megapages failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// program pages that no one touches until the test.
+static const char lazyro[3*PGSIZE] = { [0] = 'r', [2*PGSIZE] = 'o' };
+static char lazydata[3*PGSIZE] = { [0] = 'd', [2*PGSIZE] = 'a' };
+static char lazybss[3*PGSIZE];
+
+// exec() leaves the program's pages to be loaded as they are
+// touched, including by system calls, and keeps text and
+// read-only data read-only.
+void
+lazyexec(char *s)
+{
+  int fds[2], pid, xstatus;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], &lazyro[2*PGSIZE], 1) != 1 ||
+     read(fds[0], &lazybss[PGSIZE], 1) != 1 || lazybss[PGSIZE] != 'o'){
+    printf("%s: copy from rodata to bss failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], &lazydata[2*PGSIZE], 1) != 1 ||
+     read(fds[0], &lazydata[PGSIZE], 1) != 1 || lazydata[PGSIZE] != 'a' ||
+     lazydata[0] != 'd'){
+    printf("%s: copy within data failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    *(volatile char *)&lazyro[PGSIZE] = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1 || lazyro[0] != 'r'){
+    printf("%s: wrote to rodata\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    *(volatile char *)(uint64)lazyexec = 0;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: wrote to text\n", s);
+    exit(1);
+  }
+}
+
+// reads come from the page cache, and writes, even across a
+// page boundary, show up in it.
+void
+pagecache(char *s)
+{
+  enum { N = 40 };
+  int fd, i, pass;
+
+  unlink("pagecache.test");
+  fd = open("pagecache.test", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    memset(buf, i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  // the second pass is from the cache.
+  for(pass = 0; pass < 2; pass++){
+    fd = open("pagecache.test", 0);
+    for(i = 0; i < N; i++){
+      if(read(fd, buf, BSIZE) != BSIZE || buf[0] != i || buf[BSIZE-1] != i){
+        printf("%s: read block %d wrong\n", s, i);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+
+  fd = open("pagecache.test", O_RDWR);
+  if(read(fd, buf, PGSIZE - 1) != PGSIZE - 1 || write(fd, "xy", 2) != 2){
+    printf("%s: overwrite failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("pagecache.test", 0);
+  if(read(fd, buf, 2*PGSIZE) != 2*PGSIZE){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(buf[PGSIZE-2] != PGSIZE/BSIZE - 1 || buf[PGSIZE-1] != 'x' ||
+     buf[PGSIZE] != 'y' || buf[PGSIZE+1] != PGSIZE/BSIZE){
+    printf("%s: overwrite not seen\n", s);
+    exit(1);
+  }
+  unlink("pagecache.test");
+}
+
+// grow until sbrk() fails, past the end of memory if there is
+// swap, and find every page intact.
+void
+swapmuch(char *s)
+{
+  enum { MB = 1024*1024 };
+  char *a, *p, *top;
+
+  a = sbrk(0);
+  for(top = a; sbrk(MB) != (char*)-1; top += MB)
+    for(p = top; p < top + MB; p += PGSIZE)
+      *(uint64*)p = (uint64)p / PGSIZE;
+  if(top - a < 2*MB){
+    printf("%s: sbrk failed early\n", s);
+    exit(1);
+  }
+  for(p = a; p < top; p += PGSIZE){
+    if(*(uint64*)p != (uint64)p / PGSIZE){
+      printf("%s: page %p lost\n", s, p);
+      exit(1);
+    }
+  }
+  sbrk(-(top - a));
+}
+
+// getpid() is answered in uservec, and uptime() from the vDSO
+// page, which processes can't write.
+void
+vdsotest(char *s)
+{
+  int fds[2], pid, cpid, xstatus;
+  uint t;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    cpid = getpid();
+    write(fds[1], &cpid, sizeof(cpid));
+    exit(0);
+  }
+  if(read(fds[0], &cpid, sizeof(cpid)) != sizeof(cpid) || cpid != pid){
+    printf("%s: child's getpid() %d, not %d\n", s, cpid, pid);
+    exit(1);
+  }
+  wait(0);
+  close(fds[0]);
+  close(fds[1]);
+
+  t = uptime();
+  sleep(2);
+  if(uptime() < t + 2){
+    printf("%s: uptime() didn't advance\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    ((volatile struct vdso*)VDSO)->ticks = 0;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: wrote the vDSO page\n", s);
+    exit(1);
+  }
+}
+
+// queues a call on the ring.
+static void
+uringpush(struct uring *r, int op, int fd, void *addr, int len, int data)
+{
+  struct uringsqe *e = &r->sq[r->sqtail % URING_ENTRIES];
+
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint64)addr;
+  e->len = len;
+  e->data = data;
+  __sync_synchronize();
+  r->sqtail++;
+}
+
+// takes the next completion off the ring, and checks that it is
+// for the call with data, and that the call returned res.
+static int
+uringpop(struct uring *r, int data, char *s)
+{
+  struct uringcqe *c;
+  int res;
+
+  if(r->cqhead == r->cqtail){
+    printf("%s: no completion for %d\n", s, data);
+    exit(1);
+  }
+  __sync_synchronize();
+  c = &r->cq[r->cqhead % URING_ENTRIES];
+  if(c->data != data){
+    printf("%s: completion for %d, not %d\n", s, (int)c->data, data);
+    exit(1);
+  }
+  res = c->res;
+  r->cqhead++;
+  return res;
+}
+
+// open, write, read and close a file through the rings, several
+// calls per uringenter().
+void
+uringtest(char *s)
+{
+  struct uring *r;
+  char buf[8];
+  int fd, i;
+
+  if((r = uringsetup()) == (struct uring*)-1){
+    printf("%s: uringsetup failed\n", s);
+    exit(1);
+  }
+  if(uringsetup() != (struct uring*)-1){
+    printf("%s: second uringsetup succeeded\n", s);
+    exit(1);
+  }
+
+  uringpush(r, URING_OPEN, 0, "uringf", O_CREATE|O_RDWR, 0);
+  if(uringenter(1) != 1 || (fd = uringpop(r, 0, s)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 4; i++)
+    uringpush(r, URING_WRITE, fd, "uring!", 6, i + 1);
+  uringpush(r, URING_CLOSE, fd, 0, 0, 5);
+  uringpush(r, URING_READ, fd, buf, sizeof(buf), 6);
+  if(uringenter(URING_ENTRIES) != 6){
+    printf("%s: uringenter didn't do all six\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 4; i++){
+    if(uringpop(r, i + 1, s) != 6){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  if(uringpop(r, 5, s) != 0 || uringpop(r, 6, s) != -1){
+    printf("%s: close, or read after it, wrong\n", s);
+    exit(1);
+  }
+
+  uringpush(r, URING_OPEN, 0, "uringf", O_RDONLY, 7);
+  if(uringenter(1) != 1 || (fd = uringpop(r, 7, s)) < 0){
+    printf("%s: reopen failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 4; i++){
+    uringpush(r, URING_READ, fd, buf, 6, 8);
+    if(uringenter(1) != 1 || uringpop(r, 8, s) != 6 || memcmp(buf, "uring!", 6) != 0){
+      printf("%s: read back wrong\n", s);
+      exit(1);
+    }
+  }
+  uringpush(r, URING_READ, fd, buf, 6, 9);
+  uringpush(r, URING_CLOSE, fd, 0, 0, 10);
+  if(uringenter(2) != 2 || uringpop(r, 9, s) != 0 || uringpop(r, 10, s) != 0){
+    printf("%s: read at the end, or close, wrong\n", s);
+    exit(1);
+  }
+  unlink("uringf");
+}
+
+// writev() a header and payload, and read them back with
+// readv() and pread(); pwrite() and pread() leave the file
+// offset alone.
+void
+iovtest(char *s)
+{
+  struct iovec iov[3];
+  char hdr[4], body[8], tail[2];
+  int fd, fds[2];
+
+  fd = open("iovf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  iov[0].base = (uint64)"HDR:";
+  iov[0].len = 4;
+  iov[1].base = 0;
+  iov[1].len = 0;
+  iov[2].base = (uint64)"payload!";
+  iov[2].len = 8;
+  if(writev(fd, iov, 3) != 12){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "pl", 2, 4) != 2 || write(fd, "xy", 2) != 2){
+    printf("%s: pwrite, or write after it, failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, body, 8, 4) != 8 || memcmp(body, "plyload!", 8) != 0){
+    printf("%s: pread read the wrong bytes\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("iovf", O_RDONLY);
+  iov[0].base = (uint64)hdr;
+  iov[0].len = sizeof(hdr);
+  iov[1].base = (uint64)body;
+  iov[1].len = sizeof(body);
+  iov[2].base = (uint64)tail;
+  iov[2].len = sizeof(tail);
+  if(readv(fd, iov, 3) != 14 || memcmp(hdr, "HDR:", 4) != 0 ||
+     memcmp(body, "plyload!", 8) != 0 || memcmp(tail, "xy", 2) != 0){
+    printf("%s: readv read the wrong bytes\n", s);
+    exit(1);
+  }
+  if(readv(fd, iov, 3) != 0){
+    printf("%s: readv past the end\n", s);
+    exit(1);
+  }
+  if(readv(fd, iov, UIO_MAXIOV + 1) != -1){
+    printf("%s: readv took too many buffers\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("iovf");
+
+  // pipes have no offsets; readv() doesn't wait to fill
+  // every buffer.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fds[1], "x", 1, 0) != -1){
+    printf("%s: pwrite on a pipe\n", s);
+    exit(1);
+  }
+  write(fds[1], "HDR:", 4);
+  if(readv(fds[0], iov, 3) != 4 || memcmp(hdr, "HDR:", 4) != 0){
+    printf("%s: readv on a pipe\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// a process can have NOFILE descriptors open, allocated lowest
+// first, and its child inherits them all.
+void
+manyfds(char *s)
+{
+  int fd, last, pid, xstatus;
+
+  for(last = -1; (fd = dup(0)) >= 0; last = fd)
+    ;
+  if(last != NOFILE - 1){
+    printf("%s: dup stopped at fd %d\n", s, last);
+    exit(1);
+  }
+  close(100);
+  close(7);
+  if(dup(0) != 7 || dup(0) != 100 || dup(0) != -1){
+    printf("%s: dup didn't take the lowest fd\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(close(NOFILE - 1) != 0 || dup(0) != NOFILE - 1)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child lacked the fds\n", s);
+    exit(1);
+  }
+  for(fd = 3; fd < NOFILE; fd++)
+    close(fd);
+}
+
 void
 validatetest(char *s)
 {
@@ -1962,6 +2713,51 @@ stacktest(char *s)
     exit(xstatus);
 }
 
+// the kernel can't copy to or from the guard page beneath the
+// user stack either.
+void
+guardcopy(char *s)
+{
+  char *guard = (char *) PGROUNDDOWN(r_sp()) - PGSIZE;
+  char buf[8];
+  struct stat st;
+  int fds[2];
+
+  if(pipe((int *) guard) != -1 || fstat(0, (struct stat *) guard) != -1){
+    printf("%s: copied out to the guard page\n", s);
+    exit(1);
+  }
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  write(fds[1], guard, sizeof(buf));
+  close(fds[1]);
+  if(read(fds[0], buf, sizeof(buf)) != 0){
+    printf("%s: write() from the guard page\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  write(fds[1], "x", 1);
+  if(read(fds[0], guard, 1) != 0){
+    printf("%s: read() into the guard page\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  if(fstat(0, &st) != 0){
+    printf("%s: fstat failed\n", s);
+    exit(1);
+  }
+}
+
 // regression test. copyin(), copyout(), and copyinstr() used to cast
 // the virtual page address to uint, which (with certain wild system
 // call arguments) resulted in a kernel page faults.
@@ -2151,8 +2947,18 @@ main(int argc, char *argv[])
     {kernmem, "kernmem"},
     {sbrkfail, "sbrkfail"},
     {sbrkarg, "sbrkarg"},
+    {badcopy, "badcopy"},
+    {megapagetest, "megapages"},
+    {lazyexec, "lazyexec"},
+    {pagecache, "pagecache"},
+    {swapmuch, "swapmuch"},
+    {vdsotest, "vdso"},
+    {uringtest, "uring"},
+    {iovtest, "iov"},
+    {manyfds, "manyfds"},
     {validatetest, "validatetest"},
     {stacktest, "stacktest"},
+    {guardcopy, "guardcopy"},
     {opentest, "opentest"},
     {writetest, "writetest"},
     {writebig, "writebig"},
@@ -2162,6 +2968,9 @@ main(int argc, char *argv[])
     {iputtest, "iput"},
     {mem, "mem"},
     {pipe1, "pipe1"},
+    {pollpipe, "pollpipe"},
+    {epollpipe, "epollpipe"},
+    {nonblockpipe, "nonblockpipe"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
     {rmdot, "rmdot"},
@@ -35,6 +35,28 @@ entry("dup");
 entry("getpid");
 entry("sbrk");
 entry("sleep");
-entry("uptime");
 entry("connect");
 entry("ntas");
+entry("setsockopt");
+entry("sockstat");
+entry("sendmmsg");
+entry("recvmmsg");
+entry("poll");
+entry("epoll_create");
+entry("epoll_ctl");
+entry("epoll_wait");
+entry("pipe2");
+entry("fcntl");
+entry("tcpconnect");
+entry("listen");
+entry("accept");
+entry("pcapopen");
+entry("pcapwait");
+entry("pcapclose");
+entry("megapages");
+entry("uringsetup");
+entry("uringenter");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");